@@ -1,6 +1,8 @@
 #ifndef _COLORER_HRCPARSER_H_
 #define _COLORER_HRCPARSER_H_
 
+#include <iosfwd>
+#include <vector>
 #include <colorer/FileType.h>
 #include <colorer/Region.h>
 #include <colorer/xml/XmlInputSource.h>
@@ -20,6 +22,29 @@ public:
 };
 
 
+/** Search statistics of the HRC rule, collected by
+    the text parsers with the profiling turned on.
+    @ingroup colorer
+*/
+struct RuleProfile
+{
+  /** Searched part of the rule */
+  enum RuleKind { RK_REGEXP, RK_BLOCK_START, RK_BLOCK_END, RK_KEYWORDS };
+
+  const Scheme* scheme;
+  /** Position of the rule in the scheme, starting from 1 */
+  int rule;
+  RuleKind kind;
+  /** HRC file, which defines the scheme */
+  const String* location;
+  long long attempts;
+  long long matches;
+  /** Backtracking steps of the RE matching */
+  long long steps;
+  /** Search time in nanoseconds */
+  long long time;
+};
+
 /** Abstract template of HRCParser class implementation.
     Defines basic operations of loading and accessing
     HRC information.
@@ -76,6 +101,49 @@ public:
   */
   virtual const String *getVersion() = 0;
 
+  /** Returns statistics of the rules of the loaded schemes,
+      which were searched by the text parsers with profiling.
+      @see TextParser#setProfiling
+  */
+  virtual void getRuleProfiles(std::vector<RuleProfile> &profiles) {};
+  /** Clears the collected statistics of all the rules.
+  */
+  virtual void resetRuleProfiles() {};
+
+  /** Loads all the types and writes precompiled binary image of the database.
+      Image could be loaded with #loadImage() instead of the HRC files.
+      @return false, if the image is not supported or the stream has failed
+  */
+  virtual bool saveImage(std::ostream &stream) { return false; };
+  /** Loads database from the image file, written by #saveImage().
+      File is mapped into memory, types are built from it on the first request.
+      Database must be empty before the loading.
+      @return false, if the image can't be loaded, database is not changed in this case
+  */
+  virtual bool loadImage(const String *path) { return false; };
+
+  /** Sets number of threads, used by #preloadSources() and #loadAllTypes().
+      1 (default) - HRC is loaded sequentially, 0 - number of the processor cores.
+  */
+  virtual void setLoadThreads(int threads) {};
+  /** Reads and parses the HRC files in parallel with the load threads.
+      Files are parsed in batches, ahead of the following #loadSource() calls and
+      loads of the types, defined in these files, which use the parsed documents.
+      So the database is changed in their order only, and only a few documents
+      are kept in memory. Sources should be listed in the order of their loading.
+  */
+  virtual void preloadSources(const std::vector<XmlInputSource*> &sources) {};
+  /** Loads all the types and packages of the database.
+      With several load threads the files of the types are parsed and their
+      regexps and keyword lists are compiled in parallel.
+  */
+  virtual void loadAllTypes()
+  {
+    for (int idx = 0; enumerateFileTypes(idx) != nullptr; idx++) {
+      enumerateFileTypes(idx)->getBaseScheme();
+    }
+  };
+
   virtual ~HRCParser(){};
 protected:
   HRCParser(){};
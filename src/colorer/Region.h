@@ -2,6 +2,7 @@
 #define _COLORER_REGION_H_
 
 #include <colorer/Common.h>
+#include <colorer/unicode/AtomTable.h>
 
 /**
   HRC Region implementation.
@@ -21,6 +22,11 @@ public:
   {
     return name;
   }
+  /** Interned region name, regions are compared and looked up by it */
+  const Atom* getAtom() const
+  {
+    return name;
+  }
   /** Region description */
   virtual const String* getDescription() const
   {
@@ -59,7 +65,7 @@ public:
   */
   Region(const String* _name, const String* _description, const Region* _parent, int _id)
   {
-    name = new SString(_name);
+    name = AtomTable::intern(*_name);
     description = nullptr;
     if (_description != nullptr) {
       description = new SString(_description);
@@ -70,13 +76,13 @@ public:
 
   virtual ~Region()
   {
-    delete name;
     delete description;
   }
 
 protected:
   /** Internal members */
-  String* name, *description;
+  const Atom* name;
+  String* description;
   const Region* parent;
   int id;
 };
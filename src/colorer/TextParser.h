@@ -1,6 +1,7 @@
 #ifndef _COLORER_TEXTPARSER_H_
 #define _COLORER_TEXTPARSER_H_
 
+#include <iosfwd>
 #include <colorer/FileType.h>
 #include <colorer/LineSource.h>
 #include <colorer/RegionHandler.h>
@@ -77,6 +78,54 @@ public:
    */
   virtual int parse(int from, int num, TextParseMode mode) = 0;
 
+  /**
+   * Starts cachable text parse, which is performed step by step
+   * with #parseStep calls. Parameters are the same, as in #parse.
+   * Suspended parse, if any, is stopped.
+   * Default implementation makes the whole parse on the first step.
+   */
+  virtual void startParse(int from, int num, TextParseMode mode)
+  {
+    stepFrom = from;
+    stepNum = num;
+    stepMode = mode;
+    stepStarted = true;
+  };
+
+  /**
+   * Continues the parse, started with #startParse.
+   * When the time is over, parse is suspended before the next text line.
+   * Parser state and the built cache are kept for the next step.
+   * At least one line is parsed at each step.
+   * @param time Time of the step in milliseconds, negative - no limit.
+   * @return -1, if the parse is suspended, otherwise the parse is finished
+   *         and the result is the same, as returned by #parse.
+   */
+  virtual int parseStep(int time)
+  {
+    if (!stepStarted) {
+      return -1;
+    }
+    stepStarted = false;
+    return parse(stepFrom, stepNum, stepMode);
+  };
+
+  /**
+   * Finishes the suspended parse before the next unparsed line.
+   * Text lines are not requested anymore, so the parse can be stopped
+   * after the text modification. Parsed lines are kept in the cache.
+   * @return Result of the parse, the same as returned by #parse,
+   *         or -1, if there is no suspended parse.
+   */
+  virtual int stopParse()
+  {
+    if (!stepStarted) {
+      return -1;
+    }
+    stepStarted = false;
+    return stepFrom;
+  };
+
   /**
    * Performs break of parsing process from external thread.
    * It is used to stop parse from external source. This is required
@@ -93,8 +142,99 @@ public:
   virtual ~TextParser() {};
   
   virtual void setMaxBlockSize(int max_block_size){};
+
+  /**
+   * Limits backtracking of the regular expressions, so
+   * the parse time of pathological lines is bounded.
+   * RE match, which exceeds the limit, fails.
+   * @param match_limit Maximum backtracking steps of a single RE match, 0 - no limit.
+   * @param line_limit  Maximum backtracking steps of all RE matches in a text line, 0 - no limit.
+   */
+  virtual void setStepLimits(int match_limit, int line_limit){};
+
+  /**
+   * Returns the number of RE matches, stopped by the step limits
+   * since the parser creation.
+   */
+  virtual int getStepLimitHits(){ return 0; };
+
+  /**
+   * Allows cache update parse of the large text to be split into chunks,
+   * which are parsed speculatively in the parallel threads. Chunk result is
+   * used, if the parser state at the chunk start is the same, as the
+   * speculative one, otherwise the chunk is parsed again until the states
+   * converge. Results are passed to RegionHandler from the calling thread
+   * in the usual order.
+   * @note LineSource must allow concurrent #LineSource::getLine calls,
+   *       and the returned lines must be valid until the parse end.
+   * @param threads Maximum number of parse threads, 1 - parallel parse is off.
+   */
+  virtual void setParseThreads(int threads){};
+
+  /**
+   * Turns on collection of the search statistics of the HRC rules:
+   * number of the attempts, matches, RE backtracking steps and time.
+   * Statistics are shared by all the parsers of the HRC and are
+   * available with HRCParser#getRuleProfiles.
+   */
+  virtual void setProfiling(bool enable){};
+
+  /**
+   * Informs parser, that the text below the specified line is not changed
+   * since the last cache update, except the lines, moved with
+   * #linesInserted and #linesDeleted calls.
+   * Next TPM_CACHE_UPDATE parse stops at the line, where the parser state
+   * converges with the cached one, and keeps the rest of the cache.
+   * In this case parse returns the last line, covered by the cache.
+   * Information is used only by the next cache update.
+   * @param line Last changed line of text, -1 - no changed lines.
+   */
+  virtual void setLastChangedLine(int line){};
+
+  /**
+   * Moves cached parse information of the lines after insertion point.
+   * Text from the first inserted line becomes invalid.
+   * @param at    Line number of the first inserted line
+   * @param count Number of inserted lines
+   */
+  virtual void linesInserted(int at, int count){};
+
+  /**
+   * Moves cached parse information of the lines after deleted ones.
+   * Text from the first deleted line becomes invalid.
+   * @param at    Line number of the first deleted line
+   * @param count Number of deleted lines
+   */
+  virtual void linesDeleted(int at, int count){};
+
+  /**
+   * Writes the parse cache into the binary snapshot. Snapshot is bound
+   * to the text with the hash of the cached lines, so it is loaded for
+   * the same text only.
+   * @param stream   Output stream
+   * @param key      Identification of the HRC and the file type, checked on load
+   * @param lastLine Last line of text, which cache is valid
+   * @return false, if there is no cache to write, or the stream has failed
+   */
+  virtual bool saveCache(std::ostream& stream, const String* key, int lastLine){ return false; };
+
+  /**
+   * Replaces the parse cache with the snapshot, written by #saveCache.
+   * TPM_CACHE_READ parse of the loaded lines could be started from any line.
+   * @param stream Input stream
+   * @param key    Identification of the HRC and the file type
+   * @return Last line, covered by the loaded cache, or -1, if the snapshot
+   *         is made for another text, HRC or file type. Cache is empty in this case.
+   */
+  virtual int loadCache(std::istream& stream, const String* key){ return -1; };
 protected:
   TextParser() {};
+private:
+  // parameters of the parse, started with the default #startParse
+  int stepFrom = 0;
+  int stepNum = 0;
+  TextParseMode stepMode = TPM_CACHE_OFF;
+  bool stepStarted = false;
 };
 
 #endif
@@ -0,0 +1,639 @@
+#include <algorithm>
+#include <limits.h>
+#include <colorer/cregexp/LazyDFA.h>
+
+// limit of NFA states, REs with larger repetitions have no automaton
+#define MAX_NFA_STATES 2000
+// limit of cached DFA states, cache is dropped, when it is reached
+#define MAX_DFA_STATES 256
+
+#define DS_DEAD -1
+#define DS_UNKNOWN -2
+
+LazyDFA::LazyDFA(const CRegExp *re)
+{
+  regexp = re;
+  ok = true;
+  hasAsserts = false;
+  hasSlots = false;
+  reverse = false;
+  rangeDepth = 0;
+  classNum = 0;
+  markGen = 0;
+  // brackets results go first, as in SMatches
+  slotsNum = 2*re->cMatch;
+#ifndef NAMED_MATCHES_IN_HASH
+  slotsNum += 2*re->cnMatch;
+#endif
+  markStart = slotsNum++;
+  markEnd = slotsNum++;
+
+  int finalState = addState(NMatch, -1, 0, -1, -1);
+  nfaStart = buildItem(0, finalState);
+  hasSlots = hasSlots || brackets.size() > 1;
+
+  caches[0].nfaStart = nfaStart;
+  caches[0].longest = false;
+  // unanchored search is the lowest priority loop before RE
+  caches[1].nfaStart = addState(NSplit, -1, 0, nfaStart, -1);
+  nfa[caches[1].nfaStart].out1 = addState(NAny, -1, 0, caches[1].nfaStart, -1);
+  caches[1].longest = false;
+  // reversed RE is used by DFA only
+  caches[2].nfaStart = -1;
+  caches[2].longest = true;
+  if (!hasAsserts){
+    reverse = true;
+    caches[2].nfaStart = buildItem(0, finalState);
+  }
+  for(auto &cache : caches)
+    cache.start = -1;
+  if (!ok){
+    nfa.clear();
+    brackets.clear();
+    return;
+  }
+  marks.assign(nfa.size(), 0);
+}
+
+bool LazyDFA::isOk() const
+{
+  return ok;
+}
+
+bool LazyDFA::match(CRegExpContext *ctx, int pos)
+{
+  bool unanchored = ctx->positionMoves;
+  if (!hasAsserts){
+    std::unique_lock<std::mutex> dfaLock(dfaMutex, std::try_to_lock);
+    if (dfaLock.owns_lock()){
+      if (!classNum) makeClasses();
+      int end = matchEnd(caches[unanchored ? 1 : 0], ctx, pos);
+      if (end == -1) return false;
+      if (unanchored) pos = matchStart(ctx, pos, end);
+      dfaLock.unlock();
+      if (hasSlots) return runThreads(ctx, pos, end, false);
+      ctx->matches->s[0] = pos;
+      ctx->matches->e[0] = end;
+      return true;
+    }
+  }
+  return runThreads(ctx, pos, ctx->end, unanchored);
+}
+
+int LazyDFA::addState(NType type, int code, int arg, int out, int out1)
+{
+  if (nfa.size() >= MAX_NFA_STATES) ok = false;
+  NState ns = { type, code, arg, out, out1 };
+  nfa.push_back(ns);
+  return (int)nfa.size()-1;
+}
+
+/**
+  Builds NFA for the instructions sequence @c re, which
+  continues with NFA state @c next.
+  @return entry state of the sequence.
+*/
+int LazyDFA::buildSequence(int re, int next)
+{
+  const std::vector<SRegCode> &program = regexp->program;
+  std::vector<int> items;
+  for(; re != -1; re = program[re].next)
+    items.push_back(re);
+
+  // alternatives are the operands of leading ReOr's and the tail after them
+  size_t tail = 0;
+  while(tail < items.size() && program[items[tail]].op == ReOr) tail++;
+
+  int entry = next;
+  for(size_t i = tail; i < items.size(); i++){
+    if (program[items[i]].op == ReOr){
+      ok = false;
+      return next;
+    }
+  }
+  // reversed RE has reversed sequences
+  for(size_t i = 0; i < items.size()-tail && ok; i++)
+    entry = buildItem(items[reverse ? tail+i : items.size()-1-i], entry);
+  for(size_t i = tail; i > 0 && ok; i--){
+    int alt = buildSequence(program[items[i-1]].param, next);
+    entry = addState(NSplit, -1, 0, alt, entry);
+  }
+  return entry;
+}
+
+/**
+  Builds NFA for the single instruction @c re, which
+  continues with NFA state @c next.
+  @return entry state of the instruction.
+*/
+int LazyDFA::buildItem(int re, int next)
+{
+  const SRegCode &code = regexp->program[re];
+  Bracket br;
+  int i;
+  switch(code.op){
+    case ReEmpty:
+      return next;
+    case ReMetaSymb:
+      if (CRegExp::isSymbolMeta(code.un.metaSymbol))
+        return addState(NSymbol, re, 0, next, -1);
+#ifdef COLORERMODE
+      if (code.un.metaSymbol == ReStart || code.un.metaSymbol == ReEnd){
+        if (reverse) return next;
+        hasSlots = true;
+        return addState(NSave, re, code.un.metaSymbol == ReStart ? markStart : markEnd, next, -1);
+      }
+#endif
+      hasAsserts = true;
+      return addState(NAssert, re, 0, next, -1);
+    case ReSymb:
+    case ReEnum:
+    case ReNEnum:
+      return addState(NSymbol, re, 0, next, -1);
+    case ReWord:
+      for(i = 0; i < code.e; i++)
+        next = addState(NSymbol, re, reverse ? i : code.e-1-i, next, -1);
+      return next;
+    case ReBrackets:
+    case ReNamedBrackets:
+      // reversed RE finds the match start only
+      if (code.param0 == -1 || reverse) return buildSequence(code.param, next);
+#ifdef NAMED_MATCHES_IN_HASH
+      if (code.op == ReNamedBrackets){
+        ok = false;
+        return next;
+      }
+#endif
+      // brackets over the limit are closed into zero bracket
+      if (code.op == ReBrackets && code.param0 == 0 && re != 0){
+        ok = false;
+        return next;
+      }
+      br.open = slotsNum++;
+      if (code.op == ReBrackets){
+        br.s = code.param0;
+        br.e = regexp->cMatch + code.param0;
+      }
+#ifndef NAMED_MATCHES_IN_HASH
+      else{
+        br.s = 2*regexp->cMatch + code.param0;
+        br.e = 2*regexp->cMatch + regexp->cnMatch + code.param0;
+      }
+#endif
+      brackets.push_back(br);
+      i = addState(NClose, re, (int)brackets.size()-1, next, -1);
+      i = buildSequence(code.param, i);
+      return addState(NSave, re, br.open, i, -1);
+    case ReRangeN:
+    case ReNGRangeN:
+    case ReRangeNM:
+    case ReNGRangeNM:
+      return buildRange(code, next);
+    default:
+      // back references and lookarounds
+      ok = false;
+      return next;
+  }
+}
+
+/**
+  Builds NFA for range instruction @c code, which
+  continues with NFA state @c next.
+  Backtracking machine doesn't restore range counters, when it returns
+  into the previous iteration of the enclosing range. So the ranges,
+  which count optional iterations, are built, if they are not nested,
+  and the operands with alternatives and ranges are repeated
+  with *, + and ? only. Repetitions of the empty operands are cut
+  by backtracking machine in a special way and are not built.
+  @return entry state of the range.
+*/
+int LazyDFA::buildRange(const SRegCode &code, int next)
+{
+  bool greedy = code.op == ReRangeN || code.op == ReRangeNM;
+  bool counted = code.op == ReRangeNM || code.op == ReNGRangeNM;
+  bool nestedAllowed = counted ? code.e == code.s : code.s <= 1;
+  bool choiceAllowed = counted ? code.s == 0 && code.e == 1 : code.s <= 1;
+  if ((counted && code.e < code.s) || canBeEmpty(code.param) ||
+      (rangeDepth && !nestedAllowed) || (!choiceAllowed && hasChoice(code.param))){
+    ok = false;
+    return next;
+  }
+
+  rangeDepth++;
+  int entry, body, i;
+  if (counted){
+    entry = next;
+    for(i = 0; i < code.e - code.s && ok; i++){
+      body = buildSequence(code.param, entry);
+      entry = greedy ? addState(NSplit, -1, 0, body, next) : addState(NSplit, -1, 0, next, body);
+    }
+  }else{
+    entry = addState(NSplit, -1, 0, -1, -1);
+    body = buildSequence(code.param, entry);
+    nfa[entry].out = greedy ? body : next;
+    nfa[entry].out1 = greedy ? next : body;
+  }
+  for(i = 0; i < code.s && ok; i++)
+    entry = buildSequence(code.param, entry);
+  rangeDepth--;
+  return entry;
+}
+
+/** Checks, if instructions sequence could match an empty string. */
+bool LazyDFA::canBeEmpty(int re) const
+{
+  const std::vector<SRegCode> &program = regexp->program;
+  for(; re != -1; re = program[re].next){
+    const SRegCode &code = program[re];
+    switch(code.op){
+      case ReOr:
+        if (canBeEmpty(code.param)) return true;
+        break;
+      case ReEmpty:
+      case ReAhead:
+      case ReNAhead:
+      case ReBehind:
+      case ReNBehind:
+        break;
+      case ReMetaSymb:
+        if (CRegExp::isSymbolMeta(code.un.metaSymbol)) return false;
+        break;
+      case ReBrackets:
+      case ReNamedBrackets:
+        if (!canBeEmpty(code.param)) return false;
+        break;
+      case ReRangeN:
+      case ReRangeNM:
+      case ReNGRangeN:
+      case ReNGRangeNM:
+        if (code.s && !canBeEmpty(code.param)) return false;
+        break;
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+/** Checks, if instructions sequence contains alternatives or ranges. */
+bool LazyDFA::hasChoice(int re) const
+{
+  const std::vector<SRegCode> &program = regexp->program;
+  for(; re != -1; re = program[re].next){
+    const SRegCode &code = program[re];
+    switch(code.op){
+      case ReOr:
+      case ReRangeN:
+      case ReRangeNM:
+      case ReNGRangeN:
+      case ReNGRangeNM:
+        return true;
+      case ReBrackets:
+      case ReNamedBrackets:
+        if (hasChoice(code.param)) return true;
+        break;
+      default:
+        break;
+    }
+  }
+  return false;
+}
+
+/**
+  Splits Latin-1 symbols into the classes, where all the symbols
+  have the same transitions.
+*/
+void LazyDFA::makeClasses()
+{
+  std::vector<std::pair<int, int> > checks;
+  for(auto &ns : nfa)
+    if (ns.type == NSymbol) checks.push_back(std::make_pair(ns.code, ns.arg));
+  std::sort(checks.begin(), checks.end());
+  checks.erase(std::unique(checks.begin(), checks.end()), checks.end());
+
+  std::map<std::vector<bool>, int> classes;
+  std::vector<bool> signature(checks.size());
+  for(int c = 0; c < 0x100; c++){
+    for(size_t i = 0; i < checks.size(); i++)
+      signature[i] = regexp->isSymbolMatched(regexp->program[checks[i].first], checks[i].second, (wchar)c);
+    auto cl = classes.find(signature);
+    if (cl == classes.end())
+      cl = classes.insert(std::make_pair(signature, (int)classes.size())).first;
+    classMap[c] = (unsigned char)cl->second;
+  }
+  classNum = (int)classes.size();
+}
+
+/**
+  Appends symbol checking and final states, reachable from NFA state
+  @c ns with epsilon moves, into @c set in priority order.
+  States with lower priority than the final one are never used
+  by leftmost-first match, so they are not added, if not @c longest.
+  @return true, if final state is reached.
+*/
+bool LazyDFA::closure(int ns, std::vector<int> &set, bool longest)
+{
+  bool accept = false;
+  stack.clear();
+  stack.push_back(ns);
+  while(!stack.empty()){
+    int s = stack.back();
+    stack.pop_back();
+    if (marks[s] == markGen) continue;
+    marks[s] = markGen;
+    const NState &st = nfa[s];
+    switch(st.type){
+      case NSplit:
+        stack.push_back(st.out1);
+        stack.push_back(st.out);
+        break;
+      case NSave:
+      case NClose:
+        stack.push_back(st.out);
+        break;
+      case NSymbol:
+      case NAny:
+        set.push_back(s);
+        break;
+      case NMatch:
+        set.push_back(s);
+        if (!longest) return true;
+        accept = true;
+        break;
+      default:
+        break;
+    }
+  }
+  return accept;
+}
+
+int LazyDFA::getState(Cache &cache, std::vector<int> &set, bool &flushed)
+{
+  flushed = false;
+  auto it = cache.index.find(set);
+  if (it != cache.index.end()) return it->second;
+
+  if (cache.states.size() >= MAX_DFA_STATES){
+    cache.states.clear();
+    cache.index.clear();
+    cache.start = -1;
+    flushed = true;
+  }
+  int idx = (int)cache.states.size();
+  cache.index[set] = idx;
+  cache.states.emplace_back();
+  DState &ds = cache.states.back();
+  ds.accept = false;
+  for(int ns : set)
+    if (nfa[ns].type == NMatch) ds.accept = true;
+  ds.nstates.swap(set);
+  ds.next.assign(classNum, DS_UNKNOWN);
+  return idx;
+}
+
+int LazyDFA::getStart(Cache &cache)
+{
+  if (cache.start == -1){
+    std::vector<int> set;
+    bool flushed;
+    nextMark(marks, markGen);
+    closure(cache.nfaStart, set, cache.longest);
+    int start = getState(cache, set, flushed);
+    cache.start = start;
+  }
+  return cache.start;
+}
+
+/**
+  Makes transition from DFA state @c ds with symbol @c c.
+  Transitions for Latin-1 symbols are cached.
+*/
+int LazyDFA::step(Cache &cache, int ds, wchar c)
+{
+  int cl = c < 0x100 ? classMap[c] : -1;
+  if (cl != -1 && cache.states[ds].next[cl] != DS_UNKNOWN)
+    return cache.states[ds].next[cl];
+
+  std::vector<int> set;
+  nextMark(marks, markGen);
+  for(int ns : cache.states[ds].nstates){
+    const NState &st = nfa[ns];
+    if (st.type == NMatch) continue;
+    if ((st.type == NAny || regexp->isSymbolMatched(regexp->program[st.code], st.arg, c)) &&
+        closure(st.out, set, cache.longest) && !cache.longest) break;
+  }
+
+  int next = DS_DEAD;
+  if (!set.empty()){
+    bool flushed;
+    next = getState(cache, set, flushed);
+    if (flushed) return next;
+  }
+  if (cl != -1) cache.states[ds].next[cl] = next;
+  return next;
+}
+
+/**
+  Runs DFA from position @c pos until it dies.
+  @return end of leftmost-first match or -1, if there is no match.
+*/
+int LazyDFA::matchEnd(Cache &cache, const CRegExpContext *ctx, int pos)
+{
+  int ds = getStart(cache);
+  int last = cache.states[ds].accept ? pos : -1;
+  for(int i = pos; i < ctx->end; i++){
+    // nothing could continue the match
+    if (cache.states[ds].accept && cache.states[ds].nstates.size() == 1) break;
+    ds = step(cache, ds, symbolAt(ctx, i));
+    if (ds == DS_DEAD) break;
+    if (cache.states[ds].accept) last = i+1;
+  }
+  return last;
+}
+
+/**
+  Runs reversed RE DFA back from the end of leftmost-first match.
+  Leftmost match, ending there, starts at the leftmost-first match start.
+  @return match start.
+*/
+int LazyDFA::matchStart(const CRegExpContext *ctx, int pos, int end)
+{
+  Cache &cache = caches[2];
+  int ds = getStart(cache);
+  int last = end;
+  for(int i = end-1; i >= pos; i--){
+    ds = step(cache, ds, symbolAt(ctx, i));
+    if (ds == DS_DEAD) break;
+    if (cache.states[ds].accept) last = i;
+  }
+  return last;
+}
+
+wchar LazyDFA::symbolAt(const CRegExpContext *ctx, int pos)
+{
+  return ctx->buffer ? ctx->buffer[pos] : (*ctx->global_pattern)[pos];
+}
+
+void LazyDFA::nextMark(std::vector<int> &marks, int &markGen)
+{
+  if (++markGen == INT_MAX){
+    std::fill(marks.begin(), marks.end(), 0);
+    markGen = 1;
+  }
+}
+
+bool LazyDFA::canStart(CRegExpContext *ctx, int pos) const
+{
+  return !regexp->firstSetUsed || regexp->inFirstSet(ctx, pos);
+}
+
+/**
+  Adds thread at NFA state @c ns to the Pike VM @c list. Thread is split
+  into the threads at symbol checking and final states, reachable
+  with epsilon moves, in priority order.
+  @param slots thread slots or nullptr for the new thread.
+*/
+void LazyDFA::addThread(CRegExpContext *ctx, std::vector<int> &list, std::vector<int> &listSlots,
+                        int ns, int pos, const int *slots) const
+{
+  int *cur = ctx->slots.data();
+  if (slots) std::copy(slots, slots+slotsNum, cur);
+  else std::fill(cur, cur+slotsNum, -1);
+
+  // stack keeps pairs: state and -1, or negated slot and it's value to restore
+  std::vector<int> &stack = ctx->closureStack;
+  stack.clear();
+  stack.push_back(ns);
+  stack.push_back(-1);
+  while(!stack.empty()){
+    int val = stack.back();
+    stack.pop_back();
+    int s = stack.back();
+    stack.pop_back();
+    if (s < 0){
+      cur[-1-s] = val;
+      continue;
+    }
+    if (ctx->marks[s] == ctx->markGen) continue;
+    ctx->marks[s] = ctx->markGen;
+    const NState &st = nfa[s];
+    int toParse = pos;
+    switch(st.type){
+      case NSplit:
+        stack.push_back(st.out1);
+        stack.push_back(-1);
+        stack.push_back(st.out);
+        stack.push_back(-1);
+        break;
+      case NAssert:
+        if (regexp->checkMetaSymbol(ctx, regexp->program[st.code].un.metaSymbol, toParse)){
+          stack.push_back(st.out);
+          stack.push_back(-1);
+        }
+        break;
+      case NSave:
+        stack.push_back(-1-st.arg);
+        stack.push_back(cur[st.arg]);
+        cur[st.arg] = pos;
+        stack.push_back(st.out);
+        stack.push_back(-1);
+        break;
+      case NClose:{
+        const Bracket &br = brackets[st.arg];
+        stack.push_back(-1-br.s);
+        stack.push_back(cur[br.s]);
+        stack.push_back(-1-br.e);
+        stack.push_back(cur[br.e]);
+        cur[br.s] = cur[br.open];
+        cur[br.e] = pos;
+        if (cur[br.e] < cur[br.s]) cur[br.s] = cur[br.e];
+        stack.push_back(st.out);
+        stack.push_back(-1);
+        break;
+      }
+      case NSymbol:
+      case NMatch:
+        list.push_back(s);
+        listSlots.insert(listSlots.end(), cur, cur+slotsNum);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+/**
+  Pike VM: runs all the threads in parallel from position @c pos
+  to @c limit and keeps the slots of the leftmost-first match.
+  Fills context matches.
+*/
+bool LazyDFA::runThreads(CRegExpContext *ctx, int pos, int limit, bool unanchored) const
+{
+  if (ctx->marks.size() < nfa.size()) ctx->marks.resize(nfa.size(), 0);
+  if ((int)ctx->slots.size() < slotsNum) ctx->slots.resize(slotsNum);
+  std::vector<int> *clist = &ctx->threads[0], *nlist = &ctx->threads[1];
+  std::vector<int> *cslots = &ctx->threadSlots[0], *nslots = &ctx->threadSlots[1];
+  clist->clear();
+  cslots->clear();
+
+  bool matched = false;
+  int p = pos;
+  nextMark(ctx->marks, ctx->markGen);
+  if (!unanchored || canStart(ctx, p))
+    addThread(ctx, *clist, *cslots, nfaStart, p, nullptr);
+  while(true){
+    if (clist->empty()){
+      if (matched || !unanchored) break;
+      // no running threads, jumps to the next possible match start
+      do p++; while(p <= limit && !canStart(ctx, p));
+      if (p > limit) break;
+      nextMark(ctx->marks, ctx->markGen);
+      addThread(ctx, *clist, *cslots, nfaStart, p, nullptr);
+      continue;
+    }
+    nextMark(ctx->marks, ctx->markGen);
+    nlist->clear();
+    nslots->clear();
+    wchar c = p < limit ? symbolAt(ctx, p) : 0;
+    for(size_t t = 0; t < clist->size(); t++){
+      const NState &st = nfa[(*clist)[t]];
+      const int *tslots = cslots->data() + t*slotsNum;
+      if (st.type == NMatch){
+        // threads with lower priority are cut
+        matched = true;
+        ctx->matchSlots.assign(tslots, tslots+slotsNum);
+        break;
+      }
+      if (p < limit && regexp->isSymbolMatched(regexp->program[st.code], st.arg, c))
+        addThread(ctx, *nlist, *nslots, st.out, p+1, tslots);
+    }
+    if (p >= limit) break;
+    p++;
+    if (unanchored && !matched && canStart(ctx, p))
+      addThread(ctx, *nlist, *nslots, nfaStart, p, nullptr);
+    std::swap(clist, nlist);
+    std::swap(cslots, nslots);
+  }
+  if (!matched) return false;
+
+  SMatches *matches = ctx->matches;
+  const int *ms = ctx->matchSlots.data();
+  int cMatch = regexp->cMatch;
+  int i;
+  for(i = 0; i < cMatch; i++){
+    matches->s[i] = ms[i];
+    matches->e[i] = ms[cMatch+i];
+  }
+#ifndef NAMED_MATCHES_IN_HASH
+  int cnMatch = regexp->cnMatch;
+  for(i = 0; i < cnMatch; i++){
+    matches->ns[i] = ms[2*cMatch+i];
+    matches->ne[i] = ms[2*cMatch+cnMatch+i];
+  }
+#endif
+  // \m \M change zero bracket
+  if (ms[markStart] != -1) matches->s[0] = ms[markStart];
+  if (ms[markEnd] != -1) matches->e[0] = ms[markEnd];
+  if (matches->e[0] < matches->s[0]) matches->s[0] = matches->e[0];
+  return true;
+}
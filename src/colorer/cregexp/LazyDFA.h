@@ -0,0 +1,137 @@
+#ifndef _COLORER_LAZYDFA_H_
+#define _COLORER_LAZYDFA_H_
+
+#include <vector>
+#include <map>
+#include <mutex>
+#include <colorer/cregexp/cregexp.h>
+
+/** Automaton matcher of the compiled RE program.
+    RE program is converted into Thompson NFA, which keeps the brackets
+    and zero width assertions as epsilon states. Match is done in linear
+    time, without backtracking:
+    - lazily built DFA, which keeps NFA states in priority order, finds
+      the end of the leftmost-first match (as backtracking finds it);
+    - for moving search, DFA of reversed RE, running back from this end,
+      finds the match start;
+    - Pike VM simulation of NFA, bounded with the match start and end,
+      finds the brackets positions, if there are any.
+
+    REs with assertions are matched with Pike VM only.
+    REs with back references and lookarounds have no automaton, as well
+    as REs, where backtracking machine results depend on its internal
+    range counters, check #isOk.
+
+    NFA is immutable. Cache of DFA states is shared and bounded, it is
+    locked for a single scan and dropped, when it grows over the limit.
+    If it is used by another thread, match runs with Pike VM only.
+    @ingroup cregexp
+*/
+class LazyDFA
+{
+public:
+  /**
+    Builds NFA for the RE program.
+  */
+  LazyDFA(const CRegExp *re);
+
+  /** Can automaton match the RE */
+  bool isOk() const;
+
+  /**
+    Matches RE at position @c pos of the context string, or at any
+    position from @c pos to the context end, if context position moves.
+    Fills context matches.
+  */
+  bool match(CRegExpContext *ctx, int pos);
+
+private:
+  enum NType {
+    NSymbol,    // symbol check of program instruction
+    NAny,       // any symbol, used for unanchored search
+    NSplit,     // epsilon split, out is preferred
+    NAssert,    // zero width meta symbol of program instruction
+    NSave,      // stores position into the slot
+    NClose,     // closes bracket
+    NMatch
+  };
+  struct NState {
+    NType type;
+    // program instruction
+    int code;
+    // symbol position in ReWord, slot of NSave, bracket of NClose
+    int arg;
+    int out, out1;
+  };
+  // slots of capturing bracket
+  struct Bracket {
+    int open, s, e;
+  };
+  // DFA state: NFA states in priority order
+  struct DState {
+    std::vector<int> nstates;
+    bool accept;
+    // transitions for each Latin-1 symbols class
+    std::vector<int> next;
+  };
+  struct Cache {
+    std::vector<DState> states;
+    std::map<std::vector<int>, int> index;
+    // NFA start state
+    int nfaStart;
+    // leftmost-longest match: NFA states are not cut by the final one
+    bool longest;
+    int start;
+  };
+
+  const CRegExp *regexp;
+  std::vector<NState> nfa;
+  std::vector<Bracket> brackets;
+  int nfaStart;
+  // thread slots: brackets results, \m \M positions and brackets starts
+  int slotsNum;
+  int markStart, markEnd;
+  bool ok;
+  // NFA has assertions, DFA is not used
+  bool hasAsserts;
+  // DFA match needs Pike VM to find brackets or \m \M positions
+  bool hasSlots;
+  // builder state: reversed RE and nesting depth of ranges
+  bool reverse;
+  int rangeDepth;
+
+  std::mutex dfaMutex;
+  // equivalence classes of Latin-1 symbols, built on the first DFA use
+  unsigned char classMap[0x100];
+  int classNum;
+  // anchored, unanchored and reversed automata
+  Cache caches[3];
+  // epsilon closure marks and stack
+  std::vector<int> marks;
+  int markGen;
+  std::vector<int> stack;
+
+  int addState(NType type, int code, int arg, int out, int out1);
+  int buildSequence(int re, int next);
+  int buildItem(int re, int next);
+  int buildRange(const SRegCode &code, int next);
+  bool canBeEmpty(int re) const;
+  bool hasChoice(int re) const;
+
+  void makeClasses();
+  bool closure(int ns, std::vector<int> &set, bool longest);
+  int getState(Cache &cache, std::vector<int> &set, bool &flushed);
+  int getStart(Cache &cache);
+  int step(Cache &cache, int ds, wchar c);
+  int matchEnd(Cache &cache, const CRegExpContext *ctx, int pos);
+  int matchStart(const CRegExpContext *ctx, int pos, int end);
+
+  static wchar symbolAt(const CRegExpContext *ctx, int pos);
+  static void nextMark(std::vector<int> &marks, int &markGen);
+  bool canStart(CRegExpContext *ctx, int pos) const;
+  void addThread(CRegExpContext *ctx, std::vector<int> &list, std::vector<int> &listSlots,
+                 int ns, int pos, const int *slots) const;
+  bool runThreads(CRegExpContext *ctx, int pos, int limit, bool unanchored) const;
+};
+
+#endif
@@ -1,10 +1,15 @@
 #include <string.h>
+#include <limits.h>
 #include <colorer/cregexp/cregexp.h>
 #include <colorer/unicode/UnicodeTools.h>
 #include <colorer/unicode/Character.h>
+#include <colorer/cregexp/LazyDFA.h>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define CREGEXP_SSE2
+#endif
 
-StackElem *RegExpStack;
-int RegExpStack_Size;
 /////////////////////////////////////////////////////////////////////////////
 //
 SRegInfo::SRegInfo()
@@ -12,7 +17,8 @@ SRegInfo::SRegInfo()
   next = prev = parent = nullptr;
   un.param = nullptr;
   op = ReEmpty;
-  param0 = param1 = 0;
+  param0 = 0;
+  s = e = 0;
 }
 SRegInfo::~SRegInfo()
 {
@@ -38,6 +44,80 @@ SRegInfo::~SRegInfo()
   }
 }
 
+////////////////////////////////////////////////////////////////////////////
+// CRegExpContext class
+CRegExpContext::CRegExpContext()
+{
+  count_elem = 0;
+  global_pattern = nullptr;
+  buffer = nullptr;
+  end = 0;
+  positionMoves = false;
+  startChange = endChange = false;
+  matches = nullptr;
+  stepLimit = 0;
+  stepBudget = -1;
+  stepsLeft = 0;
+  lastSteps = 0;
+  limitExceeded = false;
+  limitHits = 0;
+  markGen = 0;
+#ifdef NAMED_MATCHES_IN_HASH
+  namedMatches = nullptr;
+#endif
+#ifdef COLORERMODE
+  backStr = nullptr;
+  backTrace = nullptr;
+  schemeStart = 0;
+#endif
+}
+CRegExpContext::~CRegExpContext()
+{
+}
+
+void CRegExpContext::setStepLimit(int limit)
+{
+  stepLimit = limit;
+}
+
+void CRegExpContext::setStepBudget(long long budget)
+{
+  stepBudget = budget;
+}
+
+long long CRegExpContext::getStepBudget() const
+{
+  return stepBudget;
+}
+
+bool CRegExpContext::isLimitExceeded() const
+{
+  return limitExceeded;
+}
+
+int CRegExpContext::getLimitHits() const
+{
+  return limitHits;
+}
+
+int CRegExpContext::getLastSteps() const
+{
+  return lastSteps;
+}
+
+#ifdef COLORERMODE
+void CRegExpContext::setBackTrace(const String *str, SMatches *trace)
+{
+  backTrace = trace;
+  backStr = str;
+}
+void CRegExpContext::getBackTrace(const String **str, SMatches **trace) const
+{
+  *str = backStr;
+  *trace = backTrace;
+}
+#endif
+
 ////////////////////////////////////////////////////////////////////////////
 // CRegExp class
 void CRegExp::init()
@@ -46,8 +126,9 @@ void CRegExp::init()
   positionMoves = false;
   error = EERROR;
   firstChar = 0;
+  firstSetUsed = false;
   cMatch = 0;
-  global_pattern = 0;
+  statesNum = 0;
 #ifdef COLORERMODE
   backRE = 0;
   backStr = nullptr;
@@ -58,7 +139,6 @@ void CRegExp::init()
 #else
   namedMatches = 0;
 #endif
-  count_elem = 0;
 }
 CRegExp::CRegExp()
 {
@@ -72,6 +152,7 @@ CRegExp::CRegExp(const String *text)
 CRegExp::~CRegExp()
 {
   if (tree_root) delete tree_root;
+  clearProgram();
 #ifndef NAMED_MATCHES_IN_HASH
   for(int bp = 0; bp < cnMatch; bp++)
     if(brnames[bp]) delete brnames[bp];
@@ -85,6 +166,7 @@ EError CRegExp::setRELow(const String &expr)
 
   if (tree_root) delete tree_root;
   tree_root = nullptr;
+  clearProgram();
 #ifndef NAMED_MATCHES_IN_HASH
   for(int bp = 0; bp < cnMatch; bp++)
     if(brnames[bp]) delete brnames[bp];
@@ -94,7 +176,6 @@ EError CRegExp::setRELow(const String &expr)
 #ifndef NAMED_MATCHES_IN_HASH
   cnMatch = 0;
 #endif
-  endChange = startChange = false;
   int start = 0;
   while (Character::isWhitespace(expr[start])) start++;
   if (expr[start] == '/') start++;
@@ -128,9 +209,294 @@ EError CRegExp::setRELow(const String &expr)
 
   if (err) return err;
   optimize();
+  compile(tree_root, -1);
+  delete tree_root;
+  tree_root = nullptr;
+  makeFirstSet();
+  makeLiterals();
+  checkDFAUsage();
   return EOK;
 }
 
+/**
+  Appends RE tree nodes sequence into the program.
+  Operands are placed just after their operators.
+  Words and char classes are moved from the tree into the program.
+  @return index of the first compiled instruction.
+*/
+int CRegExp::compile(SRegInfo *re, int parent)
+{
+  int first = -1;
+  int prev = -1;
+  for(; re; re = re->next){
+    int pc = (int)program.size();
+    program.emplace_back();
+    SRegCode &code = program.back();
+    code.op = re->op;
+    code.next = -1;
+    code.parent = parent;
+    code.param = -1;
+    code.param0 = re->param0;
+    code.s = re->s;
+    code.e = re->e;
+    code.stateNo = -1;
+    code.un.word = nullptr;
+#if defined NAMED_MATCHES_IN_HASH
+    code.namedata = re->namedata;
+    re->namedata = nullptr;
+#endif
+    switch(re->op){
+      case ReMetaSymb:
+        code.un.metaSymbol = re->un.metaSymbol;
+        break;
+      case ReSymb:
+        code.un.symbol = re->un.symbol;
+        code.s = Character::toLowerCase(re->un.symbol);
+        code.e = Character::toUpperCase(re->un.symbol);
+        break;
+      case ReWord:
+        code.un.word = re->un.word;
+        code.e = (int)re->un.word->length();
+        re->un.word = nullptr;
+        break;
+      case ReEnum:
+      case ReNEnum:
+        code.un.charclass = re->un.charclass;
+        re->un.charclass = nullptr;
+        break;
+      case ReBrackets:
+      case ReNamedBrackets:
+      case ReRangeN:
+      case ReRangeNM:
+      case ReNGRangeN:
+      case ReNGRangeNM:
+        code.stateNo = statesNum++;
+        break;
+      default:
+        break;
+    }
+    if (prev != -1) program[prev].next = pc;
+    else first = pc;
+    prev = pc;
+    if (re->op > ReBlockOps && (re->op < ReSymbolOps
+        || re->op == ReBrackets || re->op == ReNamedBrackets)){
+      int param = compile(re->un.param, pc);
+      program[pc].param = param;
+    }
+  }
+  return first;
+}
+
+void CRegExp::clearProgram()
+{
+  for(auto &code : program){
+    switch(code.op){
+      case ReEnum:
+      case ReNEnum:
+        delete code.un.charclass;
+        break;
+      case ReWord:
+        delete code.un.word;
+        break;
+      default:
+        break;
+    }
+#if defined NAMED_MATCHES_IN_HASH
+    delete code.namedata;
+#endif
+  }
+  program.clear();
+  statesNum = 0;
+  firstSetUsed = false;
+  prefix.clear();
+  required.clear();
+  dfa.reset();
+}
+
+/**
+  Automaton replaces backtracking for REs, where backtracking could be
+  expensive: with alternatives or repetitions. REs, which automaton
+  can't match, are left for backtracking.
+*/
+void CRegExp::checkDFAUsage()
+{
+  bool useful = false;
+  for(auto &code : program){
+    switch(code.op){
+      case ReOr:
+      case ReRangeN:
+      case ReRangeNM:
+      case ReNGRangeN:
+      case ReNGRangeNM:
+        useful = true;
+        break;
+      default:
+        break;
+    }
+  }
+  if (!useful) return;
+  dfa.reset(new LazyDFA(this));
+  if (!dfa->isOk()) dfa.reset();
+}
+
+/** Checks, if meta symbol consumes string symbol. */
+bool CRegExp::isSymbolMeta(EMetaSymbols symb)
+{
+  switch(symb){
+    case ReAnyChr:
+    case ReDigit:
+    case ReNDigit:
+    case ReWordSymb:
+    case ReNWordSymb:
+    case ReWSpace:
+    case ReNWSpace:
+    case ReUCase:
+    case ReNUCase:
+      return true;
+    default:
+      return false;
+  }
+}
+
+void CRegExp::makeFirstSet()
+{
+  memset(firstSet, 0, sizeof(firstSet));
+  firstOther = false;
+  firstSetUsed = !collectFirst(0);
+}
+
+/**
+  Adds symbols, which could start a match of the instructions
+  sequence @c re, into the first symbols set.
+  Lookahead and lookbehind operators are treated as empty ones,
+  back references could match any string.
+  @return true, if the sequence could match an empty string.
+*/
+bool CRegExp::collectFirst(int re)
+{
+  // true, if one of the previous alternatives could be empty
+  bool empty = false;
+  for(; re != -1; re = program[re].next){
+    const SRegCode &code = program[re];
+    switch(code.op){
+      case ReEmpty:
+      case ReAhead:
+      case ReNAhead:
+      case ReBehind:
+      case ReNBehind:
+        break;
+      case ReOr:
+        if (collectFirst(code.param)) empty = true;
+        break;
+      case ReBrackets:
+      case ReNamedBrackets:
+        if (!collectFirst(code.param)) return empty;
+        break;
+      case ReRangeN:
+      case ReRangeNM:
+      case ReNGRangeN:
+      case ReNGRangeNM:
+        if (!collectFirst(code.param) && code.s > 0) return empty;
+        break;
+      case ReMetaSymb:
+        // zero width assertions are skipped
+        if (isSymbolMeta(code.un.metaSymbol)){
+          addFirstSymbols(code);
+          return empty;
+        }
+        break;
+      case ReSymb:
+      case ReWord:
+      case ReEnum:
+      case ReNEnum:
+        addFirstSymbols(code);
+        return empty;
+      default:
+        // back references
+        memset(firstSet, 0xFF, sizeof(firstSet));
+        firstOther = true;
+        break;
+    }
+  }
+  return true;
+}
+
+void CRegExp::makeLiterals()
+{
+  if (ignoreCase) return;
+  std::vector<wchar> run;
+  bool atStart = true;
+  collectLiterals(0, run, atStart);
+  endLiteral(run, atStart);
+}
+
+/**
+  Collects runs of literal symbols, which are passed by every match
+  of the instructions sequence @c re. Zero width assertions do not
+  break the run, any other variable part does.
+*/
+void CRegExp::collectLiterals(int re, std::vector<wchar> &run, bool &atStart)
+{
+  for(int alt = re; alt != -1; alt = program[alt].next){
+    if (program[alt].op == ReOr){
+      endLiteral(run, atStart);
+      return;
+    }
+  }
+  for(; re != -1; re = program[re].next){
+    const SRegCode &code = program[re];
+    switch(code.op){
+      case ReEmpty:
+      case ReAhead:
+      case ReNAhead:
+      case ReBehind:
+      case ReNBehind:
+        break;
+      case ReMetaSymb:
+        if (isSymbolMeta(code.un.metaSymbol)) endLiteral(run, atStart);
+        break;
+      case ReSymb:
+        run.push_back(code.un.symbol);
+        break;
+      case ReWord:
+        for(int i = 0; i < code.e; i++)
+          run.push_back((*code.un.word)[i]);
+        break;
+      case ReBrackets:
+      case ReNamedBrackets:
+        collectLiterals(code.param, run, atStart);
+        break;
+      default:
+        endLiteral(run, atStart);
+        break;
+    }
+  }
+}
+
+void CRegExp::endLiteral(std::vector<wchar> &run, bool &atStart)
+{
+  if (atStart) prefix = run;
+  atStart = false;
+  if (run.size() > required.size()) required = run;
+  run.clear();
+}
+
+/**
+  Adds symbols, accepted by the single symbol instruction @c code,
+  into the first symbols set.
+*/
+void CRegExp::addFirstSymbols(const SRegCode &code)
+{
+  wchar first = BAD_WCHAR;
+  if (code.op == ReSymb) first = code.un.symbol;
+  if (code.op == ReWord) first = (*code.un.word)[0];
+
+  for(int c = 0; c < 0x100; c++){
+    if (isSymbolMatched(code, 0, (wchar)c)) firstSet[c >> 5] |= 1u << (c & 31);
+  }
+  // other symbols are checked only for the exact symbol match
+  if (ignoreCase || first == BAD_WCHAR || first > 0xFF) firstOther = true;
+}
 
 void CRegExp::optimize()
 {
@@ -642,36 +1008,117 @@ SRegInfo *next, *temp;
 // parsing
 ////////////////////////////////////////////////////////////////////////////
 
-bool CRegExp::isWordBoundary(int &toParse)
+/**
+  Symbols of the parsed string. Symbols are read directly
+  from the string buffer, when it is available.
+*/
+struct ParsedString
 {
+  const String *str;
+  const wchar *buf;
+
+  ParsedString(const String *s, const wchar *b) : str(s), buf(b) {}
+  wchar operator[](int i) const
+  {
+    return buf ? buf[i] : (*str)[i];
+  }
+};
+
+bool CRegExp::isWordBoundary(CRegExpContext *ctx, int &toParse) const
+{
+const ParsedString pattern(ctx->global_pattern, ctx->buffer);
   int before = 0;
   int after  = 0;
-  if (toParse < end && (Character::isLetterOrDigit((*global_pattern)[toParse]) ||
-      (*global_pattern)[toParse] == '_')) after = 1;
-  if (toParse > 0 && (Character::isLetterOrDigit((*global_pattern)[toParse-1]) ||
-      (*global_pattern)[toParse-1] == '_')) before = 1;
+  if (toParse < ctx->end && (Character::isLetterOrDigit(pattern[toParse]) ||
+      pattern[toParse] == '_')) after = 1;
+  if (toParse > 0 && (Character::isLetterOrDigit(pattern[toParse-1]) ||
+      pattern[toParse-1] == '_')) before = 1;
   return before+after == 1;
 }
-bool CRegExp::isNWordBoundary(int &toParse)
+bool CRegExp::isNWordBoundary(CRegExpContext *ctx, int &toParse) const
 {
-  return !isWordBoundary(toParse);
+  return !isWordBoundary(ctx, toParse);
 }
 
 
 
 
-bool CRegExp::checkMetaSymbol(EMetaSymbols symb, int &toParse)
+/**
+  Checks symbol @c c against the single symbol instruction @c code.
+  @c wordPos is the position of the checked symbol in ReWord.
+*/
+bool CRegExp::isSymbolMatched(const SRegCode &code, int wordPos, wchar c) const
 {
-const String &pattern = *global_pattern;
+  wchar w;
+  switch(code.op){
+    case ReSymb:
+      // s and e keep lower and upper case forms of the symbol
+      if (ignoreCase)
+        return Character::toLowerCase(c) == code.s || Character::toUpperCase(c) == code.e;
+      return c == code.un.symbol;
+    case ReWord:
+      w = (*code.un.word)[wordPos];
+      if (ignoreCase)
+        return Character::toLowerCase(c) == Character::toLowerCase(w) &&
+               Character::toUpperCase(c) == Character::toUpperCase(w);
+      return c == w;
+    case ReEnum:
+      return code.un.charclass->inClass(c);
+    case ReNEnum:
+      return !code.un.charclass->inClass(c);
+    case ReMetaSymb:
+      return isMetaSymbolMatched(code.un.metaSymbol, c);
+    default:
+      return false;
+  }
+}
 
+/**
+  Checks symbol @c c against symbol consuming meta symbol @c symb.
+*/
+bool CRegExp::isMetaSymbolMatched(EMetaSymbols symb, wchar c) const
+{
   switch(symb){
     case ReAnyChr:
-      if (toParse >= end) return false;
-      if (!singleLine && (pattern[toParse] == 0x0A || pattern[toParse] == 0x0B ||
-                          pattern[toParse] == 0x0C || pattern[toParse] == 0x0D ||
-                          pattern[toParse] == 0x85 ||
-                          pattern[toParse] == 0x2028 ||
-                          pattern[toParse] == 0x2029)) return false;
+      return singleLine || !(c == 0x0A || c == 0x0B || c == 0x0C || c == 0x0D ||
+                             c == 0x85 || c == 0x2028 || c == 0x2029);
+    case ReDigit:
+      return Character::isDigit(c);
+    case ReNDigit:
+      return !Character::isDigit(c);
+    case ReWordSymb:
+      return Character::isLetterOrDigit(c) || c == '_';
+    case ReNWordSymb:
+      return !(Character::isLetterOrDigit(c) || c == '_');
+    case ReWSpace:
+      return Character::isWhitespace(c);
+    case ReNWSpace:
+      return !Character::isWhitespace(c);
+    case ReUCase:
+      return Character::isUpperCase(c);
+    case ReNUCase:
+      return Character::isLowerCase(c);
+    default:
+      return false;
+  }
+}
+
+bool CRegExp::checkMetaSymbol(CRegExpContext *ctx, EMetaSymbols symb, int &toParse) const
+{
+const ParsedString pattern(ctx->global_pattern, ctx->buffer);
+int end = ctx->end;
+
+  switch(symb){
+    case ReAnyChr:
+    case ReDigit:
+    case ReNDigit:
+    case ReWordSymb:
+    case ReNWordSymb:
+    case ReWSpace:
+    case ReNWSpace:
+    case ReUCase:
+    case ReNUCase:
+      if (toParse >= end || !isMetaSymbolMatched(symb, pattern[toParse])) return false;
       toParse++;
       return true;
     case ReSoL:
@@ -697,57 +1144,23 @@ const String &pattern = *global_pattern;
         return (toParse == end || ok);
       }
       return (end == toParse);
-    case ReDigit:
-      if (toParse >= end || !Character::isDigit(pattern[toParse])) return false;
-      toParse++;
-      return true;
-    case ReNDigit:
-      if (toParse >= end || Character::isDigit(pattern[toParse])) return false;
-      toParse++;
-      return true;
-    case ReWordSymb:
-      if (toParse >= end || !(Character::isLetterOrDigit(pattern[toParse])
-          || pattern[toParse] == '_')) return false;
-      toParse++;
-      return true;
-    case ReNWordSymb:
-      if (toParse >= end || Character::isLetterOrDigit(pattern[toParse])
-          || pattern[toParse] == '_') return false;
-      toParse++;
-      return true;
-    case ReWSpace:
-      if (toParse >= end || !Character::isWhitespace(pattern[toParse])) return false;
-      toParse++;
-      return true;
-    case ReNWSpace:
-      if (toParse >= end || Character::isWhitespace(pattern[toParse])) return false;
-      toParse++;
-      return true;
-    case ReUCase:
-      if (toParse >= end || !Character::isUpperCase(pattern[toParse])) return false;
-      toParse++;
-      return true;
-    case ReNUCase:
-      if (toParse >= end || !Character::isLowerCase(pattern[toParse])) return false;
-      toParse++;
-      return true;
     case ReWBound:
-      return isWordBoundary(toParse);
+      return isWordBoundary(ctx, toParse);
     case ReNWBound:
-      return isNWordBoundary(toParse);
+      return isNWordBoundary(ctx, toParse);
     case RePreNW:
       if (toParse >= end) return true;
       return toParse == 0 || !Character::isLetter(pattern[toParse-1]);
 #ifdef COLORERMODE
     case ReSoScheme:
-      return (schemeStart == toParse);
+      return (ctx->schemeStart == toParse);
     case ReStart:
-      matches->s[0] = toParse;
-      startChange = true;
+      ctx->matches->s[0] = toParse;
+      ctx->startChange = true;
       return true;
     case ReEnd:
-      matches->e[0] = toParse;
-      endChange = true;
+      ctx->matches->e[0] = toParse;
+      ctx->endChange = true;
       return true;
 #endif
     default:
@@ -755,535 +1168,459 @@ const String &pattern = *global_pattern;
   }
 }
 
-void CRegExp::check_stack(bool res,SRegInfo **re, SRegInfo **prev, int *toParse, bool *leftenter, int *action)
+void CRegExp::check_stack(CRegExpContext *ctx, bool res, int *re, int *toParse, bool *leftenter, int *action)
 {
-  if (count_elem==0){
+  if (ctx->count_elem==0){
     *action=res;
     return;
   }
 
-  StackElem &ne=RegExpStack[--count_elem];
+  StackElem &ne=ctx->stack[--ctx->count_elem];
   if (res){
     *action=ne.ifTrueReturn;
   }else{
     *action=ne.ifFalseReturn;
   }
   *re=ne.re;
-  *prev=ne.prev;
   *toParse=ne.toParse;
   *leftenter=ne.leftenter;
 }
 
-void CRegExp::insert_stack(SRegInfo **re, SRegInfo **prev, int *toParse, bool *leftenter, int ifTrueReturn, int ifFalseReturn, SRegInfo **re2, SRegInfo **prev2, int toParse2)
+void CRegExp::insert_stack(CRegExpContext *ctx, int *re, int *toParse, bool *leftenter, int ifTrueReturn, int ifFalseReturn, int re2, int prev2, int toParse2) const
 {
-  if (RegExpStack_Size==0){
-    RegExpStack = new StackElem [INIT_MEM_SIZE];
-    RegExpStack_Size = INIT_MEM_SIZE;
+  if (ctx->stack.empty()){
+    ctx->stack.resize(INIT_MEM_SIZE);
   }
-  if(RegExpStack_Size==count_elem){
-    RegExpStack_Size+= MEM_INC;
-    StackElem* s = new StackElem [RegExpStack_Size];
-    memcpy(s,RegExpStack,count_elem*sizeof(StackElem));
-    delete[] RegExpStack;
-    RegExpStack=s;
+  if((int)ctx->stack.size()==ctx->count_elem){
+    ctx->stack.resize(ctx->stack.size() + MEM_INC);
   }
-  StackElem &ne=RegExpStack[count_elem++];
+  StackElem &ne=ctx->stack[ctx->count_elem++];
   ne.re=*re;
-  ne.prev=*prev;
   ne.toParse=*toParse;
   ne.ifTrueReturn=ifTrueReturn;
   ne.ifFalseReturn=ifFalseReturn;
   ne.leftenter=*leftenter;
 
-  if (prev2==nullptr) *prev=nullptr;
-  else  *prev=*prev2;
-  *re=*re2; 
+  *re=re2;
   *toParse=toParse2;
   // this is init operation from lowParse
   *leftenter = true;
-  if (!*re){
-    *re = (*prev)->parent;
+  if (*re == -1){
+    *re = program[prev2].parent;
     *leftenter = false;
   }
 }
 
-bool CRegExp::lowParse(SRegInfo *re, SRegInfo *prev, int toParse)
+bool CRegExp::lowParse(CRegExpContext *ctx, int re, int toParse) const
 {
 int i, sv, wlen;
 bool leftenter = true;
-bool br = false;
-const String &pattern = *global_pattern;
+const ParsedString pattern(ctx->global_pattern, ctx->buffer);
+const int end = ctx->end;
+SMatches *matches = ctx->matches;
+#ifdef COLORERMODE
+const String *backStr = ctx->backStr;
+SMatches *backTrace = ctx->backTrace;
+#endif
+#ifdef NAMED_MATCHES_IN_HASH
+SMatchHash *namedMatches = ctx->namedMatches;
+SMatch *mt;
+#endif
+const SRegCode *code = program.data();
+const SRegCode *cr;
+SRegState *states = ctx->states.data();
+SRegState *rs;
 int action=-1;
 
-  if (!re){
-    re = prev->parent;
-    leftenter = false;
-  }
   while (true){
-    while(re || action!=-1){
-      if (re && action==-1)
-      switch(re->op){
+    while(re != -1 || action!=-1){
+      if (re != -1 && action==-1){
+      cr = &code[re];
+      switch(cr->op){
       case ReEmpty:
         break;
       case ReBrackets:
       case ReNamedBrackets:
         if (leftenter){
-          re->s = toParse;
-          re = re->un.param;
+          states[cr->stateNo].s = toParse;
+          re = cr->param;
           leftenter = true;
           continue;
         }
-        if (re->param0 == -1) break;
-        if (re->op == ReBrackets){
-          if (re->param0 || !startChange)
-            matches->s[re->param0] = re->s;
-          if (re->param0 || !endChange)
-            matches->e[re->param0] = toParse;
-          if (matches->e[re->param0] < matches->s[re->param0])
-            matches->s[re->param0] = matches->e[re->param0];
+        if (cr->param0 == -1) break;
+        if (cr->op == ReBrackets){
+          if (cr->param0 || !ctx->startChange)
+            matches->s[cr->param0] = states[cr->stateNo].s;
+          if (cr->param0 || !ctx->endChange)
+            matches->e[cr->param0] = toParse;
+          if (matches->e[cr->param0] < matches->s[cr->param0])
+            matches->s[cr->param0] = matches->e[cr->param0];
         }else{
 #ifndef NAMED_MATCHES_IN_HASH
-          matches->ns[re->param0] = re->s;
-          matches->ne[re->param0] = toParse;
-          if (matches->ne[re->param0] < matches->ns[re->param0])
-            matches->ns[re->param0] = matches->ne[re->param0];
+          matches->ns[cr->param0] = states[cr->stateNo].s;
+          matches->ne[cr->param0] = toParse;
+          if (matches->ne[cr->param0] < matches->ns[cr->param0])
+            matches->ns[cr->param0] = matches->ne[cr->param0];
 #else
-          SMatch mt = { re->s, toParse };
-          namedMatches->setItem(re->namedata, mt);
+          SMatch nmt = { states[cr->stateNo].s, toParse };
+          namedMatches->setItem(cr->namedata, nmt);
 #endif
         }
         break;
       case ReSymb:
-        if (toParse >= end){
-          check_stack(false,&re,&prev,&toParse,&leftenter,&action);
-          continue;
-        }
+        if (toParse >= end) goto fail;
         if (ignoreCase){
-          if (Character::toLowerCase(pattern[toParse]) != Character::toLowerCase(re->un.symbol) &&
-            Character::toUpperCase(pattern[toParse]) != Character::toUpperCase(re->un.symbol)){
-              check_stack(false,&re,&prev,&toParse,&leftenter,&action); 
-              continue;
-          }
-        }else if (pattern[toParse] != re->un.symbol){
-          check_stack(false,&re,&prev,&toParse,&leftenter,&action);
-          continue;
-        }
+          // s and e keep lower and upper case forms of the symbol
+          if (Character::toLowerCase(pattern[toParse]) != cr->s &&
+              Character::toUpperCase(pattern[toParse]) != cr->e) goto fail;
+        }else if (pattern[toParse] != cr->un.symbol) goto fail;
         toParse++;
         break;
       case ReMetaSymb:
-        if (!checkMetaSymbol(re->un.metaSymbol, toParse)){
-          check_stack(false,&re,&prev,&toParse,&leftenter,&action);
-          continue;
-        }
+        if (!checkMetaSymbol(ctx, cr->un.metaSymbol, toParse)) goto fail;
         break;
       case ReWord:
-        wlen = re->un.word->length();
-        if (toParse+wlen > end) {
-          check_stack(false,&re,&prev,&toParse,&leftenter,&action); 
-          continue;
-        }
+        // e keeps the word length
+        wlen = cr->e;
+        if (toParse+wlen > end) goto fail;
         if (ignoreCase){
-          if (!CString(&pattern, toParse, wlen).equalsIgnoreCase(re->un.word)){
-            check_stack(false,&re,&prev,&toParse,&leftenter,&action);
-            continue;
+          for(i = 0; i < wlen; i++){
+            if (Character::toLowerCase(pattern[toParse+i]) != Character::toLowerCase((*cr->un.word)[i]) ||
+                Character::toUpperCase(pattern[toParse+i]) != Character::toUpperCase((*cr->un.word)[i])) goto fail;
           }
-          toParse += wlen;
         }else{
-          br = false;
           for(i = 0; i < wlen; i++){
-            if(pattern[toParse+i] != (*re->un.word)[i]){
-              check_stack(false,&re,&prev,&toParse,&leftenter,&action); 
-              br = true;
-              break;
-            }
+            if(pattern[toParse+i] != (*cr->un.word)[i]) goto fail;
           }
-          if (br) continue;
-          toParse += wlen;
         }
+        toParse += wlen;
         break;
       case ReEnum:
-        if (toParse >= end){
-          check_stack(false,&re,&prev,&toParse,&leftenter,&action);
-          continue;
-        }
-        if (!re->un.charclass->inClass(pattern[toParse])) {
-          check_stack(false,&re,&prev,&toParse,&leftenter,&action);
-          continue;
-        }
+        if (toParse >= end) goto fail;
+        if (!cr->un.charclass->inClass(pattern[toParse])) goto fail;
         toParse++;
         break;
       case ReNEnum:
-        if (toParse >= end){
-          check_stack(false,&re,&prev,&toParse,&leftenter,&action);
-          continue;
-        }
-        if (re->un.charclass->inClass(pattern[toParse])){
-          check_stack(false,&re,&prev,&toParse,&leftenter,&action); 
-          continue;
-        }
+        if (toParse >= end) goto fail;
+        if (cr->un.charclass->inClass(pattern[toParse])) goto fail;
         toParse++;
         break;
 #ifdef COLORERMODE
       case ReBkTrace:
-        sv = re->param0;
-        if (!backStr || !backTrace || sv == -1){
-          check_stack(false,&re,&prev,&toParse,&leftenter,&action); 
-          continue;
-        }
-        br = false;
+        sv = cr->param0;
+        if (!backStr || !backTrace || sv == -1) goto fail;
         for (i = backTrace->s[sv]; i < backTrace->e[sv]; i++){
-          if (toParse >= end || pattern[toParse] != (*backStr)[i]){
-            check_stack(false,&re,&prev,&toParse,&leftenter,&action); 
-            br = true;
-            break;
-          }
+          if (toParse >= end || pattern[toParse] != (*backStr)[i]) goto fail;
           toParse++;
         }
-        if (br) continue;
         break;
       case ReBkTraceN:
-        sv = re->param0;
-        if (!backStr || !backTrace || sv == -1){
-          check_stack(false,&re,&prev,&toParse,&leftenter,&action); 
-          continue;
-        }
-        br = false;
+        sv = cr->param0;
+        if (!backStr || !backTrace || sv == -1) goto fail;
         for (i = backTrace->s[sv]; i < backTrace->e[sv]; i++){
-          if (toParse >= end || Character::toLowerCase(pattern[toParse]) != Character::toLowerCase((*backStr)[i])) {
-            check_stack(false,&re,&prev,&toParse,&leftenter,&action); 
-            br = true;
-            break;
-          }
+          if (toParse >= end || Character::toLowerCase(pattern[toParse]) != Character::toLowerCase((*backStr)[i])) goto fail;
           toParse++;
         }
-        if (br) continue;
         break;
       case ReBkTraceName:
 #ifndef NAMED_MATCHES_IN_HASH
-        sv = re->param0;
-        if (!backStr || !backTrace || sv == -1) {
-          check_stack(false,&re,&prev,&toParse,&leftenter,&action);
-          continue;
-        }
-        br = false;
+        sv = cr->param0;
+        if (!backStr || !backTrace || sv == -1) goto fail;
         for (i = backTrace->ns[sv]; i < backTrace->ne[sv]; i++){
-          if (toParse >= end || pattern[toParse] != (*backStr)[i]) {
-            check_stack(false,&re,&prev,&toParse,&leftenter,&action);
-            br = true;
-            break;
-          }
+          if (toParse >= end || pattern[toParse] != (*backStr)[i]) goto fail;
           toParse++;
         }
-        if (br) continue;
         break;
 #else
-// !!!;
-        {
-          check_stack(false,&re,&prev,&toParse,&leftenter,&action);
-          continue;
-        } 
+        goto fail;
 #endif // NAMED_MATCHES_IN_HASH
       case ReBkTraceNName:
 #ifndef NAMED_MATCHES_IN_HASH
-        sv = re->param0;
-        if (!backStr || !backTrace || sv == -1) {
-          check_stack(false,&re,&prev,&toParse,&leftenter,&action);
-          continue;
-        }
-        br = false;
+        sv = cr->param0;
+        if (!backStr || !backTrace || sv == -1) goto fail;
         for (i = backTrace->s[sv]; i < backTrace->e[sv]; i++){
-          if (Character::toLowerCase(pattern[toParse]) != Character::toLowerCase((*backStr)[i]) || toParse >= end)  {
-            check_stack(false,&re,&prev,&toParse,&leftenter,&action);
-            br = true;
-            break;
-          }
+          if (Character::toLowerCase(pattern[toParse]) != Character::toLowerCase((*backStr)[i]) || toParse >= end) goto fail;
           toParse++;
         }
-        if (br) continue;
         break;
 #else
-// !!;
-        {
-          check_stack(false,&re,&prev,&toParse,&leftenter,&action);
-          continue;
-        }
+        goto fail;
 #endif // NAMED_MATCHES_IN_HASH
 #endif // COLORERMODE
 
       case ReBkBrackName:
 #ifndef NAMED_MATCHES_IN_HASH
-        sv = re->param0;
-        if (sv == -1 || cnMatch <= sv) {
-          check_stack(false,&re,&prev,&toParse,&leftenter,&action);
-          continue;
-        }
-        if (matches->ns[sv] == -1 || matches->ne[sv] == -1) {
-          check_stack(false,&re,&prev,&toParse,&leftenter,&action);
-          continue;
-        }
-        br = false;
+        sv = cr->param0;
+        if (sv == -1 || cnMatch <= sv) goto fail;
+        if (matches->ns[sv] == -1 || matches->ne[sv] == -1) goto fail;
         for (i = matches->ns[sv]; i < matches->ne[sv]; i++){
-          if (toParse >= end || pattern[toParse] != pattern[i]) {
-            check_stack(false,&re,&prev,&toParse,&leftenter,&action);
-            br = true;
-            break;
-          }
+          if (toParse >= end || pattern[toParse] != pattern[i]) goto fail;
           toParse++;
         }
-        if (br) continue;
         break;
 #else
-        {
-          SMatch *mt = namedMatches->getItem(re->namedata);
-          if (!mt) {
-            check_stack(false,&re,&prev,&toParse,&leftenter,&action);
-            continue;
-          }
-          if (mt->s == -1 || mt->e == -1) {
-            check_stack(false,&re,&prev,&toParse,&leftenter,&action); 
-            continue;
-          }
-          br = false;
-          for (i = mt->s; i < mt->e; i++){
-            if (toParse >= end || pattern[toParse] != pattern[i]){
-              check_stack(false,&re,&prev,&toParse,&leftenter,&action);
-              br = true;
-              break;
-            }
-            toParse++;
-          }
-          if (br) continue;
+        mt = namedMatches->getItem(cr->namedata);
+        if (!mt) goto fail;
+        if (mt->s == -1 || mt->e == -1) goto fail;
+        for (i = mt->s; i < mt->e; i++){
+          if (toParse >= end || pattern[toParse] != pattern[i]) goto fail;
+          toParse++;
         }
         break;
 #endif // NAMED_MATCHES_IN_HASH
 
       case ReBkBrack:
-        sv = re->param0;
-        if (sv == -1 || cMatch <= sv){
-          check_stack(false,&re,&prev,&toParse,&leftenter,&action);
-          continue;
-        }
-        if (matches->s[sv] == -1 || matches->e[sv] == -1){
-          check_stack(false,&re,&prev,&toParse,&leftenter,&action);
-          continue;
-        }
-        br = false;
+        sv = cr->param0;
+        if (sv == -1 || cMatch <= sv) goto fail;
+        if (matches->s[sv] == -1 || matches->e[sv] == -1) goto fail;
         for (i = matches->s[sv]; i < matches->e[sv]; i++){
-          if (toParse >= end || pattern[toParse] != pattern[i]){
-            check_stack(false,&re,&prev,&toParse,&leftenter,&action);
-            br = true;
-            break;
-          }
+          if (toParse >= end || pattern[toParse] != pattern[i]) goto fail;
           toParse++;
         }
-        if (br) continue;
         break;
       case ReAhead:
         if (!leftenter){
-          check_stack(true,&re,&prev,&toParse,&leftenter,&action);
+          check_stack(ctx,true,&re,&toParse,&leftenter,&action);
           continue;
         }
-        {
-          insert_stack(&re,&prev,&toParse,&leftenter,rea_Break,rea_False,&re->un.param,0,toParse);
-          continue;
-        }
-        break;
+        insert_stack(ctx,&re,&toParse,&leftenter,rea_Break,rea_False,cr->param,-1,toParse);
+        continue;
       case ReNAhead:
         if (!leftenter){
-          check_stack(true,&re,&prev,&toParse,&leftenter,&action); 
-          continue;
-        }
-        {
-          insert_stack(&re,&prev,&toParse,&leftenter,rea_False,rea_Break,&re->un.param,0,toParse);
+          check_stack(ctx,true,&re,&toParse,&leftenter,&action);
           continue;
         }
-        break;
+        insert_stack(ctx,&re,&toParse,&leftenter,rea_False,rea_Break,cr->param,-1,toParse);
+        continue;
       case ReBehind:
         if (!leftenter){
-          check_stack(true,&re,&prev,&toParse,&leftenter,&action); 
-          continue;
-        }
-        if (toParse - re->param0 < 0) {
-          check_stack(false,&re,&prev,&toParse,&leftenter,&action); 
+          check_stack(ctx,true,&re,&toParse,&leftenter,&action);
           continue;
         }
-        else{
-          insert_stack(&re,&prev,&toParse,&leftenter,rea_Break,rea_False,&re->un.param,0,toParse - re->param0);
-          continue;
-        }
-        break;
+        if (toParse - cr->param0 < 0) goto fail;
+        insert_stack(ctx,&re,&toParse,&leftenter,rea_Break,rea_False,cr->param,-1,toParse - cr->param0);
+        continue;
       case ReNBehind:
         if (!leftenter){
-          check_stack(true,&re,&prev,&toParse,&leftenter,&action); 
+          check_stack(ctx,true,&re,&toParse,&leftenter,&action);
           continue;
         }
-        if (toParse - re->param0 >= 0){ 
-          insert_stack(&re,&prev,&toParse,&leftenter,rea_False,rea_Break,&re->un.param,0,toParse - re->param0);
+        if (toParse - cr->param0 >= 0){
+          insert_stack(ctx,&re,&toParse,&leftenter,rea_False,rea_Break,cr->param,-1,toParse - cr->param0);
           continue;
         }
         break;
 
       case ReOr:
         if (!leftenter){
-          while (re->next)
-            re = re->next;
+          while (code[re].next != -1)
+            re = code[re].next;
           break;
         }
-        {
-          insert_stack(&re,&prev,&toParse,&leftenter,rea_True,rea_Break,&re->un.param,0,toParse );
-          continue;
-        }
-        break;
+        insert_stack(ctx,&re,&toParse,&leftenter,rea_True,rea_Break,cr->param,-1,toParse);
+        continue;
       case ReRangeN:
+        rs = &states[cr->stateNo];
         // first enter into op
         if (leftenter){
-          re->param0 = re->s;
-          re->oldParse = -1;
+          rs->param0 = cr->s;
+          rs->oldParse = -1;
         }
-        if (!re->param0 && re->oldParse == toParse) break;
-        re->oldParse = toParse;
+        if (!rs->param0 && rs->oldParse == toParse) break;
+        rs->oldParse = toParse;
         // making branch
-        if (!re->param0){
-          insert_stack(&re,&prev,&toParse,&leftenter,rea_True,rea_RangeN_step2,&re->un.param,0,toParse );
+        if (!rs->param0){
+          insert_stack(ctx,&re,&toParse,&leftenter,rea_True,rea_RangeN_step2,cr->param,-1,toParse);
           continue;
         }
         // go into
-        if (re->param0) re->param0--;
-        re = re->un.param;
+        if (rs->param0) rs->param0--;
+        re = cr->param;
         leftenter = true;
         continue;
       case ReRangeNM:
+        rs = &states[cr->stateNo];
         if (leftenter){
-          re->param0 = re->s;
-          re->param1 = re->e - re->s;
-          re->oldParse = -1;
+          rs->param0 = cr->s;
+          rs->param1 = cr->e - cr->s;
+          rs->oldParse = -1;
         }
-        if (!re->param0){
-          if (re->param1) re->param1--;
+        if (!rs->param0){
+          if (rs->param1) rs->param1--;
           else{
-            insert_stack(&re,&prev,&toParse,&leftenter,rea_True,rea_False,&re->next,&re,toParse );
-            continue;
-          }
-          {
-            insert_stack(&re,&prev,&toParse,&leftenter,rea_True,rea_RangeNM_step2,&re->un.param,0,toParse );
+            insert_stack(ctx,&re,&toParse,&leftenter,rea_True,rea_False,cr->next,re,toParse);
             continue;
           }
+          insert_stack(ctx,&re,&toParse,&leftenter,rea_True,rea_RangeNM_step2,cr->param,-1,toParse);
+          continue;
         }
-        if (re->param0) re->param0--;
-        re = re->un.param;
+        if (rs->param0) rs->param0--;
+        re = cr->param;
         leftenter = true;
         continue;
       case ReNGRangeN:
+        rs = &states[cr->stateNo];
         if (leftenter){
-          re->param0 = re->s;
-          re->oldParse = -1;
+          rs->param0 = cr->s;
+          rs->oldParse = -1;
         }
-        if (!re->param0 && re->oldParse == toParse) break;
-        re->oldParse = toParse;
-        if (!re->param0){
-          insert_stack(&re,&prev,&toParse,&leftenter,rea_True,rea_NGRangeN_step2,&re->next,&re,toParse );
+        if (!rs->param0 && rs->oldParse == toParse) break;
+        rs->oldParse = toParse;
+        if (!rs->param0){
+          insert_stack(ctx,&re,&toParse,&leftenter,rea_True,rea_NGRangeN_step2,cr->next,re,toParse);
           continue;
         }
-        if (re->param0) re->param0--;
-        re = re->un.param;
+        if (rs->param0) rs->param0--;
+        re = cr->param;
         leftenter = true;
         continue;
       case ReNGRangeNM:
+        rs = &states[cr->stateNo];
         if (leftenter){
-          re->param0 = re->s;
-          re->param1 = re->e - re->s;
-          re->oldParse = -1;
+          rs->param0 = cr->s;
+          rs->param1 = cr->e - cr->s;
+          rs->oldParse = -1;
         }
-        if (!re->param0){
-          if (re->param1) re->param1--;
+        if (!rs->param0){
+          if (rs->param1) rs->param1--;
           else {
-            insert_stack(&re,&prev,&toParse,&leftenter,rea_True,rea_False,&re->next,&re,toParse );
-            continue;
-          }
-          {
-            insert_stack(&re,&prev,&toParse,&leftenter,rea_True,rea_NGRangeNM_step2,&re->next,&re,toParse );
+            insert_stack(ctx,&re,&toParse,&leftenter,rea_True,rea_False,cr->next,re,toParse);
             continue;
           }
+          insert_stack(ctx,&re,&toParse,&leftenter,rea_True,rea_NGRangeNM_step2,cr->next,re,toParse);
+          continue;
         }
-        if (re->param0) re->param0--;
-        re = re->un.param;
+        if (rs->param0) rs->param0--;
+        re = cr->param;
         leftenter = true;
         continue;
-    }
-   
-    switch (action){
-      case rea_False: 
-        if (count_elem){
-          check_stack(false,&re,&prev,&toParse,&leftenter,&action);
-          continue;
-        }else
-          return false; 
+      default:
         break;
-      case rea_True: 
-        if (count_elem){
-          check_stack(true,&re,&prev,&toParse,&leftenter,&action);
+      }
+      }
+
+      switch (action){
+        case rea_False:
+          if (ctx->count_elem) goto fail;
+          return false;
+        case rea_True:
+          if (ctx->count_elem){
+            check_stack(ctx,true,&re,&toParse,&leftenter,&action);
+            continue;
+          }
+          return true;
+        case rea_Break:
+          action = -1;
+          break;
+        case rea_RangeN_step2:
+          action = -1;
+          insert_stack(ctx,&re,&toParse,&leftenter,rea_True,rea_False,code[re].next,re,toParse);
           continue;
-        }else
-          return true; 
-        break;
-      case rea_Break: 
-        action = -1; 
-        break;
-      case rea_RangeN_step2: 
-        action = -1;
-        insert_stack(&re,&prev,&toParse,&leftenter,rea_True,rea_False,&re->next,&re,toParse);
-        continue;
-        break;
-      case rea_RangeNM_step2:
-        action = -1;
-        insert_stack(&re,&prev,&toParse,&leftenter,rea_True,rea_RangeNM_step3,&re->next,&re,toParse);
-        continue;
-        break;
-      case rea_RangeNM_step3:
-        action = -1;
-        re->param1++;
-        check_stack(false,&re,&prev,&toParse,&leftenter,&action);
-        continue;
-        break;
-      case rea_NGRangeN_step2:
-        action = -1;
-        if (re->param0) re->param0--;
-        re = re->un.param;
+        case rea_RangeNM_step2:
+          action = -1;
+          insert_stack(ctx,&re,&toParse,&leftenter,rea_True,rea_RangeNM_step3,code[re].next,re,toParse);
+          continue;
+        case rea_RangeNM_step3:
+          action = -1;
+          states[code[re].stateNo].param1++;
+          goto fail;
+        case rea_NGRangeN_step2:
+          action = -1;
+          rs = &states[code[re].stateNo];
+          if (rs->param0) rs->param0--;
+          re = code[re].param;
+          leftenter = true;
+          continue;
+        case rea_NGRangeNM_step2:
+          action = -1;
+          insert_stack(ctx,&re,&toParse,&leftenter,rea_True,rea_NGRangeNM_step3,code[re].param,-1,toParse);
+          continue;
+        case rea_NGRangeNM_step3:
+          action = -1;
+          states[code[re].stateNo].param1++;
+          goto fail;
+      }
+      // goes to the next instruction
+      if (code[re].next == -1){
+        re = code[re].parent;
+        leftenter = false;
+      }else{
+        re = code[re].next;
         leftenter = true;
-        continue;
-        break;
-      case rea_NGRangeNM_step2:
-        action = -1;
-        insert_stack(&re,&prev,&toParse,&leftenter,rea_True,rea_NGRangeNM_step3,&re->un.param,0,toParse);
-        continue;
-        break;
-      case rea_NGRangeNM_step3:
-        action = -1;
-        re->param1++;
-        check_stack(false,&re,&prev,&toParse,&leftenter,&action);
-        continue;
-        break;
+      }
+      continue;
+fail:
+      // each backtracking is a step, counted against the limit
+      if (--ctx->stepsLeft < 0){
+        ctx->limitExceeded = true;
+        ctx->count_elem = 0;
+        return false;
+      }
+      // backtracks to the last stored position
+      check_stack(ctx,false,&re,&toParse,&leftenter,&action);
     }
-    if (!re->next){
-      re = re->parent;
-      leftenter = false;
-    }else{
-      re = re->next;
-      leftenter = true;
+    check_stack(ctx,true,&re,&toParse,&leftenter,&action);
+  }
+}
+
+/**
+  Searches symbol @c c in the buffer positions from @c pos to @c end.
+  @return symbol position or -1, if not found.
+*/
+static int findSymbol(const wchar *buf, int pos, int end, wchar c)
+{
+#ifdef CREGEXP_SSE2
+  if (sizeof(wchar) == 2){
+    const __m128i sym = _mm_set1_epi16((short)c);
+    for(; pos + 8 <= end; pos += 8){
+      __m128i block = _mm_loadu_si128((const __m128i*)(buf + pos));
+      int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(block, sym));
+      if (mask) return pos + (__builtin_ctz(mask) >> 1);
     }
   }
-  check_stack(true,&re,&prev,&toParse,&leftenter,&action);
+#endif
+  for(; pos < end; pos++)
+    if (buf[pos] == c) return pos;
+  return -1;
+}
+
+/**
+  Searches @c literal in the buffer, starting from @c pos.
+  Literal must end before @c end.
+  @return literal position or -1, if not found.
+*/
+static int findLiteral(const wchar *buf, const std::vector<wchar> &literal, int pos, int end)
+{
+  int llen = (int)literal.size();
+  int last = end - llen;
+  for(; pos <= last; pos++){
+    pos = findSymbol(buf, pos, last+1, literal[0]);
+    if (pos == -1) return -1;
+    int i;
+    for(i = 1; i < llen && buf[pos+i] == literal[i]; i++);
+    if (i == llen) return pos;
   }
+  return -1;
 }
 
-inline bool CRegExp::quickCheck(int toParse)
+bool CRegExp::inFirstSet(CRegExpContext *ctx, int toParse) const
 {
+  if (toParse >= ctx->end) return false;
+  wchar c = ParsedString(ctx->global_pattern, ctx->buffer)[toParse];
+  if (c > 0xFF) return firstOther;
+  return (firstSet[c >> 5] >> (c & 31)) & 1;
+}
+
+inline bool CRegExp::quickCheck(CRegExpContext *ctx, int toParse) const
+{
+  if (firstSetUsed && !inFirstSet(ctx, toParse)) return false;
   if (firstChar != BAD_WCHAR){
-    if (toParse >= end) return false;
+    if (toParse >= ctx->end) return false;
+    wchar c = ParsedString(ctx->global_pattern, ctx->buffer)[toParse];
     if (ignoreCase){
-      if (Character::toLowerCase((*global_pattern)[toParse]) != Character::toLowerCase(firstChar)) return false;
+      if (Character::toLowerCase(c) != Character::toLowerCase(firstChar)) return false;
     }else
-      if ((*global_pattern)[toParse] != firstChar) return false;
+      if (c != firstChar) return false;
     return true;
   }
   if (firstMetaChar != ReBadMeta)
@@ -1293,7 +1630,7 @@ inline bool CRegExp::quickCheck(int toParse)
       return true;
 #ifdef COLORERMODE
     case ReSoScheme:
-      if (toParse != schemeStart) return false;
+      if (toParse != ctx->schemeStart) return false;
       return true;
 #endif
 //    case ReWBound:
@@ -1302,53 +1639,119 @@ inline bool CRegExp::quickCheck(int toParse)
   return true;
 }
 
-inline bool CRegExp::parseRE(int pos)
+inline bool CRegExp::parseRE(CRegExpContext *ctx, int pos) const
 {
   if (error) return false;
 
   int toParse = pos;
 
-  if (!positionMoves && (firstChar != BAD_WCHAR || firstMetaChar != ReBadMeta) && !quickCheck(toParse))
+  if (!ctx->positionMoves && !quickCheck(ctx, toParse))
     return false;
 
-  int i;
-  for (i = 0; i < cMatch; i++)
-    matches->s[i] = matches->e[i] = -1;
+  SMatches *matches = ctx->matches;
   matches->cMatch = cMatch;
 #ifndef NAMED_MATCHES_IN_HASH
-  for (i = 0; i < cnMatch; i++)
-    matches->ns[i] = matches->ne[i] = -1;
   matches->cnMatch = cnMatch;
 #endif
+  if ((int)ctx->states.size() < statesNum)
+    ctx->states.resize(statesNum);
+  ctx->count_elem = 0;
+
+  const wchar *buf = ctx->buffer;
+  // moving search needs only the positions of literal occurrences
+  if (ctx->positionMoves && buf && !required.empty() &&
+      findLiteral(buf, required, pos, ctx->end) == -1)
+    return false;
+  if (dfa){
+    if (ctx->positionMoves && buf && !prefix.empty()){
+      pos = findLiteral(buf, prefix, pos, ctx->end);
+      if (pos == -1) return false;
+    }
+    return dfa->match(ctx, pos);
+  }
   do{
-    //stack=null;
-    if (lowParse(tree_root, 0, toParse)) return true;
-    if (!positionMoves) return false;
+    if (ctx->positionMoves && buf && !prefix.empty()){
+      pos = findLiteral(buf, prefix, pos, ctx->end);
+      if (pos == -1) return false;
+      toParse = pos;
+    }
+    // each attempt starts with clean matches, so failed attempts
+    // on the previous positions do not affect the result
+    if (!firstSetUsed || inFirstSet(ctx, toParse)){
+      int i;
+      for (i = 0; i < cMatch; i++)
+        matches->s[i] = matches->e[i] = -1;
+#ifndef NAMED_MATCHES_IN_HASH
+      for (i = 0; i < cnMatch; i++)
+        matches->ns[i] = matches->ne[i] = -1;
+#endif
+      ctx->startChange = ctx->endChange = false;
+      if (lowParse(ctx, 0, toParse)) return true;
+      if (ctx->limitExceeded) return false;
+    }
+    if (!ctx->positionMoves) return false;
     toParse = ++pos;
-  }while(toParse <= end);
+  }while(toParse <= ctx->end);
   return false;
 }
 
+bool CRegExp::parse(CRegExpContext *ctx, const String *str, int pos, int eol, SMatches *mtch
+#ifdef NAMED_MATCHES_IN_HASH
+, PMatchHash nmtch
+#endif
+, int soScheme, int posMoves) const
+{
+  ctx->positionMoves = positionMoves;
+  if (posMoves != -1) ctx->positionMoves = (posMoves != 0);
+#ifdef COLORERMODE
+  ctx->schemeStart = soScheme;
+#endif
+  ctx->global_pattern = str;
+  ctx->buffer = str->getWBuffer();
+  ctx->end = eol;
+  ctx->matches = mtch;
+#ifdef NAMED_MATCHES_IN_HASH
+  ctx->namedMatches = nmtch;
+#endif
+  if (ctx->stepBudget == 0){
+    ctx->limitExceeded = true;
+    ctx->limitHits++;
+    ctx->lastSteps = 0;
+    return false;
+  }
+  int steps = ctx->stepLimit > 0 ? ctx->stepLimit : INT_MAX;
+  if (ctx->stepBudget >= 0 && ctx->stepBudget < steps)
+    steps = (int)ctx->stepBudget;
+  ctx->stepsLeft = steps;
+  ctx->limitExceeded = false;
+
+  bool res = parseRE(ctx, pos);
+
+  if (ctx->limitExceeded){
+    ctx->limitHits++;
+    ctx->stepsLeft = 0;
+  }
+  ctx->lastSteps = steps - ctx->stepsLeft;
+  if (ctx->stepBudget >= 0)
+    ctx->stepBudget -= ctx->lastSteps;
+  return res;
+}
+
 bool CRegExp::parse(const String *str, int pos, int eol, SMatches *mtch
 #ifdef NAMED_MATCHES_IN_HASH
 , PMatchHash nmtch
 #endif
 , int soScheme, int posMoves)
 {
-  bool nms = positionMoves;
-  if (posMoves != -1) positionMoves = (posMoves != 0);
+  CRegExpContext ctx;
 #ifdef COLORERMODE
-  schemeStart = soScheme;
+  ctx.setBackTrace(backStr, backTrace);
 #endif
-  global_pattern = str;
-  end = eol;
-  matches = mtch;
+  return parse(&ctx, str, pos, eol, mtch,
 #ifdef NAMED_MATCHES_IN_HASH
-  namedMatches = nmtch;
+               nmtch,
 #endif
-  bool result = parseRE(pos);
-  positionMoves = nms;
-  return result;
+               soScheme, posMoves);
 }
 
 bool CRegExp::parse(const String *str, SMatches *mtch
@@ -1357,16 +1760,11 @@ bool CRegExp::parse(const String *str, SMatches *mtch
 #endif
 )
 {
-  end = str->length();
-  global_pattern = str;
-#ifdef COLORERMODE
-  schemeStart = 0;
-#endif
-  matches = mtch;
+  return parse(str, 0, str->length(), mtch,
 #ifdef NAMED_MATCHES_IN_HASH
-  namedMatches = nmtch;
+               nmtch,
 #endif
-  return parseRE(0);
+               0, -1);
 }
 
 /////////////////////////////////////////////////////////////////
@@ -1386,6 +1784,20 @@ bool CRegExp::setRE(const String *re)
 #endif
   return error == EOK;
 }
+bool CRegExp::canStartWith(wchar c) const
+{
+  if (error) return false;
+  if (!firstSetUsed || positionMoves) return true;
+  if (c > 0xFF) return firstOther;
+  return (firstSet[c >> 5] >> (c & 31)) & 1;
+}
+
+bool CRegExp::canMatchAtEnd() const
+{
+  if (error) return false;
+  return !firstSetUsed;
+}
+
 bool CRegExp::isOk()
 {
   return error == EOK;
@@ -1,6 +1,8 @@
 #ifndef __CREGEXP__
 #define __CREGEXP__
 
+#include<vector>
+#include<memory>
 #include<colorer/unicode/String.h>
 #include<colorer/unicode/CharacterClass.h>
 
@@ -153,28 +155,66 @@ public:
   SRegInfo *parent;
   SRegInfo *next;
   SRegInfo *prev;
-  int oldParse;
-  int param0, param1;
+  int param0;
   int s, e;
 
   EOps op;
 };
 
+/** Instruction of the flat RE program.
+    Program is compiled from SRegInfo tree in preorder, so operands of
+    each operator follow it immediately. All links are program indexes,
+    -1 means no link.
+    @ingroup cregexp
+*/
+struct SRegCode
+{
+  EOps op;
+  // next instruction in sequence
+  int next;
+  // enclosing operator
+  int parent;
+  // first instruction of operator's operand sequence
+  int param;
+  int param0;
+  // range bounds; lower and upper case forms for ReSymb; length for ReWord
+  int s, e;
+  // index of instruction's SRegState in CRegExpContext, -1 if stateless
+  int stateNo;
+  union{
+    EMetaSymbols metaSymbol;
+    wchar symbol;
+    String *word;
+    CharacterClass *charclass;
+  }un;
+#if defined NAMED_MATCHES_IN_HASH
+  String *namedata;
+#endif
+};
+
+/** Mutable matching state of a single brackets or range instruction.
+    @ingroup cregexp
+*/
+struct SRegState
+{
+  // bracket start position
+  int s;
+  // range counters
+  int param0, param1;
+  int oldParse;
+};
+
 struct StackElem{
   //local variable
-  SRegInfo *re;
-  SRegInfo *prev;
+  int re;
   int toParse;
   bool leftenter;
   // step if function return true
-  int ifTrueReturn;
+  unsigned char ifTrueReturn;
   // step if function return false
-  int ifFalseReturn;
+  unsigned char ifFalseReturn;
 };
 
-extern StackElem *RegExpStack;
-extern int RegExpStack_Size;
-
 #define INIT_MEM_SIZE 512
 #define MEM_INC 128
 
@@ -189,6 +229,94 @@ enum ReAction {
   rea_NGRangeNM_step2,
   rea_NGRangeNM_step3
 };
+
+/** Regular expression matching context.
+    Holds all the state, changed by CRegExp while matching: backtracking
+    stack, brackets and ranges state, automaton threads, match slots
+    and back trace references.
+    Compiled CRegExp object is not modified by the matching, so it can
+    be shared between threads, each using its own context.
+    Context can be reused for any number of sequential parse calls
+    with any CRegExp objects.
+    @ingroup cregexp
+*/
+class CRegExpContext
+{
+public:
+  CRegExpContext();
+  ~CRegExpContext();
+#ifdef COLORERMODE
+  /**
+    Changes string and matches, used for backreferences with \\y \\Y operators.
+  */
+  void setBackTrace(const String *str, SMatches *trace);
+  /**
+    Returns current string and matches, used for backreferences with \\y \\Y operators.
+  */
+  void getBackTrace(const String **str, SMatches **trace) const;
+#endif
+  /**
+    Limits the number of backtracking steps of a single RE match.
+    Match, which exceeds the limit, fails.
+    @param limit maximum number of steps, 0 - no limit.
+  */
+  void setStepLimit(int limit);
+  /**
+    Sets the number of backtracking steps, shared by all the next
+    RE matches with this context. When the budget is exhausted,
+    all the matches fail, until the budget is set again.
+    @param budget number of steps, -1 - no budget.
+  */
+  void setStepBudget(long long budget);
+  /** Returns remaining steps budget, or -1, if there is no budget. */
+  long long getStepBudget() const;
+  /** Was the last match stopped because of the step limit or budget. */
+  bool isLimitExceeded() const;
+  /** Returns the number of matches, stopped because of the step limit or budget. */
+  int getLimitHits() const;
+  /** Returns the number of backtracking steps, made by the last match.
+      Matches, made with automaton, take no steps. */
+  int getLastSteps() const;
+private:
+  friend class CRegExp;
+  friend class LazyDFA;
+
+  std::vector<StackElem> stack;
+  int count_elem;
+  std::vector<SRegState> states;
+  // LazyDFA threads lists with their slots, closure marks and stack
+  std::vector<int> threads[2];
+  std::vector<int> threadSlots[2];
+  std::vector<int> slots, matchSlots;
+  std::vector<int> marks;
+  int markGen;
+  std::vector<int> closureStack;
+
+  const String *global_pattern;
+  // contiguous symbols of global_pattern, if available
+  const wchar *buffer;
+  int end;
+  bool positionMoves;
+  bool startChange, endChange;
+  SMatches *matches;
+  int stepLimit;
+  long long stepBudget;
+  int stepsLeft;
+  int lastSteps;
+  bool limitExceeded;
+  int limitHits;
+#ifdef NAMED_MATCHES_IN_HASH
+  SMatchHash *namedMatches;
+#endif
+#ifdef COLORERMODE
+  const String *backStr;
+  SMatches *backTrace;
+  int schemeStart;
+#endif
+};
+
+class LazyDFA;
+
 /** Regular Expression compiler and matcher.
     Colorer regular expressions library cregexp.
 
@@ -241,7 +369,31 @@ enum ReAction {
    - No surrogate symbols support,
    - No string length changes on case mappings (only 1 <-> 1 mappings),
 \par 2.2. Algorithmic problems:
-   - Stack recursion implementation.
+   - Backtracking matcher: some patterns take exponential time,
+     the number of the steps could be limited with setStepLimit().
+     Patterns, matched with LazyDFA, take linear time.
+
+\par 3. Implementation.
+   RE text is parsed into SRegInfo tree, which is then compiled into
+   flat SRegCode program. The program is executed by the iterative
+   backtracking machine with explicit StackElem stack.
+
+   Each compiled RE keeps the set of symbols, which could start
+   a match, so most of the positions are rejected without running
+   the machine.
+   Moving search also jumps directly to the occurrences of the RE's
+   literal prefix and fails at once, if a literal required by the RE
+   is not found in the string.
+   REs with alternatives or repetitions and without back references
+   and lookarounds are matched with LazyDFA automaton instead of the
+   backtracking machine. Automaton finds the same match, as backtracking,
+   in linear time. Brackets and \\m \\M positions are taken from the
+   match path only: the ones, set on the failed branches, are not reported.
+
+\par 4. Reentrance.
+   All the matching state is kept in CRegExpContext. Methods, which
+   accept the context, are const and could be called concurrently
+   on the same CRegExp object with different contexts.
 
     @ingroup cregexp
 */
@@ -297,6 +449,16 @@ public:
     previous structures.
   */
   bool setRE(const String *re);
+  /**
+    Checks, if RE could start its match at position with symbol @c c.
+    Returns true, if it is not known.
+  */
+  bool canStartWith(wchar c) const;
+  /**
+    Checks, if RE could match at the end of the string.
+    Returns true, if it is not known.
+  */
+  bool canMatchAtEnd() const;
 #ifdef NAMED_MATCHES_IN_HASH
   /** Runs RE parser against input string @c str
   */
@@ -312,25 +474,44 @@ public:
   */
   bool parse(const String *str, int pos, int eol, SMatches *mtch, int soscheme = 0, int moves = -1);
 #endif
+  /** Runs RE parser against input string @c str using caller owned
+      matching context @c ctx. Back trace for \\y \\Y operators
+      is taken from the context. Match fails, if it exceeds the step
+      limit or budget of the context, see CRegExpContext::isLimitExceeded.
+  */
+  bool parse(CRegExpContext *ctx, const String *str, int pos, int eol, SMatches *mtch,
+#ifdef NAMED_MATCHES_IN_HASH
+             SMatchHash *nmtch = nullptr,
+#endif
+             int soscheme = 0, int moves = -1) const;
 
 private:
+  friend class LazyDFA;
+
   bool ignoreCase, extend, positionMoves, singleLine, multiLine;
   SRegInfo *tree_root;
+  std::vector<SRegCode> program;
   EError error;
   wchar firstChar;
   EMetaSymbols firstMetaChar;
+  // set of symbols, which could start a match: bits for symbols
+  // 0x00-0xFF, firstOther accepts all the others.
+  // Not used, if RE could match an empty string.
+  bool firstSetUsed, firstOther;
+  unsigned int firstSet[8];
+  // literal, which starts every match, and the longest literal,
+  // contained in every match. Collected for case sensitive REs only.
+  std::vector<wchar> prefix, required;
+  // automaton matcher, replaces backtracking, if it is built
+  std::unique_ptr<LazyDFA> dfa;
 #ifdef COLORERMODE
   CRegExp *backRE;
   const String *backStr;
   SMatches *backTrace;
-  int schemeStart;
 #endif
-  bool startChange, endChange;
-  const String *global_pattern;
-  int end;
-
-  SMatches *matches;
   int cMatch;
+  // number of SRegState slots, needed for matching
+  int statesNum;
 #if !defined NAMED_MATCHES_IN_HASH
   String* brnames[NAMED_MATCHES_NUM];
   int cnMatch;
@@ -343,16 +524,28 @@ private:
   EError setStructs(SRegInfo *&, const String &expr, int &endPos);
 
   void optimize();
-  bool quickCheck(int toParse);
-  bool isWordBoundary(int &toParse);
-  bool isNWordBoundary(int &toParse);
-  bool checkMetaSymbol(EMetaSymbols metaSymbol, int &toParse);
-  bool lowParse(SRegInfo *re, SRegInfo *prev, int toParse);
-  bool parseRE(int toParse);
-
-  int count_elem;
-  void check_stack(bool res,SRegInfo **re, SRegInfo **prev, int *toParse,bool *leftenter, int *action);
-  void insert_stack(SRegInfo **re, SRegInfo **prev, int *toParse, bool *leftenter, int ifTrueReturn, int ifFalseReturn, SRegInfo **re2, SRegInfo **prev2, int toParse2);
+  int compile(SRegInfo *re, int parent);
+  void clearProgram();
+  void makeFirstSet();
+  bool collectFirst(int re);
+  void addFirstSymbols(const SRegCode &code);
+  void makeLiterals();
+  void checkDFAUsage();
+  void collectLiterals(int re, std::vector<wchar> &run, bool &atStart);
+  void endLiteral(std::vector<wchar> &run, bool &atStart);
+  bool inFirstSet(CRegExpContext *ctx, int toParse) const;
+  bool quickCheck(CRegExpContext *ctx, int toParse) const;
+  bool isWordBoundary(CRegExpContext *ctx, int &toParse) const;
+  bool isNWordBoundary(CRegExpContext *ctx, int &toParse) const;
+  static bool isSymbolMeta(EMetaSymbols symb);
+  bool isSymbolMatched(const SRegCode &code, int wordPos, wchar c) const;
+  bool isMetaSymbolMatched(EMetaSymbols symb, wchar c) const;
+  bool checkMetaSymbol(CRegExpContext *ctx, EMetaSymbols metaSymbol, int &toParse) const;
+  bool lowParse(CRegExpContext *ctx, int re, int toParse) const;
+  bool parseRE(CRegExpContext *ctx, int toParse) const;
+
+  static void check_stack(CRegExpContext *ctx, bool res, int *re, int *toParse, bool *leftenter, int *action);
+  void insert_stack(CRegExpContext *ctx, int *re, int *toParse, bool *leftenter, int ifTrueReturn, int ifFalseReturn, int re2, int prev2, int toParse2) const;
 
 };
 
@@ -1,7 +1,5 @@
 #include <colorer/editor/BaseEditor.h>
 
-#define IDLE_PARSE(time) (100+time*4)
-
 const int CHOOSE_STR = 4;
 const int CHOOSE_LEN = 200 * CHOOSE_STR;
 
@@ -35,6 +33,7 @@ BaseEditor::BaseEditor(ParserFactory* parserFactory, LineSource* lineSource)
 
   breakParse = false;
   validationProcess = false;
+  idleParse = false;
 
   CString def_text = CString("def:Text");
   CString def_syntax = CString("def:Syntax");
@@ -57,6 +56,7 @@ BaseEditor::~BaseEditor()
   textParser->breakParse();
   breakParse = true;
   while (validationProcess); /// @todo wait until validation is finished
+  stopIdleParse();
   if (internalRM) {
     delete regionMapper;
   }
@@ -94,6 +94,7 @@ void BaseEditor::setRegionMapper(const String* hrdClass, const String* hrdName)
 
 void BaseEditor::remapLRS(bool recreate)
 {
+  stopIdleParse();
   if (recreate || lrSupport == nullptr) {
     delete lrSupport;
     if (regionCompact) {
@@ -107,6 +108,8 @@ void BaseEditor::remapLRS(bool recreate)
   lrSupport->setRegionMapper(regionMapper);
   lrSupport->setSpecialRegion(def_Special);
   invalidLine = 0;
+  // all the regions are needed again, parser can't stop on its cache
+  changedLine = 0x7FFFFFFF;
   rd_def_Text = rd_def_HorzCross = rd_def_VertCross = nullptr;
   if (regionMapper != nullptr) {
     rd_def_Text = regionMapper->getRegionDefine(CString("def:Text"));
@@ -119,6 +122,7 @@ void BaseEditor::setFileType(FileType* ftype)
 {
   spdlog::debug("[BaseEditor] setFileType: {0}", ftype->getName()->getChars());
   currentFileType = ftype;
+  stopIdleParse();
   textParser->setFileType(currentFileType);
   invalidLine = 0;
 }
@@ -377,6 +381,7 @@ PairMatch* BaseEditor::searchGlobalPair(int lineNo, int pos)
 
 LineRegion* BaseEditor::getLineRegions(int lno)
 {
+  stopIdleParse();
   /*
    * Backparse value check
    */
@@ -390,20 +395,78 @@ LineRegion* BaseEditor::getLineRegions(int lno)
 void BaseEditor::modifyEvent(int topLine)
 {
   spdlog::debug("[BaseEditor] modifyEvent: {0}", topLine);
+  stopIdleParse();
   if (invalidLine > topLine) {
     invalidLine = topLine;
     for (auto & editorListener : editorListeners) {
       editorListener->modifyEvent(topLine);
     }
   }
+  changedLine = 0x7FFFFFFF;
 }
 
 void BaseEditor::modifyLineEvent(int line)
 {
+  stopIdleParse();
   if (invalidLine > line) {
     invalidLine = line;
   }
-  // changedLine = topLine;!!!
+  if (changedLine < line) {
+    changedLine = line;
+  }
+}
+
+void BaseEditor::linesInserted(int at, int count)
+{
+  spdlog::debug("[BaseEditor] linesInserted: {0}, {1}", at, count);
+  if (count <= 0) {
+    return;
+  }
+  stopIdleParse();
+  lineCount += count;
+  textParser->linesInserted(at, count);
+  lrSupport->linesInserted(at, count);
+  if (invalidLine > at) {
+    invalidLine = at;
+  }
+  // inserted lines are new ones
+  if (changedLine != 0x7FFFFFFF) {
+    if (changedLine >= at) {
+      changedLine += count;
+    }
+    if (changedLine < at + count - 1) {
+      changedLine = at + count - 1;
+    }
+  }
+  for (auto & editorListener : editorListeners) {
+    editorListener->linesInserted(at, count);
+  }
+}
+
+void BaseEditor::linesDeleted(int at, int count)
+{
+  spdlog::debug("[BaseEditor] linesDeleted: {0}, {1}", at, count);
+  if (count <= 0) {
+    return;
+  }
+  stopIdleParse();
+  lineCount -= count;
+  textParser->linesDeleted(at, count);
+  lrSupport->linesDeleted(at, count);
+  if (invalidLine > at) {
+    invalidLine = at;
+  }
+  // line after deleted ones has new parse state
+  if (changedLine != 0x7FFFFFFF) {
+    if (changedLine >= at + count) {
+      changedLine -= count;
+    } else {
+      changedLine = at;
+    }
+  }
+  for (auto & editorListener : editorListeners) {
+    editorListener->linesDeleted(at, count);
+  }
 }
 
 void BaseEditor::visibleTextEvent(int wStart, int wSize)
@@ -416,6 +479,7 @@ void BaseEditor::visibleTextEvent(int wStart, int wSize)
 void BaseEditor::lineCountEvent(int newLineCount)
 {
   spdlog::debug("[BaseEditor] lineCountEvent: {0}", newLineCount);
+  stopIdleParse();
   lineCount = newLineCount;
 }
 
@@ -433,6 +497,7 @@ void BaseEditor::validate(int lno, bool rebuildRegions)
   bool layoutChanged = false;
   TextParseMode tpmode = TPM_CACHE_READ;
 
+  stopIdleParse();
   if (lno == -1 || lno > lineCount) {
     lno = lineCount - 1;
   }
@@ -504,11 +569,23 @@ void BaseEditor::validate(int lno, bool rebuildRegions)
   /* Runs parser */
   if (parseTo - parseFrom > 0) {
 
+    /* Only single lines were changed, parser can stop on its cache state */
+    bool lineChanges = tpmode == TPM_CACHE_UPDATE && !layoutChanged && changedLine != 0x7FFFFFFF;
+    if (lineChanges) {
+      textParser->setLastChangedLine(changedLine);
+    }
+
     spdlog::debug("[BaseEditor] validate:parse:{0}-{1}, {2}", parseFrom, parseTo, tpmode == TPM_CACHE_READ ? "READ" : "UPDATE");
     int stopLine = textParser->parse(parseFrom, parseTo - parseFrom, tpmode);
 
     if (tpmode == TPM_CACHE_UPDATE) {
       invalidLine = stopLine + 1;
+      changedLine = -1;
+      /* Parser stopped on the cache, lines after the cache end are parsed as usual */
+      if (lineChanges && !breakParse && invalidLine < parseTo) {
+        stopLine = textParser->parse(invalidLine, parseTo - invalidLine, TPM_CACHE_UPDATE);
+        invalidLine = stopLine + 1;
+      }
     }
     spdlog::debug("[BaseEditor] validate:parsed: invalidLine={0}", invalidLine);
   }
@@ -516,17 +593,72 @@ void BaseEditor::validate(int lno, bool rebuildRegions)
 
 void BaseEditor::idleJob(int time)
 {
-  if (invalidLine < lineCount) {
-    if (time < 0) {
-      time = 0;
+  if (!idleParse) {
+    if (invalidLine >= lineCount) {
+      return;
     }
-    if (time > 100) {
-      time = 100;
+    /* Only single lines were changed, parser can stop on its cache state */
+    if (changedLine != 0x7FFFFFFF) {
+      textParser->setLastChangedLine(changedLine);
     }
-    validate(invalidLine + IDLE_PARSE(time), false);
+    changedLine = -1;
+    spdlog::debug("[BaseEditor] idleJob:parse from {0}", invalidLine);
+    textParser->startParse(invalidLine, lineCount - invalidLine, TPM_CACHE_UPDATE);
+    idleParse = true;
+  }
+  if (time < 0) {
+    time = 0;
+  }
+  int stopLine = textParser->parseStep(time);
+  if (stopLine != -1) {
+    idleParse = false;
+    invalidLine = stopLine + 1;
+    spdlog::debug("[BaseEditor] idleJob:parsed: invalidLine={0}", invalidLine);
+  }
+}
+
+void BaseEditor::stopIdleParse()
+{
+  if (idleParse) {
+    idleParse = false;
+    invalidLine = textParser->stopParse() + 1;
   }
 }
 
+SString BaseEditor::parseCacheKey()
+{
+  SString key;
+  key.append(hrcParser->getVersion());
+  key.append(CString(":"));
+  key.append(currentFileType->getName());
+  return key;
+}
+
+bool BaseEditor::saveParseCache(std::ostream& stream)
+{
+  stopIdleParse();
+  if (currentFileType == nullptr) {
+    return false;
+  }
+  SString key = parseCacheKey();
+  return textParser->saveCache(stream, &key, invalidLine - 1);
+}
+
+bool BaseEditor::loadParseCache(std::istream& stream)
+{
+  stopIdleParse();
+  if (currentFileType == nullptr) {
+    return false;
+  }
+  SString key = parseCacheKey();
+  int endLine = textParser->loadCache(stream, &key);
+  invalidLine = endLine + 1;
+  changedLine = 0x7FFFFFFF;
+  // line regions are taken again from the loaded cache
+  lrSize = 0;
+  return endLine != -1;
+}
+
 void BaseEditor::startParsing(size_t lno)
 {
   lrSupport->startParsing(lno);
@@ -588,3 +720,15 @@ int BaseEditor::getInvalidLine() const
 void BaseEditor::setMaxBlockSize(int max_block_size) {
   textParser->setMaxBlockSize(max_block_size);
 }
+
+void BaseEditor::setStepLimits(int match_limit, int line_limit) {
+  textParser->setStepLimits(match_limit, line_limit);
+}
+
+void BaseEditor::setParseThreads(int threads) {
+  textParser->setParseThreads(threads);
+}
+
+void BaseEditor::setProfiling(bool enable) {
+  textParser->setProfiling(enable);
+}
@@ -180,8 +180,10 @@ public:
 
   /**
    * Tries to do some parsing job while user is doing nothing.
-   * @param time integer between 0 and 100, shows an abount of time,
-   *             available for this job.
+   * Background parse is suspended, when the time is over, and
+   * continued with the next call. Any other request or text
+   * modification event stops it at the already parsed line.
+   * @param time Time in milliseconds, available for this job.
    */
   void idleJob(int time);
 
@@ -197,11 +199,31 @@ public:
    * Generally, this type of event can be processed much faster
    * because of pre-checking line's changed structure and
    * cancelling further parsing in case of unmodified text structure.
+   * Number of lines must not be changed, modifyEvent is used otherwise.
    * @param line Modified line of text.
-   * @todo Not used yet! This must include special 'try' parse method.
    */
   void modifyLineEvent(int line);
 
+  /**
+   * Informs about lines insertion. Parse information of the lines
+   * after insertion point is moved and kept, so the next parse can
+   * stop, when it reaches the same state, as before insertion.
+   * Line count is changed accordingly.
+   * @param at    Line number of the first inserted line.
+   * @param count Number of inserted lines.
+   */
+  void linesInserted(int at, int count);
+
+  /**
+   * Informs about lines deletion. Parse information of the lines
+   * after deleted ones is moved and kept, so the next parse can
+   * stop, when it reaches the same state, as before deletion.
+   * Line count is changed accordingly.
+   * @param at    Line number of the first deleted line.
+   * @param count Number of deleted lines.
+   */
+  void linesDeleted(int at, int count);
+
   /**
    * Informs about changes in visible range of text lines.
    * This information is used to make assumptions about
@@ -218,6 +240,23 @@ public:
    */
   void lineCountEvent(int newLineCount);
 
+  /**
+   * Saves parse cache of the valid text lines into the binary stream.
+   * Snapshot could be loaded, when the same text is opened again
+   * with the same file type and HRC version.
+   * @return false, if there is no parsed lines, or the stream has failed.
+   */
+  bool saveParseCache(std::ostream& stream);
+
+  /**
+   * Loads parse cache, saved with #saveParseCache. Lines, covered
+   * by the loaded cache, are not parsed again from the text start.
+   * Editor must have its file type and line count set.
+   * @return false, if the snapshot doesn't match the text, file type or HRC.
+   *         All the text is parsed again in this case.
+   */
+  bool loadParseCache(std::istream& stream);
+
   /** Basic HRC region - default text (background color) */
   const Region* def_Text;
   /** Basic HRC region - syntax checkable region */
@@ -241,6 +280,9 @@ public:
 
   bool haveInvalidLine();
   void setMaxBlockSize(int max_block_size);
+  void setStepLimits(int match_limit, int line_limit);
+  void setParseThreads(int threads);
+  void setProfiling(bool enable);
 
 private:
 
@@ -270,16 +312,21 @@ private:
  public:
   int getInvalidLine() const;
  private:
-  // no lines structure changes, just single line change
+  // no lines structure changes, just single line change:
+  // last changed line, -1 - none, 0x7FFFFFFF - all lines after invalidLine
   int changedLine;
 
   bool internalRM;
   bool regionCompact;
   bool breakParse;
   bool validationProcess;
+  // background parse of idleJob is suspended in the parser
+  bool idleParse;
 
   inline int getLastVisibleLine();
   void remapLRS(bool recreate);
+  void stopIdleParse();
+  SString parseCacheKey();
   /**
    * Searches for the paired token and creates PairMatch
    * object with valid initial properties filled.
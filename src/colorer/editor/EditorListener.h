@@ -13,6 +13,30 @@ public:
    */
   virtual void modifyEvent(size_t topLine) = 0;
 
+  /**
+   * Informs EditorListener object about lines insertion.
+   * By default it is handled as modification of all the text
+   * after insertion point.
+   * @param at    Line number of the first inserted line.
+   * @param count Number of inserted lines.
+   */
+  virtual void linesInserted(size_t at, size_t count)
+  {
+    modifyEvent(at);
+  }
+
+  /**
+   * Informs EditorListener object about lines deletion.
+   * By default it is handled as modification of all the text
+   * after deletion point.
+   * @param at    Line number of the first deleted line.
+   * @param count Number of deleted lines.
+   */
+  virtual void linesDeleted(size_t at, size_t count)
+  {
+    modifyEvent(at);
+  }
+
 };
 
 #endif
@@ -1,9 +1,12 @@
+#include <algorithm>
 #include <colorer/editor/Outliner.h>
 
 Outliner::Outliner(BaseEditor* baseEditor, const Region* searchRegion)
 {
   this->searchRegion = searchRegion;
-  modifiedLine = -1;
+  lineIsEmpty = true;
+  linePos = 0;
+  curLevel = 0;
   this->baseEditor = baseEditor;
   baseEditor->addRegionHandler(this);
   baseEditor->addEditorListener(this);
@@ -54,12 +57,38 @@ void Outliner::modifyEvent(size_t topLine)
 {
   for (size_t i = 0; i <outline.size(); ++i) {
     if (outline[i]->lno >= topLine) {
+      for (size_t j = i; j < outline.size(); ++j) {
+        delete outline[j];
+      }
       outline.resize(i);
       break;
     }
   }
+}
+
+void Outliner::linesInserted(size_t at, size_t count)
+{
+  for (auto item : outline) {
+    if (item->lno >= at) {
+      item->lno += count;
+    }
+  }
+}
 
-  modifiedLine = topLine;
+void Outliner::linesDeleted(size_t at, size_t count)
+{
+  size_t idx = 0;
+  for (auto item : outline) {
+    if (item->lno >= at && item->lno < at + count) {
+      delete item;
+      continue;
+    }
+    if (item->lno >= at + count) {
+      item->lno -= count;
+    }
+    outline[idx++] = item;
+  }
+  outline.resize(idx);
 }
 
 void Outliner::startParsing(size_t lno)
@@ -69,22 +98,26 @@ void Outliner::startParsing(size_t lno)
 
 void Outliner::endParsing(size_t lno)
 {
-  if (modifiedLine < lno) {
-    modifiedLine = lno + 1;
-  }
   curLevel = 0;
 }
 
 void Outliner::clearLine(size_t lno, String* line)
 {
+  // items of the parsed line are replaced with the new ones,
+  // parser can stop before the end of modified text
+  auto first = std::lower_bound(outline.begin(), outline.end(), lno,
+                                [](const OutlineItem* item, size_t l) { return item->lno < l; });
+  auto last = first;
+  while (last != outline.end() && (*last)->lno == lno) {
+    delete *last;
+    ++last;
+  }
+  linePos = outline.erase(first, last) - outline.begin();
   lineIsEmpty = true;
 }
 
 void Outliner::addRegion(size_t lno, String* line, int sx, int ex, const Region* region)
 {
-  if (lno < modifiedLine) {
-    return;
-  }
   if (!isOutlined(region)) {
     return;
   }
@@ -92,9 +125,9 @@ void Outliner::addRegion(size_t lno, String* line, int sx, int ex, const Region*
   String* itemLabel = new CString(line, sx, ex - sx);
 
   if (lineIsEmpty) {
-    outline.push_back(new OutlineItem(lno, sx, curLevel, itemLabel, region));
+    outline.insert(outline.begin() + linePos, new OutlineItem(lno, sx, curLevel, itemLabel, region));
   } else {
-    OutlineItem* thisItem = outline.back();
+    OutlineItem* thisItem = outline[linePos];
     if (thisItem->token != nullptr && thisItem->lno == lno) {
       thisItem->token->append(itemLabel);
     }
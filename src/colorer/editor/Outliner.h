@@ -62,6 +62,8 @@ public:
   void enterScheme(size_t lno, String* line, int sx, int ex, const Region* region, const Scheme* scheme);
   void leaveScheme(size_t lno, String* line, int sx, int ex, const Region* region, const Scheme* scheme);
   void modifyEvent(size_t topLine);
+  void linesInserted(size_t at, size_t count);
+  void linesDeleted(size_t at, size_t count);
 
 protected:
   bool isOutlined(const Region* region);
@@ -70,8 +72,9 @@ protected:
   const Region* searchRegion;
   std::vector<OutlineItem*> outline;
   bool lineIsEmpty;
+  // position of the current line items in outline
+  size_t linePos;
   int curLevel;
-  size_t modifiedLine;
 };
 
 #endif
@@ -54,6 +54,61 @@ LineRegion* LineRegionsSupport::getLineRegions(size_t lno) const
   return lineRegions.at(getLineIndex(lno));
 }
 
+void LineRegionsSupport::deleteLineRegions(size_t lno)
+{
+  LineRegion* ln = lineRegions.at(getLineIndex(lno));
+  lineRegions.at(getLineIndex(lno)) = nullptr;
+  while (ln != nullptr) {
+    LineRegion* lnn = ln->next;
+    delete ln;
+    ln = lnn;
+  }
+}
+
+void LineRegionsSupport::linesInserted(size_t at, size_t count)
+{
+  size_t last = firstLineNo + lineCount;
+  if (at < firstLineNo) {
+    at = firstLineNo;
+  }
+  if (at >= last || count == 0) {
+    return;
+  }
+  // lines, moved out of stored interval
+  for (size_t lno = (last - at > count ? last - count : at); lno < last; lno++) {
+    deleteLineRegions(lno);
+  }
+  for (size_t lno = last; lno-- > at;) {
+    LineRegion* lr = nullptr;
+    if (lno >= at + count) {
+      lr = lineRegions.at(getLineIndex(lno - count));
+    }
+    lineRegions.at(getLineIndex(lno)) = lr;
+  }
+}
+
+void LineRegionsSupport::linesDeleted(size_t at, size_t count)
+{
+  size_t last = firstLineNo + lineCount;
+  size_t from = at < firstLineNo ? firstLineNo : at;
+  if (from >= last || count == 0) {
+    return;
+  }
+  // deleted lines and lines, moved out of stored interval
+  for (size_t lno = from; lno < last; lno++) {
+    if (lno < at + count || lno - count < firstLineNo) {
+      deleteLineRegions(lno);
+    }
+  }
+  for (size_t lno = from; lno < last; lno++) {
+    LineRegion* lr = nullptr;
+    if (lno + count < last) {
+      lr = lineRegions.at(getLineIndex(lno + count));
+    }
+    lineRegions.at(getLineIndex(lno)) = lr;
+  }
+}
+
 void LineRegionsSupport::setFirstLine(size_t first)
 {
   firstLineNo = first;
@@ -69,6 +69,22 @@ public:
    */
   LineRegion* getLineRegions(size_t lno) const;
 
+  /**
+   * Moves stored regions of the lines after insertion point.
+   * Inserted lines have no regions.
+   * @param at    Line number of the first inserted line
+   * @param count Number of inserted lines
+   */
+  void linesInserted(size_t at, size_t count);
+
+  /**
+   * Drops regions of the deleted lines and moves stored regions
+   * of the lines after them.
+   * @param at    Line number of the first deleted line
+   * @param count Number of deleted lines
+   */
+  void linesDeleted(size_t at, size_t count);
+
   /**
    * RegionHandler implementation
    */
@@ -84,6 +100,7 @@ protected:
   virtual void addLineRegion(size_t lno, LineRegion* lr);
   size_t getLineIndex(size_t lno) const;
   bool checkLine(size_t lno) const;
+  void deleteLineRegions(size_t lno);
 
   std::vector<LineRegion*> lineRegions;
   std::vector<LineRegion*> schemeStack;
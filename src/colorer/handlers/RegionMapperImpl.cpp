@@ -27,7 +27,7 @@ const RegionDefine* RegionMapperImpl::getRegionDefine(const Region* region) cons
     regionDefinesVector.resize(region->getID() * 2);
   }
 
-  auto rd_new = regionDefines.find(region->getName());
+  auto rd_new = regionDefines.find(region->getAtom());
   if (rd_new != regionDefines.end()) {
     regionDefinesVector.at(region->getID()) = rd_new->second;
     return rd_new->second;
@@ -44,7 +44,7 @@ const RegionDefine* RegionMapperImpl::getRegionDefine(const Region* region) cons
 */
 const RegionDefine* RegionMapperImpl::getRegionDefine(const String &name) const
 {
-  auto tp = regionDefines.find(name);
+  auto tp = regionDefines.find(AtomTable::find(name));
   if (tp != regionDefines.end()) {
     return tp->second;
   }
@@ -42,7 +42,8 @@ public:
   const RegionDefine* getRegionDefine(const String &name) const;
 
 protected:
-  std::unordered_map<SString, RegionDefine*> regionDefines;
+  // region defines by the interned region name
+  std::unordered_map<const Atom*, RegionDefine*> regionDefines;
   mutable std::vector<const RegionDefine*> regionDefinesVector;
 
   RegionMapperImpl(const RegionMapperImpl &);
@@ -46,7 +46,7 @@ void StyledHRDMapper::loadRegionMappings(XmlInputSource* is)
         continue;
       }
 
-      const String* name = new CString(xname);
+      const Atom* name = AtomTable::intern(CString(xname));
       auto rd_new = regionDefines.find(name);
       if (rd_new != regionDefines.end()) {
         regionDefines.erase(rd_new);
@@ -65,10 +65,8 @@ void StyledHRDMapper::loadRegionMappings(XmlInputSource* is)
         style = val;
       }
       RegionDefine* rdef = new StyledRegion(bfore, bback, fore, back, style);
-      std::pair<SString, RegionDefine*> pp(name, rdef);
+      std::pair<const Atom*, RegionDefine*> pp(name, rdef);
       regionDefines.emplace(pp);
-
-      delete name;
     }
   }
 }
@@ -106,11 +104,12 @@ void StyledHRDMapper::saveRegionMappings(Writer* writer) const
 /** Adds or replaces region definition */
 void StyledHRDMapper::setRegionDefine(const String &name, const RegionDefine* rd)
 {
-  auto rd_old = regionDefines.find(&name);
+  const Atom* atom = AtomTable::intern(name);
+  auto rd_old = regionDefines.find(atom);
 
   const StyledRegion* new_region = StyledRegion::cast(rd);
   RegionDefine* rd_new = new StyledRegion(*new_region);
-  std::pair<SString, RegionDefine*> pp(name, rd_new);
+  std::pair<const Atom*, RegionDefine*> pp(atom, rd_new);
   regionDefines.emplace(pp);
 
   // Searches and replaces old region references
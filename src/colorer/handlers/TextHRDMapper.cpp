@@ -46,7 +46,7 @@ void TextHRDMapper::loadRegionMappings(XmlInputSource* is)
         continue;
       }
 
-      const String* name = new CString(xname);
+      const Atom* name = AtomTable::intern(CString(xname));
       auto tp = regionDefines.find(name);
       if (tp != regionDefines.end()) {
         const TextRegion* rd = TextRegion::cast(tp->second);
@@ -79,9 +79,8 @@ void TextHRDMapper::loadRegionMappings(XmlInputSource* is)
       }
 
       RegionDefine* rdef = new TextRegion(stext, etext, sback, eback);
-      std::pair<SString, RegionDefine*> pp(name, rdef);
+      std::pair<const Atom*, RegionDefine*> pp(name, rdef);
       regionDefines.emplace(pp);
-      delete name;
     }
   }
 }
@@ -136,7 +135,8 @@ void TextHRDMapper::setRegionDefine(const String &name, const RegionDefine* rd)
     eback = new SString(rd_new->end_back);
   }
 
-  auto rd_old = regionDefines.find(name);
+  const Atom* atom = AtomTable::intern(name);
+  auto rd_old = regionDefines.find(atom);
   if (rd_old != regionDefines.end()) {
     const TextRegion* rdef = TextRegion::cast(rd_old->second);
     delete rdef->start_text;
@@ -147,7 +147,7 @@ void TextHRDMapper::setRegionDefine(const String &name, const RegionDefine* rd)
   }
 
   RegionDefine* new_region = new TextRegion(stext, etext, sback, eback);
-  std::pair<SString, RegionDefine*> p(name, new_region);
+  std::pair<const Atom*, RegionDefine*> p(atom, new_region);
   regionDefines.emplace(p);
 
   // Searches and replaces old region references
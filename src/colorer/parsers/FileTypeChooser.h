@@ -17,7 +17,7 @@ public:
       @param prior Priority of this rule
       @param re Associated regular expression
   */
-  FileTypeChooser(ChooserType type, double prior, CRegExp* re);
+  FileTypeChooser(ChooserType type, double prior, const std::shared_ptr<CRegExp> &re);
   /** Default destructor */
   ~FileTypeChooser() {};
   /** Returns type of chooser */
@@ -29,12 +29,12 @@ public:
   /** Returns associated regular expression */
   CRegExp* getRE() const;
 private:
-  std::unique_ptr<CRegExp> reg_matcher;
+  std::shared_ptr<CRegExp> reg_matcher;
   ChooserType type;
   double priority;
 };
 
-inline FileTypeChooser::FileTypeChooser(ChooserType type_, double prior, CRegExp* re):
+inline FileTypeChooser::FileTypeChooser(ChooserType type_, double prior, const std::shared_ptr<CRegExp> &re):
   reg_matcher(re), type(type_), priority(prior)
 {
 }
@@ -10,6 +10,7 @@ FileTypeImpl::FileTypeImpl(HRCParserImpl* hrcParser): name(nullptr), group(nullp
   isPackage = false;
   baseScheme = nullptr;
   inputSource = nullptr;
+  imageIndex = -1;
 }
 
 FileTypeImpl::~FileTypeImpl(){
@@ -134,11 +135,12 @@ size_t FileTypeImpl::getParamUserValueCount() const{
 
 double FileTypeImpl::getPriority(const String *fileName, const String *fileContent) const{
   SMatches match;
+  CRegExpContext ctx;
   double cur_prior = 0;
   for(auto ftc : chooserVector){
-    if (fileName != nullptr && ftc->isFileName() && ftc->getRE()->parse(fileName, &match))
+    if (fileName != nullptr && ftc->isFileName() && ftc->getRE()->parse(&ctx, fileName, 0, fileName->length(), &match))
       cur_prior += ftc->getPriority();
-    if (fileContent != nullptr && ftc->isFileContent() && ftc->getRE()->parse(fileContent, &match))
+    if (fileContent != nullptr && ftc->isFileContent() && ftc->getRE()->parse(&ctx, fileContent, 0, fileContent->length(), &match))
       cur_prior += ftc->getPriority();
   }
   return cur_prior;
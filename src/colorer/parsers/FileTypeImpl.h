@@ -30,6 +30,7 @@ public:
 class FileTypeImpl : public FileType
 {
   friend class HRCParserImpl;
+  friend class HRCDatabaseImage;
   friend class TextParserImpl;
 public:
   const String *getName() const;
@@ -84,7 +85,7 @@ protected:
   /// is this IS loading was started
   bool input_source_loading;
 
-  UString name;
+  const Atom* name;
   UString group;
   UString description;
   bool isPackage;
@@ -93,15 +94,17 @@ protected:
 
   std::vector<FileTypeChooser*> chooserVector;
   std::unordered_map<SString, TypeParameter*> paramsHash;
-  std::vector<UString> importVector;
+  std::vector<const Atom*> importVector;
   uXmlInputSource inputSource;
+  /// index of the type body in the HRC database image, or -1
+  int imageIndex;
 
   FileTypeImpl(HRCParserImpl *hrcParser);
   ~FileTypeImpl();
 };
 
 inline const String* FileTypeImpl::getName() const{
-  return name.get();
+  return name;
 }
 
 inline const String* FileTypeImpl::getGroup() const{
@@ -113,7 +116,7 @@ inline const String* FileTypeImpl::getDescription() const{
 }
 
 inline void FileTypeImpl::setName(const String *name_) {
-  name.reset(new SString(name_));
+  name = AtomTable::intern(*name_);
 }
 
 inline void FileTypeImpl::setGroup(const String *group_) {
@@ -0,0 +1,784 @@
+#include <algorithm>
+#include <cstring>
+#include <ostream>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <colorer/parsers/HRCDatabaseImage.h>
+
+static const char IMAGE_MAGIC[4] = {'C', 'L', 'R', 'H'};
+
+// flags of the scheme node
+enum {
+  NF_INNER_REGION = 1,
+  NF_LOW_PRIORITY = 2,
+  NF_LOW_CONTENT_PRIORITY = 4
+};
+
+static void writeNumber(std::string& out, uint64_t value)
+{
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+// strings are written with length + 1, zero means no string
+static void writeString(std::string& out, const String* string)
+{
+  if (string == nullptr) {
+    writeNumber(out, 0);
+    return;
+  }
+  writeNumber(out, string->length() + 1);
+  for (size_t i = 0; i < string->length(); i++) {
+    writeNumber(out, (*string)[i]);
+  }
+}
+
+static void writeDouble(std::string& out, double value)
+{
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  for (int i = 0; i < 8; i++) {
+    out.push_back(static_cast<char>(bits >> (i * 8)));
+  }
+}
+
+// references are written with index + 1, zero means no object
+static void writeRegion(std::string& out, const Region* region)
+{
+  writeNumber(out, region ? region->getID() + 1 : 0);
+}
+
+static bool isQualified(const String* name)
+{
+  return name != nullptr && name->indexOf(':') != String::npos;
+}
+
+/** Sequential reader of the mapped image.
+    Reading out of the bounds marks reader as broken and returns empty values,
+    so the state is checked after the groups of values.
+*/
+class HRCDatabaseImage::Reader
+{
+public:
+  Reader(const unsigned char* start, size_t size): pos(start), end(start + size), broken(false) {}
+
+  bool isBroken() const
+  {
+    return broken;
+  }
+
+  void setBroken()
+  {
+    broken = true;
+  }
+
+  size_t left() const
+  {
+    return end - pos;
+  }
+
+  void skip(size_t len)
+  {
+    if (len > left()) {
+      broken = true;
+      pos = end;
+      return;
+    }
+    pos += len;
+  }
+
+  uint64_t readNumber()
+  {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64 && pos < end; shift += 7) {
+      unsigned char c = *pos++;
+      value |= static_cast<uint64_t>(c & 0x7F) << shift;
+      if (!(c & 0x80)) {
+        return value;
+      }
+    }
+    broken = true;
+    return 0;
+  }
+
+  /** Number of the following elements, each of them takes a byte at least. */
+  size_t readCount()
+  {
+    uint64_t count = readNumber();
+    if (count > left()) {
+      broken = true;
+      return 0;
+    }
+    return static_cast<size_t>(count);
+  }
+
+  /** Index of the element in the table of @c num elements, or -1. */
+  int readRef(size_t num)
+  {
+    uint64_t ref = readNumber();
+    if (ref > num) {
+      broken = true;
+      return -1;
+    }
+    return static_cast<int>(ref) - 1;
+  }
+
+  double readDouble()
+  {
+    double value = 0;
+    if (left() < 8) {
+      broken = true;
+      pos = end;
+      return value;
+    }
+    uint64_t bits = 0;
+    for (int i = 0; i < 8; i++) {
+      bits |= static_cast<uint64_t>(pos[i]) << (i * 8);
+    }
+    pos += 8;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  std::unique_ptr<SString> readString()
+  {
+    uint64_t len = readNumber();
+    if (len == 0) {
+      return nullptr;
+    }
+    if (len - 1 > left()) {
+      broken = true;
+      return nullptr;
+    }
+    auto string = std::make_unique<SString>();
+    for (uint64_t i = 0; i < len - 1; i++) {
+      string->append(static_cast<wchar>(readNumber()));
+    }
+    return string;
+  }
+
+private:
+  const unsigned char* pos;
+  const unsigned char* end;
+  bool broken;
+};
+
+HRCDatabaseImage::HRCDatabaseImage(HRCParserImpl* hrcParser_)
+  : hrcParser(hrcParser_), data(nullptr), size(0)
+#ifdef _WIN32
+  , file(INVALID_HANDLE_VALUE), mapping(nullptr)
+#endif
+{
+}
+
+HRCDatabaseImage::~HRCDatabaseImage()
+{
+  unmap();
+}
+
+bool HRCDatabaseImage::write(std::ostream& stream)
+{
+  hrcParser->loadAllTypes();
+  std::vector<const FileTypeImpl*> packages;
+  for (const auto& it : hrcParser->fileTypeHash) {
+    if (it.second->isPackage) {
+      packages.push_back(it.second);
+    }
+  }
+  std::sort(packages.begin(), packages.end(), [](const FileTypeImpl* a, const FileTypeImpl* b) {
+    return a->name->compareTo(*b->name) < 0;
+  });
+  std::vector<const FileTypeImpl*> types(hrcParser->fileTypeVector.begin(), hrcParser->fileTypeVector.end());
+  types.insert(types.end(), packages.begin(), packages.end());
+
+  patterns.clear();
+  for (const auto& it : hrcParser->regExpHash) {
+    for (const auto& entry : it.second) {
+      patterns[entry.re.get()] = &it.first;
+    }
+  }
+  std::unordered_map<const FileTypeImpl*, std::vector<const SchemeImpl*>> typeSchemes;
+  for (const auto& it : hrcParser->schemeHash) {
+    typeSchemes[it.second->fileType].push_back(it.second);
+  }
+
+  std::string out;
+  out.append(IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+  writeNumber(out, FORMAT_VERSION);
+  writeString(out, hrcParser->versionName);
+
+  writeNumber(out, hrcParser->regionNamesVector.size());
+  for (auto region : hrcParser->regionNamesVector) {
+    writeString(out, region->getName());
+    writeString(out, region->getDescription());
+    writeRegion(out, region->getParent());
+  }
+
+  // bodies follow the prototypes in the same order,
+  // each prototype ends with its body size + 1, or zero, if type is not loaded
+  std::string bodiesOut;
+  writeNumber(out, types.size());
+  for (auto type : types) {
+    writePrototype(out, type);
+    if (!type->type_loaded) {
+      writeNumber(out, 0);
+      continue;
+    }
+    auto& schemes = typeSchemes[type];
+    std::sort(schemes.begin(), schemes.end(), [](const SchemeImpl * a, const SchemeImpl * b) {
+      return a->getName()->compareTo(*b->getName()) < 0;
+    });
+    std::string body;
+    writeBody(body, schemes);
+    writeNumber(out, body.size() + 1);
+    bodiesOut.append(body);
+  }
+  out.append(bodiesOut);
+  patterns.clear();
+
+  stream.write(out.data(), out.size());
+  return stream.good();
+}
+
+void HRCDatabaseImage::writePrototype(std::string& out, const FileTypeImpl* type)
+{
+  writeString(out, type->getName());
+  writeString(out, type->getGroup());
+  writeString(out, type->getDescription());
+  writeNumber(out, type->isPackage ? 1 : 0);
+
+  writeNumber(out, type->chooserVector.size());
+  for (auto chooser : type->chooserVector) {
+    writeNumber(out, chooser->isFileName() ? FileTypeChooser::CT_FILENAME : FileTypeChooser::CT_FIRSTLINE);
+    writeDouble(out, chooser->getPriority());
+    writeRE(out, chooser->getRE());
+  }
+
+  writeNumber(out, type->paramsHash.size());
+  for (const auto& it : type->paramsHash) {
+    writeString(out, &it.first);
+    writeString(out, it.second->description.get());
+    writeString(out, it.second->default_value.get());
+  }
+}
+
+void HRCDatabaseImage::writeBody(std::string& out, const std::vector<const SchemeImpl*>& schemes)
+{
+  // most of the schemes share a few HRC files
+  std::vector<const String*> locations;
+  std::unordered_map<SString, size_t> locationIndex;
+  for (auto scheme : schemes) {
+    if (scheme->sourceLocation && locationIndex.find(*scheme->sourceLocation) == locationIndex.end()) {
+      locationIndex.emplace(*scheme->sourceLocation, locations.size());
+      locations.push_back(scheme->sourceLocation.get());
+    }
+  }
+  writeNumber(out, locations.size());
+  for (auto location : locations) {
+    writeString(out, location);
+  }
+
+  writeNumber(out, schemes.size());
+  for (auto scheme : schemes) {
+    writeString(out, scheme->getName());
+    writeNumber(out, scheme->sourceLocation ? locationIndex[*scheme->sourceLocation] + 1 : 0);
+    writeNumber(out, scheme->nodes.size());
+    for (auto node : scheme->nodes) {
+      writeNode(out, node);
+    }
+  }
+}
+
+void HRCDatabaseImage::writeNode(std::string& out, const SchemeNode* node)
+{
+  writeNumber(out, node->type);
+  writeNumber(out, (node->innerRegion ? NF_INNER_REGION : 0) |
+              (node->lowPriority ? NF_LOW_PRIORITY : 0) |
+              (node->lowContentPriority ? NF_LOW_CONTENT_PRIORITY : 0));
+  writeString(out, node->scheme ? node->scheme->getName() : nullptr);
+
+  // unresolved virtual entries are never used
+  size_t virtualNum = 0;
+  for (auto vt : node->virtualEntryVector) {
+    if (vt->virtScheme && vt->substScheme) {
+      virtualNum++;
+    }
+  }
+  writeNumber(out, virtualNum);
+  for (auto vt : node->virtualEntryVector) {
+    if (vt->virtScheme && vt->substScheme) {
+      writeString(out, vt->virtScheme->getName());
+      writeString(out, vt->substScheme->getName());
+    }
+  }
+
+  writeRegion(out, node->region);
+  for (int i = 0; i < REGIONS_NUM; i++) {
+    writeRegion(out, node->regions[i]);
+  }
+  for (int i = 0; i < NAMED_REGIONS_NUM; i++) {
+    writeRegion(out, node->regionsn[i]);
+  }
+  for (int i = 0; i < REGIONS_NUM; i++) {
+    writeRegion(out, node->regione[i]);
+  }
+  for (int i = 0; i < NAMED_REGIONS_NUM; i++) {
+    writeRegion(out, node->regionen[i]);
+  }
+
+  writeRE(out, node->start.get());
+  writeRE(out, node->end.get());
+
+  const KeywordList* list = node->kwList.get();
+  writeNumber(out, list ? 1 : 0);
+  if (list) {
+    writeNumber(out, list->matchCase ? 1 : 0);
+    writeNumber(out, list->minKeywordLength);
+    writeNumber(out, list->num);
+    for (int i = 0; i < list->num; i++) {
+      writeString(out, list->kwList[i].keyword.get());
+      writeRegion(out, list->kwList[i].region);
+      writeNumber(out, list->kwList[i].isSymbol ? 1 : 0);
+    }
+  }
+
+  // word dividers are stored as the ranges of symbols
+  writeNumber(out, node->worddiv ? 1 : 0);
+  if (node->worddiv) {
+    std::vector<std::pair<int, int>> ranges;
+    for (int c = 0; c <= 0xFFFF; c++) {
+      if (!node->worddiv->inClass(static_cast<wchar>(c))) {
+        continue;
+      }
+      if (!ranges.empty() && ranges.back().second == c - 1) {
+        ranges.back().second = c;
+      } else {
+        ranges.emplace_back(c, c);
+      }
+    }
+    writeNumber(out, ranges.size());
+    for (const auto& range : ranges) {
+      writeNumber(out, range.first);
+      writeNumber(out, range.second - range.first);
+    }
+  }
+}
+
+void HRCDatabaseImage::writeRE(std::string& out, const CRegExp* re)
+{
+  const String* pattern = nullptr;
+  if (re != nullptr) {
+    auto it = patterns.find(re);
+    if (it != patterns.end()) {
+      pattern = it->second;
+    }
+  }
+  writeString(out, pattern);
+}
+
+bool HRCDatabaseImage::open(const String* path)
+{
+  if (!map(path)) {
+    spdlog::error("Can't map HRC image '{0}'", path->getChars());
+    return false;
+  }
+  Reader reader(data, size);
+  if (size < sizeof(IMAGE_MAGIC) || memcmp(data, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0) {
+    spdlog::error("'{0}' is not a HRC image", path->getChars());
+    unmap();
+    return false;
+  }
+  reader.skip(sizeof(IMAGE_MAGIC));
+  if (reader.readNumber() != FORMAT_VERSION) {
+    spdlog::error("Unsupported format of HRC image '{0}'", path->getChars());
+    unmap();
+    return false;
+  }
+  auto version = reader.readString();
+
+  std::vector<const Region*> regions;
+  std::vector<FileTypeImpl*> types;
+  if (!readIndex(reader, regions, types)) {
+    spdlog::error("Broken HRC image '{0}'", path->getChars());
+    for (auto type : types) {
+      delete type;
+    }
+    for (auto region : regions) {
+      delete region;
+    }
+    hrcParser->regExpHash.clear();
+    bodies.clear();
+    unmap();
+    return false;
+  }
+
+  if (version) {
+    hrcParser->versionName = version.release();
+  }
+  for (auto region : regions) {
+    hrcParser->regionNamesVector.push_back(region);
+    hrcParser->regionNamesHash.emplace(region->getAtom(), region);
+  }
+  for (auto type : types) {
+    if (!hrcParser->fileTypeHash.emplace(type->name, type).second) {
+      delete type;
+      continue;
+    }
+    if (!type->isPackage) {
+      hrcParser->fileTypeVector.push_back(type);
+    }
+  }
+  return true;
+}
+
+bool HRCDatabaseImage::readIndex(Reader& reader, std::vector<const Region*>& regions, std::vector<FileTypeImpl*>& types)
+{
+  size_t regionsNum = reader.readCount();
+  for (size_t idx = 0; idx < regionsNum; idx++) {
+    auto name = reader.readString();
+    auto description = reader.readString();
+    // parents are defined before their children
+    int parent = reader.readRef(idx);
+    if (reader.isBroken() || name == nullptr) {
+      return false;
+    }
+    regions.push_back(new Region(name.get(), description.get(), parent < 0 ? nullptr : regions[parent], static_cast<int>(idx)));
+  }
+
+  size_t typesNum = reader.readCount();
+  size_t bodiesSize = 0;
+  for (size_t idx = 0; idx < typesNum; idx++) {
+    FileTypeImpl* type = readPrototype(reader);
+    if (type == nullptr) {
+      return false;
+    }
+    types.push_back(type);
+    uint64_t bodySize = reader.readNumber();
+    if (reader.isBroken()) {
+      return false;
+    }
+    if (bodySize == 0) {
+      // type was not loaded, when the image was written
+      type->load_broken = true;
+      continue;
+    }
+    type->imageIndex = static_cast<int>(bodies.size());
+    bodies.push_back({bodiesSize, static_cast<size_t>(bodySize - 1)});
+    bodiesSize += static_cast<size_t>(bodySize - 1);
+    if (bodiesSize > size) {
+      return false;
+    }
+  }
+
+  if (bodiesSize != reader.left()) {
+    return false;
+  }
+  size_t bodiesStart = size - bodiesSize;
+  for (auto& body : bodies) {
+    body.offset += bodiesStart;
+  }
+  return true;
+}
+
+FileTypeImpl* HRCDatabaseImage::readPrototype(Reader& reader)
+{
+  auto* type = new FileTypeImpl(hrcParser);
+  auto name = reader.readString();
+  type->name = name ? AtomTable::intern(*name) : nullptr;
+  type->group = reader.readString();
+  type->description = reader.readString();
+  type->isPackage = reader.readNumber() != 0;
+  if (type->name == nullptr || type->description == nullptr) {
+    reader.setBroken();
+  }
+
+  size_t choosersNum = reader.readCount();
+  for (size_t idx = 0; idx < choosersNum && !reader.isBroken(); idx++) {
+    uint64_t ctype = reader.readNumber();
+    double prior = reader.readDouble();
+    auto pattern = reader.readString();
+    if (ctype > FileTypeChooser::CT_FIRSTLINE || pattern == nullptr) {
+      reader.setBroken();
+      break;
+    }
+    auto matchRE = hrcParser->getRegExp(pattern.get(), true, nullptr);
+    if (!matchRE->isOk()) {
+      spdlog::warn("Fault compiling chooser RE '{0}' in prototype '{1}'", pattern->getChars(), type->name->getChars());
+      continue;
+    }
+    type->chooserVector.push_back(new FileTypeChooser(static_cast<FileTypeChooser::ChooserType>(ctype), prior, matchRE));
+  }
+
+  size_t paramsNum = reader.readCount();
+  for (size_t idx = 0; idx < paramsNum && !reader.isBroken(); idx++) {
+    auto name = reader.readString();
+    auto description = reader.readString();
+    auto value = reader.readString();
+    if (name == nullptr) {
+      reader.setBroken();
+      break;
+    }
+    TypeParameter* tp = type->addParam(name.get());
+    tp->description = std::move(description);
+    tp->default_value = std::move(value);
+  }
+
+  if (reader.isBroken()) {
+    delete type;
+    return nullptr;
+  }
+  type->protoLoaded = true;
+  return type;
+}
+
+void HRCDatabaseImage::loadType(FileTypeImpl* type)
+{
+  const Body& body = bodies.at(type->imageIndex);
+  Reader reader(data + body.offset, body.size);
+  type->type_loaded = true;
+
+  std::vector<std::unique_ptr<SString>> locations;
+  size_t locationsNum = reader.readCount();
+  for (size_t idx = 0; idx < locationsNum; idx++) {
+    locations.push_back(reader.readString());
+  }
+
+  size_t schemesNum = reader.readCount();
+  for (size_t idx = 0; idx < schemesNum && !reader.isBroken(); idx++) {
+    auto name = reader.readString();
+    int location = reader.readRef(locations.size());
+    if (reader.isBroken() || !isQualified(name.get()) || hrcParser->schemeHash.find(AtomTable::find(*name)) != hrcParser->schemeHash.end()) {
+      reader.setBroken();
+      break;
+    }
+    auto* scheme = new SchemeImpl(name.get());
+    scheme->fileType = type;
+    if (location >= 0 && locations[location]) {
+      scheme->sourceLocation.reset(new SString(locations[location].get()));
+    }
+    hrcParser->schemeHash.emplace(scheme->schemeName, scheme);
+    hrcParser->unindexedSchemes.push_back(scheme);
+
+    size_t nodesNum = reader.readCount();
+    for (size_t nidx = 0; nidx < nodesNum && !reader.isBroken(); nidx++) {
+      auto* node = new SchemeNode();
+      scheme->nodes.push_back(node);
+      readNode(reader, node);
+      hrcParser->addSchemeLinks(scheme, node);
+    }
+  }
+  if (reader.isBroken() || reader.left() != 0) {
+    throw HRCParserException(SString("Broken HRC image body of type '") + type->getName() + "'");
+  }
+
+  SString baseSchemeName = SString(type->getName()).append(CString(":")).append(type->getName());
+  auto sh = hrcParser->schemeHash.find(AtomTable::find(baseSchemeName));
+  type->baseScheme = sh == hrcParser->schemeHash.end() ? nullptr : sh->second;
+  if (type->baseScheme == nullptr && !type->isPackage) {
+    spdlog::warn("type '{0}' has no default scheme", type->getName()->getChars());
+  }
+  type->loadDone = true;
+}
+
+void HRCDatabaseImage::readNode(Reader& reader, SchemeNode* node)
+{
+  uint64_t type = reader.readNumber();
+  if (type > SchemeNode::SNT_INHERIT) {
+    reader.setBroken();
+    return;
+  }
+  node->type = static_cast<SchemeNode::SchemeNodeType>(type);
+  uint64_t flags = reader.readNumber();
+  node->innerRegion = (flags & NF_INNER_REGION) != 0;
+  node->lowPriority = (flags & NF_LOW_PRIORITY) != 0;
+  node->lowContentPriority = (flags & NF_LOW_CONTENT_PRIORITY) != 0;
+  // scheme names are qualified and resolved by updateLinks
+  node->schemeName = reader.readString();
+  if (node->schemeName && !isQualified(node->schemeName.get())) {
+    reader.setBroken();
+    return;
+  }
+
+  size_t virtualNum = reader.readCount();
+  if (virtualNum != 0 && node->type != SchemeNode::SNT_INHERIT) {
+    reader.setBroken();
+    return;
+  }
+  for (size_t idx = 0; idx < virtualNum; idx++) {
+    auto virtName = reader.readString();
+    auto substName = reader.readString();
+    if (!isQualified(virtName.get()) || !isQualified(substName.get())) {
+      reader.setBroken();
+      return;
+    }
+    node->virtualEntryVector.push_back(new VirtualEntry(virtName.get(), substName.get()));
+  }
+
+  node->region = readRegion(reader);
+  for (int i = 0; i < REGIONS_NUM; i++) {
+    node->regions[i] = readRegion(reader);
+  }
+  for (int i = 0; i < NAMED_REGIONS_NUM; i++) {
+    node->regionsn[i] = readRegion(reader);
+  }
+  for (int i = 0; i < REGIONS_NUM; i++) {
+    node->regione[i] = readRegion(reader);
+  }
+  for (int i = 0; i < NAMED_REGIONS_NUM; i++) {
+    node->regionen[i] = readRegion(reader);
+  }
+
+  auto start = reader.readString();
+  auto end = reader.readString();
+  if (reader.isBroken()) {
+    return;
+  }
+  if (start) {
+    node->start = hrcParser->getRegExp(start.get(), false, nullptr);
+    if (!node->start->isOk()) {
+      spdlog::error("fault compiling regexp '{0}'", start->getChars());
+    }
+  }
+  if (end) {
+    node->end = hrcParser->getRegExp(end.get(), true, node->start.get());
+    if (!node->end->isOk()) {
+      spdlog::error("fault compiling regexp '{0}'", end->getChars());
+    }
+  }
+
+  if (reader.readNumber()) {
+    node->kwList = std::make_unique<KeywordList>();
+    KeywordList* list = node->kwList.get();
+    list->matchCase = reader.readNumber() != 0;
+    list->minKeywordLength = static_cast<unsigned int>(reader.readNumber());
+    size_t num = reader.readCount();
+    list->kwList = new KeywordInfo[num]();
+    for (size_t idx = 0; idx < num; idx++) {
+      auto keyword = reader.readString();
+      const Region* region = readRegion(reader);
+      bool isSymbol = reader.readNumber() != 0;
+      if (reader.isBroken() || keyword == nullptr || keyword->length() == 0) {
+        reader.setBroken();
+        break;
+      }
+      wchar first = (*keyword)[0];
+      KeywordInfo& info = list->kwList[list->num];
+      info.keyword = std::move(keyword);
+      info.region = region;
+      info.isSymbol = isSymbol;
+      list->firstChar->addChar(first);
+      if (!list->matchCase) {
+        list->firstChar->addChar(Character::toLowerCase(first));
+        list->firstChar->addChar(Character::toUpperCase(first));
+        list->firstChar->addChar(Character::toTitleCase(first));
+      }
+      list->num++;
+    }
+    list->buildTrie();
+  }
+
+  if (reader.readNumber()) {
+    node->worddiv = std::make_unique<CharacterClass>();
+    size_t rangesNum = reader.readCount();
+    for (size_t idx = 0; idx < rangesNum; idx++) {
+      uint64_t first = reader.readNumber();
+      uint64_t len = reader.readNumber();
+      if (reader.isBroken() || first + len > 0xFFFF) {
+        reader.setBroken();
+        return;
+      }
+      node->worddiv->addRange(static_cast<wchar>(first), static_cast<wchar>(first + len));
+    }
+  }
+}
+
+const Region* HRCDatabaseImage::readRegion(Reader& reader)
+{
+  int id = reader.readRef(hrcParser->regionNamesVector.size());
+  return id < 0 ? nullptr : hrcParser->regionNamesVector[id];
+}
+
+#ifdef _WIN32
+bool HRCDatabaseImage::map(const String* path)
+{
+  file = CreateFileW(reinterpret_cast<const wchar_t*>(path->getWChars()), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                     OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+    unmap();
+    return false;
+  }
+  mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping == nullptr) {
+    unmap();
+    return false;
+  }
+  data = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+  if (data == nullptr) {
+    unmap();
+    return false;
+  }
+  size = static_cast<size_t>(fileSize.QuadPart);
+  return true;
+}
+
+void HRCDatabaseImage::unmap()
+{
+  if (data != nullptr) {
+    UnmapViewOfFile(data);
+  }
+  if (mapping != nullptr) {
+    CloseHandle(mapping);
+  }
+  if (file != INVALID_HANDLE_VALUE) {
+    CloseHandle(file);
+  }
+  data = nullptr;
+  size = 0;
+  mapping = nullptr;
+  file = INVALID_HANDLE_VALUE;
+}
+#else
+bool HRCDatabaseImage::map(const String* path)
+{
+  int fd = ::open(path->getChars(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  void* addr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  // mapping stays valid after the file is closed
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return false;
+  }
+  data = static_cast<const unsigned char*>(addr);
+  size = static_cast<size_t>(st.st_size);
+  return true;
+}
+
+void HRCDatabaseImage::unmap()
+{
+  if (data != nullptr) {
+    munmap(const_cast<unsigned char*>(data), size);
+  }
+  data = nullptr;
+  size = 0;
+}
+#endif
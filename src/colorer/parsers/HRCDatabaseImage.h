@@ -0,0 +1,85 @@
+#ifndef _COLORER_HRCDATABASEIMAGE_H_
+#define _COLORER_HRCDATABASEIMAGE_H_
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <unordered_map>
+#include <colorer/parsers/HRCParserImpl.h>
+
+/**
+ * Precompiled binary image of the HRC database.
+ * Image keeps the resolved database: regions, file types with their
+ * choosers and parameters, and the bodies of the types - schemes with
+ * their nodes, keyword lists and RE patterns with substituted entities.
+ * Scheme references are stored with qualified names, so no entities, imports
+ * and HRC files are needed to load it.
+ *
+ * Image is mapped into memory, regions and prototypes are read on open,
+ * types are built from their bodies on the first request, as the HRC types are.
+ * Compiled RE programs are not stored, REs are compiled from the patterns.
+ * Schemes, disabled by the type parameters, are stored without nodes,
+ * so the parameters must be changed before the image is written.
+ *
+ * All integers are written as variable length numbers.
+ * @ingroup colorer_parsers
+ */
+class HRCDatabaseImage
+{
+public:
+  explicit HRCDatabaseImage(HRCParserImpl* hrcParser);
+  ~HRCDatabaseImage();
+
+  /**
+   * Loads all the types of the parser and writes its image.
+   * @return false, if the stream has failed
+   */
+  bool write(std::ostream& stream);
+  /**
+   * Maps the image file and adds its regions and prototypes
+   * into the parser, which must be empty.
+   * @return false, if the file can't be mapped or is broken.
+   *         In this case the parser is not changed.
+   */
+  bool open(const String* path);
+  /**
+   * Builds schemes of the type from its body in the image.
+   * @throw HRCParserException If the body is broken.
+   */
+  void loadType(FileTypeImpl* type);
+
+private:
+  static const unsigned int FORMAT_VERSION = 1;
+
+  struct Body {
+    size_t offset;
+    size_t size;
+  };
+  class Reader;
+
+  HRCParserImpl* hrcParser;
+  const unsigned char* data;
+  size_t size;
+#ifdef _WIN32
+  void* file;
+  void* mapping;
+#endif
+  std::vector<Body> bodies;
+  // patterns of the compiled REs, used by writer
+  std::unordered_map<const CRegExp*, const SString*> patterns;
+
+  bool map(const String* path);
+  void unmap();
+
+  void writePrototype(std::string& out, const FileTypeImpl* type);
+  void writeBody(std::string& out, const std::vector<const SchemeImpl*>& schemes);
+  void writeNode(std::string& out, const SchemeNode* node);
+  void writeRE(std::string& out, const CRegExp* re);
+
+  bool readIndex(Reader& reader, std::vector<const Region*>& regions, std::vector<FileTypeImpl*>& types);
+  FileTypeImpl* readPrototype(Reader& reader);
+  void readNode(Reader& reader, SchemeNode* node);
+  const Region* readRegion(Reader& reader);
+};
+
+#endif
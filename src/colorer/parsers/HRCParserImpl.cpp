@@ -1,9 +1,17 @@
 #include <memory>
+#include <bitset>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <unordered_set>
 #include <xercesc/parsers/XercesDOMParser.hpp>
 #include <cmath>
 #include <cstdio>
 #include <colorer/parsers/SchemeImpl.h>
 #include <colorer/parsers/HRCParserImpl.h>
+#include <colorer/parsers/HRCDatabaseImage.h>
+#include <colorer/parsers/HRCReader.h>
 #include <colorer/xml/XmlParserErrorHandler.h>
 #include <colorer/xml/XmlInputSource.h>
 #include <colorer/xml/BaseEntityResolver.h>
@@ -13,8 +21,8 @@
 #include <colorer/unicode/Character.h>
 
 HRCParserImpl::HRCParserImpl():
-  versionName(nullptr), parseProtoType(nullptr), parseType(nullptr), current_input_source(nullptr),
-  structureChanged(false), updateStarted(false)
+  versionName(nullptr), preloadBatch(0), loadThreads(1), deferCompile(false), parseProtoType(nullptr), parseType(nullptr),
+  current_input_source(nullptr), updateStarted(false)
 {
   fileTypeHash.reserve(200);
   fileTypeVector.reserve(150);
@@ -80,7 +88,15 @@ void HRCParserImpl::unloadFileType(FileTypeImpl* filetype)
       break;
     }
   }
-  fileTypeHash.erase(filetype->getName());
+  pendingNodes.erase(std::remove_if(pendingNodes.begin(), pendingNodes.end(), [filetype](const PendingNode & pending) {
+    return pending.scheme->fileType == filetype;
+  }), pendingNodes.end());
+  linkWorklists.erase(filetype);
+  unindexedSchemes.erase(std::remove_if(unindexedSchemes.begin(), unindexedSchemes.end(), [filetype](const SchemeImpl * scheme) {
+    return scheme->fileType == filetype;
+  }), unindexedSchemes.end());
+  linkReadyTypes.erase(std::remove(linkReadyTypes.begin(), linkReadyTypes.end(), filetype), linkReadyTypes.end());
+  fileTypeHash.erase(filetype->name);
   delete filetype;
 }
 
@@ -94,7 +110,11 @@ void HRCParserImpl::loadFileType(FileType* filetype)
   thisType->input_source_loading = true;
 
   try {
-    loadSource(thisType->inputSource.get());
+    if (thisType->imageIndex >= 0) {
+      loadImageType(thisType);
+    } else {
+      loadSource(thisType->inputSource.get());
+    }
   } catch (InputSourceException &e) {
     spdlog::error("Can't open source stream: {0}", e.what());
     thisType->load_broken = true;
@@ -105,13 +125,241 @@ void HRCParserImpl::loadFileType(FileType* filetype)
     spdlog::error("{0} [{1}]", e.what(), thisType->inputSource ? XStr(thisType->inputSource->getInputSource()->getSystemId()).get_char() : "");
     thisType->load_broken = true;
   } catch (...) {
-    spdlog::error("Unknown exception while loading {0}", XStr(thisType->inputSource->getInputSource()->getSystemId()).get_char());
+    spdlog::error("Unknown exception while loading {0}", thisType->inputSource ? XStr(thisType->inputSource->getInputSource()->getSystemId()).get_char() : "");
     thisType->load_broken = true;
   }
 
   thisType->input_source_loading = false;
 }
 
+void HRCParserImpl::loadImageType(FileTypeImpl* type)
+{
+  bool globalUpdateStarted = false;
+  if (!updateStarted) {
+    globalUpdateStarted = true;
+    updateStarted = true;
+  }
+
+  try {
+    image->loadType(type);
+  } catch (...) {
+    dropImageSchemes(type);
+    if (globalUpdateStarted) {
+      updateStarted = false;
+    }
+    throw;
+  }
+
+  if (type->loadDone) {
+    linkReadyTypes.push_back(type);
+  }
+  if (globalUpdateStarted) {
+    updateLinks();
+    updateDispatchIndex();
+    updateStarted = false;
+  }
+}
+
+/**
+ * Deletes the schemes of the type, which image body is broken.
+ * Links of the schemes are not resolved yet, so nothing refers to them.
+ */
+void HRCParserImpl::dropImageSchemes(FileTypeImpl* type)
+{
+  for (auto scheme = schemeHash.begin(); scheme != schemeHash.end();) {
+    if (scheme->second->fileType == type) {
+      delete scheme->second;
+      scheme = schemeHash.erase(scheme);
+    } else {
+      ++scheme;
+    }
+  }
+  unindexedSchemes.erase(std::remove_if(unindexedSchemes.begin(), unindexedSchemes.end(), [type](const SchemeImpl * scheme) {
+    return scheme->fileType == type;
+  }), unindexedSchemes.end());
+  linkWorklists.erase(type);
+}
+
+bool HRCParserImpl::saveImage(std::ostream &stream)
+{
+  HRCDatabaseImage writer(this);
+  return writer.write(stream);
+}
+
+bool HRCParserImpl::loadImage(const String* path)
+{
+  if (!fileTypeHash.empty() || !regionNamesVector.empty()) {
+    spdlog::error("HRC image can't be loaded into the not empty database");
+    return false;
+  }
+  std::unique_ptr<HRCDatabaseImage> new_image(new HRCDatabaseImage(this));
+  if (!new_image->open(path)) {
+    return false;
+  }
+  image = std::move(new_image);
+  return true;
+}
+
+/**
+ * Calls @c job for the indexes [0, count) in @c threads threads, including the calling one.
+ * Job must not throw.
+ */
+static void runParallel(int threads, size_t count, const std::function<void(size_t)> &job)
+{
+  std::atomic<size_t> next(0);
+  auto worker = [&next, count, &job]() {
+    for (size_t idx = next++; idx < count; idx = next++) {
+      job(idx);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < std::min(static_cast<size_t>(threads), count); i++) {
+    workers.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : workers) {
+    thread.join();
+  }
+}
+
+void HRCParserImpl::setLoadThreads(int threads)
+{
+  if (threads <= 0) {
+    threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  }
+  loadThreads = threads;
+}
+
+void HRCParserImpl::preloadSources(const std::vector<XmlInputSource*> &sources)
+{
+  if (loadThreads <= 1) {
+    return;
+  }
+  preloadQueue.clear();
+  preloadIndex.clear();
+  parsedSources.clear();
+  for (auto is : sources) {
+    if (is != nullptr && preloadIndex.emplace(is, preloadQueue.size()).second) {
+      preloadQueue.push_back(is);
+    }
+  }
+  spdlog::debug("preload {0} hrc files in {1} threads", preloadQueue.size(), loadThreads);
+}
+
+/**
+ * Parses the batch of the queued sources, starting with the requested one,
+ * in the load threads. Not used documents of the batches before the previous
+ * one are dropped, so the number of the documents in memory is bounded.
+ */
+void HRCParserImpl::preloadNextBatch(size_t pos)
+{
+  preloadBatch++;
+  for (auto parsed = parsedSources.begin(); parsed != parsedSources.end();) {
+    if (parsed->second.batch + 1 < preloadBatch) {
+      parsed = parsedSources.erase(parsed);
+    } else {
+      ++parsed;
+    }
+  }
+  std::vector<std::pair<XmlInputSource*, ParsedSource*>> unparsed;
+  for (; pos < preloadQueue.size() && unparsed.size() < static_cast<size_t>(loadThreads); pos++) {
+    XmlInputSource* is = preloadQueue[pos];
+    if (is == nullptr) {
+      continue;
+    }
+    auto parsed = parsedSources.emplace(is, ParsedSource());
+    if (parsed.second) {
+      parsed.first->second.batch = preloadBatch;
+      unparsed.emplace_back(is, &parsed.first->second);
+    }
+  }
+  // errors are thrown again, when the source is loaded
+  runParallel(loadThreads, unparsed.size(), [&unparsed](size_t idx) {
+    try {
+      unparsed[idx].second->parser = parseDocument(unparsed[idx].first);
+    } catch (...) {
+      unparsed[idx].second->error = std::current_exception();
+    }
+  });
+}
+
+void HRCParserImpl::loadAllTypes()
+{
+  std::vector<const Atom*> packageNames;
+  for (const auto& it : fileTypeHash) {
+    if (it.second->isPackage) {
+      packageNames.push_back(it.first);
+    }
+  }
+  std::sort(packageNames.begin(), packageNames.end(), [](const Atom* a, const Atom* b) {
+    return a->compareTo(*b) < 0;
+  });
+  // files are preloaded in the order of the types loading
+  std::vector<FileTypeImpl*> types(fileTypeVector);
+  for (auto name : packageNames) {
+    types.push_back(fileTypeHash.find(name)->second);
+  }
+  std::vector<XmlInputSource*> sources;
+  for (auto type : types) {
+    if (!type->type_loaded && !type->load_broken && type->imageIndex < 0 && type->inputSource) {
+      sources.push_back(type->inputSource.get());
+    }
+  }
+  preloadSources(sources);
+
+  bool globalUpdateStarted = false;
+  if (!updateStarted) {
+    globalUpdateStarted = true;
+    updateStarted = true;
+  }
+  bool globalDeferStarted = false;
+  if (!deferCompile && loadThreads > 1) {
+    globalDeferStarted = true;
+    deferCompile = true;
+  }
+
+  // types could be added by the loaded HRC files, so they are enumerated by index
+  for (size_t idx = 0; idx < fileTypeVector.size(); idx++) {
+    loadFileType(fileTypeVector[idx]);
+  }
+  packageNames.clear();
+  for (const auto& it : fileTypeHash) {
+    if (it.second->isPackage) {
+      packageNames.push_back(it.first);
+    }
+  }
+  std::sort(packageNames.begin(), packageNames.end(), [](const Atom* a, const Atom* b) {
+    return a->compareTo(*b) < 0;
+  });
+  for (auto name : packageNames) {
+    auto package = fileTypeHash.find(name);
+    if (package != fileTypeHash.end()) {
+      loadFileType(package->second);
+    }
+  }
+
+  if (globalDeferStarted) {
+    // named regions and links could load the referred types, their nodes are compiled in the next pass
+    while (!pendingRegExps.empty() || !pendingKeywords.empty() || !pendingNodes.empty()) {
+      compilePending();
+      finishPending();
+      if (globalUpdateStarted && pendingNodes.empty()) {
+        updateLinks();
+      }
+    }
+    deferCompile = false;
+  }
+  if (globalUpdateStarted) {
+    updateLinks();
+    updateDispatchIndex();
+    updateStarted = false;
+  }
+  // documents of the types, which were loaded with other files
+  preloadQueue.clear();
+  preloadIndex.clear();
+  parsedSources.clear();
+}
+
 FileType* HRCParserImpl::chooseFileType(const String* fileName, const String* firstLine, int typeNo)
 {
   FileTypeImpl* best = nullptr;
@@ -140,7 +388,7 @@ FileType* HRCParserImpl::getFileType(const String* name)
   if (name == nullptr) {
     return nullptr;
   }
-  auto filetype = fileTypeHash.find(name);
+  auto filetype = fileTypeHash.find(AtomTable::find(*name));
   if (filetype != fileTypeHash.end())
     return filetype->second;
   else
@@ -186,93 +434,148 @@ const String* HRCParserImpl::getVersion()
   return versionName;
 }
 
+static void addRuleProfile(std::vector<RuleProfile> &profiles, RuleProfile &profile, const SearchProfile &search)
+{
+  if (search.attempts == 0) {
+    return;
+  }
+  profile.attempts = search.attempts;
+  profile.matches = search.matches;
+  profile.steps = search.steps;
+  profile.time = search.time;
+  profiles.push_back(profile);
+}
+
+void HRCParserImpl::getRuleProfiles(std::vector<RuleProfile> &profiles)
+{
+  for (const auto& it : schemeHash) {
+    SchemeImpl* scheme = it.second;
+    for (size_t idx = 0; idx < scheme->nodes.size(); idx++) {
+      const SchemeNode* node = scheme->nodes[idx];
+      RuleProfile profile;
+      profile.scheme = scheme;
+      profile.rule = (int)idx + 1;
+      profile.location = scheme->getSourceLocation();
+      switch (node->type) {
+        case SchemeNode::SNT_RE:
+          profile.kind = RuleProfile::RK_REGEXP;
+          break;
+        case SchemeNode::SNT_SCHEME:
+          profile.kind = RuleProfile::RK_BLOCK_START;
+          break;
+        case SchemeNode::SNT_KEYWORDS:
+          profile.kind = RuleProfile::RK_KEYWORDS;
+          break;
+        default:
+          continue;
+      }
+      addRuleProfile(profiles, profile, node->startProfile);
+      if (node->type == SchemeNode::SNT_SCHEME) {
+        profile.kind = RuleProfile::RK_BLOCK_END;
+        addRuleProfile(profiles, profile, node->endProfile);
+      }
+    }
+  }
+}
+
+void HRCParserImpl::resetRuleProfiles()
+{
+  for (const auto& it : schemeHash) {
+    for (auto node : it.second->nodes) {
+      node->startProfile.reset();
+      node->endProfile.reset();
+    }
+  }
+}
+
 
 // protected methods
 
 
-void HRCParserImpl::parseHRC(XmlInputSource* is)
+/**
+ * Reads and parses the HRC file. Could be called from several threads
+ * with the different sources.
+ */
+std::unique_ptr<xercesc::XercesDOMParser> HRCParserImpl::parseDocument(XmlInputSource* is)
 {
-  spdlog::debug("begin parse '{0}'", *XStr(is->getInputSource()->getSystemId()).get_stdstr());
-  xercesc::XercesDOMParser xml_parser;
+  std::unique_ptr<xercesc::XercesDOMParser> xml_parser(new xercesc::XercesDOMParser());
   XmlParserErrorHandler error_handler;
   BaseEntityResolver resolver;
-  xml_parser.setErrorHandler(&error_handler);
-  xml_parser.setXMLEntityResolver(&resolver);
-  xml_parser.setLoadExternalDTD(false);
-  xml_parser.setSkipDTDValidation(true);
-  xml_parser.parse(*is->getInputSource());
+  xml_parser->setErrorHandler(&error_handler);
+  xml_parser->setXMLEntityResolver(&resolver);
+  xml_parser->setLoadExternalDTD(false);
+  xml_parser->setSkipDTDValidation(true);
+  xml_parser->parse(*is->getInputSource());
+  xml_parser->setErrorHandler(nullptr);
+  xml_parser->setXMLEntityResolver(nullptr);
   if (error_handler.getSawErrors()) {
     throw HRCParserException(SString("Error reading hrc file '") + CString(is->getInputSource()->getSystemId()) + "'");
   }
-  xercesc::DOMDocument* doc = xml_parser.getDocument();
-  xercesc::DOMElement* root = doc->getDocumentElement();
-
-  if (root && !xercesc::XMLString::equals(root->getNodeName(), hrcTagHrc)) {
-    throw HRCParserException(SString("Incorrect hrc-file structure. Main '<hrc>' block not found. Current file ") + \
-                             CString(is->getInputSource()->getSystemId()));
-  }
-  if (versionName == nullptr) {
-    versionName = new CString(root->getAttribute(hrcHrcAttrVersion));
-  }
+  return xml_parser;
+}
 
+void HRCParserImpl::parseHRC(XmlInputSource* is)
+{
+  spdlog::debug("begin parse '{0}'", *XStr(is->getInputSource()->getSystemId()).get_stdstr());
   bool globalUpdateStarted = false;
   if (!updateStarted) {
     globalUpdateStarted = true;
     updateStarted = true;
   }
 
-  parseHrcBlock(root);
+  HRCReader reader(this);
+  try {
+    auto queued = preloadIndex.find(is);
+    if (queued != preloadIndex.end()) {
+      if (parsedSources.find(is) == parsedSources.end()) {
+        preloadNextBatch(queued->second);
+      }
+      preloadQueue[queued->second] = nullptr;
+      preloadIndex.erase(queued);
+      if (preloadIndex.empty()) {
+        preloadQueue.clear();
+      }
+    }
+    auto parsed = parsedSources.find(is);
+    if (parsed != parsedSources.end()) {
+      std::unique_ptr<xercesc::XercesDOMParser> xml_parser = std::move(parsed->second.parser);
+      std::exception_ptr error = parsed->second.error;
+      parsedSources.erase(parsed);
+      if (error) {
+        std::rethrow_exception(error);
+      }
+      reader.parse(xml_parser->getDocument());
+    } else {
+      reader.parse(is);
+    }
+  } catch (...) {
+    if (globalUpdateStarted) {
+      updateStarted = false;
+    }
+    throw;
+  }
 
-  structureChanged = true;
   if (globalUpdateStarted) {
     updateLinks();
+    updateDispatchIndex();
     updateStarted = false;
   }
 
   spdlog::debug("end parse '{0}'", *XStr(is->getInputSource()->getSystemId()).get_stdstr());
 }
 
-void HRCParserImpl::parseHrcBlock(const xercesc::DOMElement* elem)
+void HRCParserImpl::startHrc(const HRCNode* root)
 {
-  for (xercesc::DOMNode* node = elem->getFirstChild(); node != nullptr; node = node->getNextSibling()) {
-    if (node->getNodeType() == xercesc::DOMNode::ELEMENT_NODE) {
-      auto* sub_elem = static_cast<xercesc::DOMElement*>(node);
-      parseHrcBlockElements(sub_elem);
-      continue;
-    }
-    if (node->getNodeType() == xercesc::DOMNode::ENTITY_REFERENCE_NODE) {
-      for (xercesc::DOMNode* sub_node = node->getFirstChild(); sub_node != nullptr; sub_node = sub_node->getNextSibling()) {
-        auto* sub_elem = static_cast<xercesc::DOMElement*>(sub_node);
-        parseHrcBlockElements(sub_elem);
-      }
-    }
+  if (!xercesc::XMLString::equals(root->getNodeName(), hrcTagHrc)) {
+    throw HRCParserException(SString("Incorrect hrc-file structure. Main '<hrc>' block not found. Current file ") + \
+                             CString(current_input_source->getInputSource()->getSystemId()));
   }
-}
-
-void HRCParserImpl::parseHrcBlockElements(const xercesc::DOMElement* elem)
-{
-  if (elem->getNodeType() == xercesc::DOMNode::ELEMENT_NODE) {
-    if (xercesc::XMLString::equals(elem->getNodeName(), hrcTagPrototype)) {
-      addPrototype(elem);
-      return;
-    }
-    if (xercesc::XMLString::equals(elem->getNodeName(), hrcTagPackage)) {
-      addPrototype(elem);
-      return;
-    }
-    if (xercesc::XMLString::equals(elem->getNodeName(), hrcTagType)) {
-      addType(elem);
-      return;
-    }
-    if (xercesc::XMLString::equals(elem->getNodeName(), hrcTagAnnotation)) {
-      // not read anotation
-      return;
-    }
-    spdlog::warn("Unused element '{0}'. Current file {1}.", *XStr(elem->getNodeName()).get_stdstr() , *XStr(current_input_source->getInputSource()->getSystemId()).get_stdstr());
+  if (versionName == nullptr) {
+    versionName = new SString(CString(root->getAttribute(hrcHrcAttrVersion)));
   }
 }
 
-void HRCParserImpl::addPrototype(const xercesc::DOMElement* elem)
+void HRCParserImpl::addPrototype(const HRCNode* elem)
 {
   const XMLCh* typeName = elem->getAttribute(hrcPrototypeAttrName);
   const XMLCh* typeGroup = elem->getAttribute(hrcPrototypeAttrGroup);
@@ -286,7 +589,7 @@ void HRCParserImpl::addPrototype(const xercesc::DOMElement* elem)
   }
   FileTypeImpl* f = nullptr;
   CString tname = CString(typeName);
-  auto ft = fileTypeHash.find(&tname);
+  auto ft = fileTypeHash.find(AtomTable::find(tname));
   if (ft != fileTypeHash.end()) {
     f = ft->second;
   }
@@ -296,7 +599,7 @@ void HRCParserImpl::addPrototype(const xercesc::DOMElement* elem)
     //  return;
   }
   auto* type = new FileTypeImpl(this);
-  type->name = std::make_unique<SString>(CString(typeName));
+  type->name = AtomTable::intern(tname);
   type->description = std::make_unique<SString>(CString(typeDescription));
   if (typeGroup != nullptr) {
     type->group = std::make_unique<SString>(CString(typeGroup));
@@ -308,7 +611,7 @@ void HRCParserImpl::addPrototype(const xercesc::DOMElement* elem)
   parsePrototypeBlock(elem);
 
   type->protoLoaded = true;
-  std::pair<SString, FileTypeImpl*> pp(type->getName(), type);
+  std::pair<const Atom*, FileTypeImpl*> pp(type->name, type);
   fileTypeHash.emplace(pp);
 
   if (!type->isPackage) {
@@ -316,11 +619,11 @@ void HRCParserImpl::addPrototype(const xercesc::DOMElement* elem)
   }
 }
 
-void HRCParserImpl::parsePrototypeBlock(const xercesc::DOMElement* elem)
+void HRCParserImpl::parsePrototypeBlock(const HRCNode* elem)
 {
-  for (xercesc::DOMNode* node = elem->getFirstChild(); node != nullptr; node = node->getNextSibling()) {
-    if (node->getNodeType() == xercesc::DOMNode::ELEMENT_NODE) {
-      auto* subelem = static_cast<xercesc::DOMElement*>(node);
+  for (const auto& node : elem->getChildNodes()) {
+    if (node->getNodeType() == HRCNode::ELEMENT_NODE) {
+      const HRCNode* subelem = node.get();
       if (xercesc::XMLString::equals(subelem->getNodeName(), hrcTagLocation)) {
         addPrototypeLocation(subelem);
         continue;
@@ -338,7 +641,7 @@ void HRCParserImpl::parsePrototypeBlock(const xercesc::DOMElement* elem)
   }
 }
 
-void HRCParserImpl::addPrototypeLocation(const xercesc::DOMElement* elem)
+void HRCParserImpl::addPrototypeLocation(const HRCNode* elem)
 {
   const XMLCh* locationLink = elem->getAttribute(hrcLocationAttrLink);
   if (*locationLink == '\0') {
@@ -348,19 +651,17 @@ void HRCParserImpl::addPrototypeLocation(const xercesc::DOMElement* elem)
   parseProtoType->inputSource = XmlInputSource::newInstance(locationLink, current_input_source);
 }
 
-void HRCParserImpl::addPrototypeDetectParam(const xercesc::DOMElement* elem)
+void HRCParserImpl::addPrototypeDetectParam(const HRCNode* elem)
 {
-  if (elem->getFirstChild() == nullptr || elem->getFirstChild()->getNodeType() != xercesc::DOMNode::TEXT_NODE) {
+  if (elem->getChildNodes().empty() || elem->getChildNodes().front()->getNodeType() != HRCNode::TEXT_NODE) {
     spdlog::warn("Bad '{0}' element in prototype '{1}'", XStr(elem->getNodeName()).get_char(), parseProtoType->name->getChars());
     return;
   }
-  const XMLCh* match = ((xercesc::DOMText*)elem->getFirstChild())->getData();
+  const XMLCh* match = elem->getChildNodes().front()->getData();
   CString dmatch = CString(match);
-  auto* matchRE = new CRegExp(&dmatch);
-  matchRE->setPositionMoves(true);
+  auto matchRE = getRegExp(&dmatch, true, nullptr);
   if (!matchRE->isOk()) {
     spdlog::warn("Fault compiling chooser RE '{0}' in prototype '{1}'", dmatch.getChars(), parseProtoType->name->getChars());
-    delete matchRE;
     return;
   }
   FileTypeChooser::ChooserType ctype = xercesc::XMLString::equals(elem->getNodeName() , hrcTagFilename) ? FileTypeChooser::ChooserType::CT_FILENAME : FileTypeChooser::ChooserType::CT_FIRSTLINE;
@@ -371,11 +672,11 @@ void HRCParserImpl::addPrototypeDetectParam(const xercesc::DOMElement* elem)
   parseProtoType->chooserVector.push_back(ftc);
 }
 
-void HRCParserImpl::addPrototypeParameters(const xercesc::DOMElement* elem)
+void HRCParserImpl::addPrototypeParameters(const HRCNode* elem)
 {
-  for (xercesc::DOMNode* node = elem->getFirstChild(); node != nullptr; node = node->getNextSibling()) {
-    if (node->getNodeType() == xercesc::DOMNode::ELEMENT_NODE) {
-      auto* subelem = static_cast<xercesc::DOMElement*>(node);
+  for (const auto& node : elem->getChildNodes()) {
+    if (node->getNodeType() == HRCNode::ELEMENT_NODE) {
+      const HRCNode* subelem = node.get();
       if (xercesc::XMLString::equals(subelem->getNodeName(), hrcTagParam)) {
         const XMLCh* name = subelem->getAttribute(hrcParamAttrName);
         const XMLCh* value = subelem->getAttribute(hrcParamAttrValue);
@@ -393,85 +694,57 @@ void HRCParserImpl::addPrototypeParameters(const xercesc::DOMElement* elem)
       }
       continue;
     }
-    if (node->getNodeType() == xercesc::DOMNode::ENTITY_REFERENCE_NODE) {
-      addPrototypeParameters(static_cast<xercesc::DOMElement*>(node));
+    if (node->getNodeType() == HRCNode::ENTITY_REFERENCE_NODE) {
+      addPrototypeParameters(node.get());
     }
   }
 }
 
-void HRCParserImpl::addType(const xercesc::DOMElement* elem)
+/**
+ * Starts the type definition, child elements of the type are added by HRCReader.
+ * @return Type to be loaded, or null, if the type element must be skipped
+ */
+FileTypeImpl* HRCParserImpl::startType(const HRCNode* elem)
 {
   const XMLCh* typeName = elem->getAttribute(hrcTypeAttrName);
 
   if (*typeName == '\0') {
     spdlog::error("Unnamed type found");
-    return;
+    return nullptr;
   }
   CString d_name = CString(typeName);
-  auto type_ref = fileTypeHash.find(&d_name);
+  auto type_ref = fileTypeHash.find(AtomTable::find(d_name));
   if (type_ref == fileTypeHash.end()) {
     spdlog::error("type '%s' without prototype", d_name.getChars());
-    return;
+    return nullptr;
   }
   FileTypeImpl* type = type_ref->second;
   if (type->type_loaded) {
     spdlog::warn("type '{0}' is already loaded", XStr(typeName).get_char());
-    return;
+    return nullptr;
   }
   type->type_loaded = true;
 
-  FileTypeImpl* o_parseType = parseType;
   parseType = type;
+  return type;
+}
 
-  parseTypeBlock(elem);
-
+void HRCParserImpl::endType(FileTypeImpl* type)
+{
   String* baseSchemeName = qualifyOwnName(type->getName());
   if (baseSchemeName != nullptr) {
-    auto sh = schemeHash.find(baseSchemeName);
+    auto sh = schemeHash.find(AtomTable::find(*baseSchemeName));
     type->baseScheme = sh == schemeHash.end() ? nullptr : sh->second;
   }
   delete baseSchemeName;
   if (type->baseScheme == nullptr && !type->isPackage) {
-    spdlog::warn("type '{0}' has no default scheme", XStr(typeName).get_char());
+    spdlog::warn("type '{0}' has no default scheme", type->getName()->getChars());
   }
   type->loadDone = true;
-  parseType = o_parseType;
+  linkReadyTypes.push_back(type);
 }
 
-void HRCParserImpl::parseTypeBlock(const xercesc::DOMElement* elem)
-{
-  for (xercesc::DOMNode* node = elem->getFirstChild(); node != nullptr; node = node->getNextSibling()) {
-    if (node->getNodeType() == xercesc::DOMNode::ELEMENT_NODE) {
-      auto* subelem = static_cast<xercesc::DOMElement*>(node);
-      if (xercesc::XMLString::equals(subelem->getNodeName(), hrcTagRegion)) {
-        addTypeRegion(subelem);
-        continue;
-      }
-      if (xercesc::XMLString::equals(subelem->getNodeName(), hrcTagEntity)) {
-        addTypeEntity(subelem);
-        continue;
-      }
-      if (xercesc::XMLString::equals(subelem->getNodeName(), hrcTagImport)) {
-        addTypeImport(subelem);
-        continue;
-      }
-      if (xercesc::XMLString::equals(subelem->getNodeName(), hrcTagScheme)) {
-        addScheme(subelem);
-        continue;
-      }
-      if (xercesc::XMLString::equals(subelem->getNodeName(), hrcTagAnnotation)) {
-        // not read anotation
-        continue;
-      }
-    }
-    // случай entity ссылки на другой файл
-    if (node->getNodeType() == xercesc::DOMNode::ENTITY_REFERENCE_NODE) {
-      parseTypeBlock(static_cast<xercesc::DOMElement*>(node));
-    }
-  }
-}
-
-void HRCParserImpl::addTypeRegion(const xercesc::DOMElement* elem)
+void HRCParserImpl::addTypeRegion(const HRCNode* elem)
 {
   const XMLCh* regionName = elem->getAttribute(hrcRegionAttrName);
   const XMLCh* regionParent = elem->getAttribute(hrcRegionAttrParent);
@@ -487,7 +760,7 @@ void HRCParserImpl::addTypeRegion(const xercesc::DOMElement* elem)
   }
   CString d_regionparent = CString(regionParent);
   String* qname2 = qualifyForeignName(*regionParent != '\0' ? &d_regionparent : nullptr, QNT_DEFINE, true);
-  if (regionNamesHash.find(qname1) != regionNamesHash.end()) {
+  if (regionNamesHash.find(AtomTable::find(*qname1)) != regionNamesHash.end()) {
     spdlog::warn("Duplicate region '{0}' definition in type '{1}'", qname1->getChars(), parseType->getName()->getChars());
     delete qname1;
     delete qname2;
@@ -497,18 +770,18 @@ void HRCParserImpl::addTypeRegion(const xercesc::DOMElement* elem)
   CString regiondescr = CString(regionDescr);
   const Region* region = new Region(qname1, &regiondescr, getRegion(qname2), (int)regionNamesVector.size());
   regionNamesVector.push_back(region);
-  std::pair<SString, const Region*> pp(qname1, region);
+  std::pair<const Atom*, const Region*> pp(region->getAtom(), region);
   regionNamesHash.emplace(pp);
 
   delete qname1;
   delete qname2;
 }
 
-void HRCParserImpl::addTypeEntity(const xercesc::DOMElement* elem)
+void HRCParserImpl::addTypeEntity(const HRCNode* elem)
 {
   const XMLCh* entityName  = elem->getAttribute(hrcEntityAttrName);
   const XMLCh* entityValue = elem->getAttribute(hrcEntityAttrValue);
-  if (*entityName == '\0' || elem->getAttributeNode(hrcEntityAttrValue) == nullptr) {
+  if (*entityName == '\0' || !elem->hasAttribute(hrcEntityAttrValue)) {
     spdlog::error("Bad entity attributes");
     return;
   }
@@ -523,39 +796,46 @@ void HRCParserImpl::addTypeEntity(const xercesc::DOMElement* elem)
   }
 }
 
-void HRCParserImpl::addTypeImport(const xercesc::DOMElement* elem)
+void HRCParserImpl::addTypeImport(const HRCNode* elem)
 {
   const XMLCh* typeParam = elem->getAttribute(hrcImportAttrType);
   CString typeparam = CString(typeParam);
-  if (*typeParam == '\0' || fileTypeHash.find(&typeparam) == fileTypeHash.end()) {
+  auto imported = fileTypeHash.find(AtomTable::find(typeparam));
+  if (*typeParam == '\0' || imported == fileTypeHash.end()) {
     spdlog::error("Import with bad '{0}' attribute in type '{1}'", typeparam.getChars(), parseType->name->getChars());
     return;
   }
-  parseType->importVector.emplace_back(new SString(CString(typeParam)));
+  parseType->importVector.push_back(imported->first);
 }
 
-void HRCParserImpl::addScheme(const xercesc::DOMElement* elem)
+/**
+ * Adds the scheme of the current type, its nodes are added by HRCReader.
+ * @return Added scheme, or null, if the scheme element must be skipped
+ */
+SchemeImpl* HRCParserImpl::startScheme(const HRCNode* elem)
 {
   const XMLCh* schemeName = elem->getAttribute(hrcSchemeAttrName);
   CString dschemeName = CString(schemeName);
   String* qSchemeName = qualifyOwnName(*schemeName != '\0' ? &dschemeName : nullptr);
   if (qSchemeName == nullptr) {
     spdlog::error("bad scheme name in type '{0}'", parseType->getName()->getChars());
-    return;
+    return nullptr;
   }
-  if (schemeHash.find(qSchemeName) != schemeHash.end() ||
+  if (schemeHash.find(AtomTable::find(*qSchemeName)) != schemeHash.end() ||
       disabledSchemes.find(qSchemeName) != disabledSchemes.end()) {
     spdlog::error("duplicate scheme name '{0}'", qSchemeName->getChars());
     delete qSchemeName;
-    return;
+    return nullptr;
   }
 
   auto* scheme = new SchemeImpl(qSchemeName);
   delete qSchemeName;
   scheme->fileType = parseType;
+  scheme->sourceLocation.reset(new SString(CString(current_input_source->getInputSource()->getSystemId())));
 
-  std::pair<SString, SchemeImpl*> pp(scheme->getName(), scheme);
+  std::pair<const Atom*, SchemeImpl*> pp(scheme->schemeName, scheme);
   schemeHash.emplace(pp);
+  unindexedSchemes.push_back(scheme);
   const XMLCh* condIf = elem->getAttribute(hrcSchemeAttrIf);
   const XMLCh* condUnless = elem->getAttribute(hrcSchemeAttrUnless);
   const String* p1 = parseType->getParamValue(CString(condIf));
@@ -563,44 +843,12 @@ void HRCParserImpl::addScheme(const xercesc::DOMElement* elem)
   if ((*condIf != '\0' && !CString("true").equals(p1)) ||
       (*condUnless != '\0' && CString("true").equals(p2))) {
     //disabledSchemes.put(scheme->schemeName, 1);
-    return;
-  }
-  parseSchemeBlock(scheme, elem);
-}
-
-void HRCParserImpl::parseSchemeBlock(SchemeImpl* scheme, const xercesc::DOMElement* elem)
-{
-  for (xercesc::DOMNode* node = elem->getFirstChild(); node != nullptr; node = node->getNextSibling()) {
-    if (node->getNodeType() == xercesc::DOMNode::ELEMENT_NODE) {
-      auto* subelem = static_cast<xercesc::DOMElement*>(node);
-      if (xercesc::XMLString::equals(subelem->getNodeName(), hrcTagInherit)) {
-        addSchemeInherit(scheme, subelem);
-        continue;
-      }
-      if (xercesc::XMLString::equals(subelem->getNodeName(), hrcTagRegexp)) {
-        addSchemeRegexp(scheme, subelem);
-        continue;
-      }
-      if (xercesc::XMLString::equals(subelem->getNodeName(), hrcTagBlock)) {
-        addSchemeBlock(scheme, subelem);
-        continue;
-      }
-      if (xercesc::XMLString::equals(subelem->getNodeName(), hrcTagKeywords)) {
-        addSchemeKeywords(scheme, subelem);
-        continue;
-      }
-      if (xercesc::XMLString::equals(subelem->getNodeName(), hrcTagAnnotation)) {
-        // not read anotation
-        continue;
-      }
-    }
-    if (node->getNodeType() == xercesc::DOMNode::ENTITY_REFERENCE_NODE) {
-      parseSchemeBlock(scheme, static_cast<xercesc::DOMElement*>(node));
-    }
+    return nullptr;
   }
+  return scheme;
 }
 
-void HRCParserImpl::addSchemeInherit(SchemeImpl* scheme, const xercesc::DOMElement* elem)
+void HRCParserImpl::addSchemeInherit(SchemeImpl* scheme, const HRCNode* elem)
 {
   const XMLCh* nqSchemeName = elem->getAttribute(hrcInheritAttrScheme);
   if (*nqSchemeName == '\0') {
@@ -617,15 +865,15 @@ void HRCParserImpl::addSchemeInherit(SchemeImpl* scheme, const xercesc::DOMEleme
     //        delete next;
     //        continue;
   } else {
-    scheme_node->scheme = schemeHash.find(schemeName)->second;
+    scheme_node->scheme = schemeHash.find(AtomTable::find(*schemeName))->second;
   }
   if (schemeName != nullptr) {
     scheme_node->schemeName.reset(schemeName);
   }
 
-  for (xercesc::DOMNode* node = elem->getFirstChild(); node != nullptr; node = node->getNextSibling()) {
-    if (node->getNodeType() == xercesc::DOMNode::ELEMENT_NODE) {
-      auto* subelem = static_cast<xercesc::DOMElement*>(node);
+  for (const auto& node : elem->getChildNodes()) {
+    if (node->getNodeType() == HRCNode::ELEMENT_NODE) {
+      const HRCNode* subelem = node.get();
       if (xercesc::XMLString::equals(subelem->getNodeName() , hrcTagVirtual)) {
         const XMLCh* x_schemeName = subelem->getAttribute(hrcVirtualAttrScheme);
         const XMLCh* x_substName = subelem->getAttribute(hrcVirtualAttrSubstScheme);
@@ -640,20 +888,21 @@ void HRCParserImpl::addSchemeInherit(SchemeImpl* scheme, const xercesc::DOMEleme
     }
   }
   scheme->nodes.push_back(scheme_node);
+  addSchemeLinks(scheme, scheme_node);
 }
 
-void HRCParserImpl::addSchemeRegexp(SchemeImpl* scheme, const xercesc::DOMElement* elem)
+void HRCParserImpl::addSchemeRegexp(SchemeImpl* scheme, const HRCNode* elem)
 {
   const XMLCh* matchParam = elem->getAttribute(hrcRegexpAttrMatch);
   if (*matchParam == '\0') {
-    for (xercesc::DOMNode* child = elem->getFirstChild(); child != nullptr; child = child->getNextSibling()) {
-      if (child->getNodeType() == xercesc::DOMNode::CDATA_SECTION_NODE) {
-        matchParam = ((xercesc::DOMCDATASection*)child)->getData();
+    for (const auto& child : elem->getChildNodes()) {
+      if (child->getNodeType() == HRCNode::CDATA_SECTION_NODE) {
+        matchParam = child->getData();
         break;
       }
-      if (child->getNodeType() == xercesc::DOMNode::TEXT_NODE) {
+      if (child->getNodeType() == HRCNode::TEXT_NODE) {
         const XMLCh* matchParam1;
-        matchParam1 = ((xercesc::DOMText*)child)->getData();
+        matchParam1 = child->getData();
         xercesc::XMLString::trim((XMLCh*)matchParam1);
         if (*matchParam1 != '\0') {
           matchParam = matchParam1;
@@ -672,12 +921,14 @@ void HRCParserImpl::addSchemeRegexp(SchemeImpl* scheme, const xercesc::DOMElemen
   CString dhrcRegexpAttrPriority = CString(elem->getAttribute(hrcRegexpAttrPriority));
   scheme_node->lowPriority = CString("low").equals(&dhrcRegexpAttrPriority);
   scheme_node->type = SchemeNode::SNT_RE;
-  scheme_node->start = std::make_unique<CRegExp>(entMatchParam);
-  if (!scheme_node->start || !scheme_node->start->isOk())
+  scheme_node->start = getRegExp(entMatchParam, false, nullptr, deferCompile);
+  scheme_node->end = nullptr;
+  if (deferCompile) {
+    pendingNodes.push_back({scheme, scheme_node, SString(entMatchParam), SString()});
+  } else if (!scheme_node->start->isOk()) {
     spdlog::error("fault compiling regexp '{0}' in scheme '{1}'", entMatchParam->getChars(), scheme->schemeName->getChars());
+  }
   delete entMatchParam;
-  scheme_node->start->setPositionMoves(false);
-  scheme_node->end = nullptr;
 
   loadRegions(scheme_node, elem, true);
   if (scheme_node->region) {
@@ -687,33 +938,36 @@ void HRCParserImpl::addSchemeRegexp(SchemeImpl* scheme, const xercesc::DOMElemen
   scheme->nodes.push_back(scheme_node);
 }
 
-void HRCParserImpl::addSchemeBlock(SchemeImpl* scheme, const xercesc::DOMElement* elem)
+void HRCParserImpl::addSchemeBlock(SchemeImpl* scheme, const HRCNode* elem)
 {
   const XMLCh* sParam = elem->getAttribute(hrcBlockAttrStart);
   const XMLCh* eParam = elem->getAttribute(hrcBlockAttrEnd);
 
-  xercesc::DOMElement* eStart = nullptr, *eEnd = nullptr;
+  const HRCNode* eStart = nullptr, *eEnd = nullptr;
 
-  for (xercesc::DOMNode* blkn = elem->getFirstChild(); blkn && !(*eParam != '\0' && *sParam != '\0'); blkn = blkn->getNextSibling()) {
-    xercesc::DOMElement* blkel;
-    if (blkn->getNodeType() == xercesc::DOMNode::ELEMENT_NODE) {
-      blkel = static_cast<xercesc::DOMElement*>(blkn);
+  for (const auto& blkn : elem->getChildNodes()) {
+    if (*eParam != '\0' && *sParam != '\0') {
+      break;
+    }
+    const HRCNode* blkel;
+    if (blkn->getNodeType() == HRCNode::ELEMENT_NODE) {
+      blkel = blkn.get();
     } else {
       continue;
     }
 
     const XMLCh* p = nullptr;
-    if (blkel->getAttributeNode(hrcBlockAttrMatch)) {
+    if (blkel->hasAttribute(hrcBlockAttrMatch)) {
       p = blkel->getAttribute(hrcBlockAttrMatch);
     } else {
-      for (xercesc::DOMNode* child = blkel->getFirstChild(); child != nullptr; child = child->getNextSibling()) {
-        if (child->getNodeType() == xercesc::DOMNode::CDATA_SECTION_NODE) {
-          p = ((xercesc::DOMCDATASection*)child)->getData();
+      for (const auto& child : blkel->getChildNodes()) {
+        if (child->getNodeType() == HRCNode::CDATA_SECTION_NODE) {
+          p = child->getData();
           break;
         }
-        if (child->getNodeType() == xercesc::DOMNode::TEXT_NODE) {
+        if (child->getNodeType() == HRCNode::TEXT_NODE) {
           const XMLCh* p1;
-          p1 = ((xercesc::DOMText*)child)->getData();
+          p1 = child->getData();
           xercesc::XMLString::trim((XMLCh*)p1);
           if (*p1 != '\0') {
             p = p1;
@@ -764,17 +1018,17 @@ void HRCParserImpl::addSchemeBlock(SchemeImpl* scheme, const xercesc::DOMElement
   scheme_node->lowContentPriority = CString("low").equals(&attr_cpr);
   scheme_node->innerRegion = CString("yes").equals(&attr_ireg);
   scheme_node->type = SchemeNode::SNT_SCHEME;
-  scheme_node->start = std::make_unique<CRegExp>(startParam);
-  scheme_node->start->setPositionMoves(false);
-  if (!scheme_node->start->isOk()) {
-    spdlog::error("fault compiling regexp '{0}' in scheme '{1}'", startParam->getChars(), scheme->schemeName->getChars());
-  }
-  scheme_node->end = std::make_unique<CRegExp>();
-  scheme_node->end->setPositionMoves(true);
-  scheme_node->end->setBackRE(scheme_node->start.get());
-  scheme_node->end->setRE(endParam);
-  if (!scheme_node->end->isOk()) {
-    spdlog::error("fault compiling regexp '{0}' in scheme '{1}'", endParam->getChars(), scheme->schemeName->getChars());
+  scheme_node->start = getRegExp(startParam, false, nullptr, deferCompile);
+  scheme_node->end = getRegExp(endParam, true, scheme_node->start.get(), deferCompile);
+  if (deferCompile) {
+    pendingNodes.push_back({scheme, scheme_node, SString(startParam), SString(endParam)});
+  } else {
+    if (!scheme_node->start->isOk()) {
+      spdlog::error("fault compiling regexp '{0}' in scheme '{1}'", startParam->getChars(), scheme->schemeName->getChars());
+    }
+    if (!scheme_node->end->isOk()) {
+      spdlog::error("fault compiling regexp '{0}' in scheme '{1}'", endParam->getChars(), scheme->schemeName->getChars());
+    }
   }
   delete startParam;
   delete endParam;
@@ -784,9 +1038,10 @@ void HRCParserImpl::addSchemeBlock(SchemeImpl* scheme, const xercesc::DOMElement
   loadRegions(scheme_node, eStart, true);
   loadRegions(scheme_node, eEnd, false);
   scheme->nodes.push_back(scheme_node);
+  addSchemeLinks(scheme, scheme_node);
 }
 
-void HRCParserImpl::addSchemeKeywords(SchemeImpl* scheme, const xercesc::DOMElement* elem)
+void HRCParserImpl::addSchemeKeywords(SchemeImpl* scheme, const HRCNode* elem)
 {
   const Region* brgn = getNCRegion(elem, CString("region"));
   if (brgn == nullptr) {
@@ -821,25 +1076,28 @@ void HRCParserImpl::addSchemeKeywords(SchemeImpl* scheme, const xercesc::DOMElem
   scheme_node->kwList->matchCase = isCase;
   scheme_node->type = SchemeNode::SNT_KEYWORDS;
 
-  for (xercesc::DOMNode* keywrd = elem->getFirstChild(); keywrd; keywrd = keywrd->getNextSibling()) {
-    if (keywrd->getNodeType() == xercesc::DOMNode::ELEMENT_NODE) {
-      addKeyword(scheme_node, brgn, static_cast<xercesc::DOMElement*>(keywrd));
+  for (const auto& keywrd : elem->getChildNodes()) {
+    if (keywrd->getNodeType() == HRCNode::ELEMENT_NODE) {
+      addKeyword(scheme_node, brgn, keywrd.get());
       continue;
     }
-    if (keywrd->getNodeType() == xercesc::DOMNode::ENTITY_REFERENCE_NODE) {
-      for (xercesc::DOMNode* keywrd2 = keywrd->getFirstChild(); keywrd2; keywrd2 = keywrd2->getNextSibling()) {
-        if (keywrd2->getNodeType() == xercesc::DOMNode::ELEMENT_NODE) {
-          addKeyword(scheme_node, brgn, static_cast<xercesc::DOMElement*>(keywrd2));
+    if (keywrd->getNodeType() == HRCNode::ENTITY_REFERENCE_NODE) {
+      for (const auto& keywrd2 : keywrd->getChildNodes()) {
+        if (keywrd2->getNodeType() == HRCNode::ELEMENT_NODE) {
+          addKeyword(scheme_node, brgn, keywrd2.get());
         }
       }
     }
   }
-  scheme_node->kwList->sortList();
-  scheme_node->kwList->substrIndex();
+  if (deferCompile) {
+    pendingKeywords.push_back(scheme_node->kwList.get());
+  } else {
+    scheme_node->kwList->buildTrie();
+  }
   scheme->nodes.push_back(scheme_node);
 }
 
-void HRCParserImpl::addKeyword(SchemeNode* scheme_node, const Region* brgn, const xercesc::DOMElement* elem)
+void HRCParserImpl::addKeyword(SchemeNode* scheme_node, const Region* brgn, const HRCNode* elem)
 {
   int type = 0;
   if (xercesc::XMLString::equals(elem->getNodeName() , hrcTagWord)) {
@@ -866,7 +1124,6 @@ void HRCParserImpl::addKeyword(SchemeNode* scheme_node, const Region* brgn, cons
   scheme_node->kwList->kwList[pos].keyword = std::make_unique<SString>(CString(param));
   scheme_node->kwList->kwList[pos].region = rgn;
   scheme_node->kwList->kwList[pos].isSymbol = (type == 2);
-  scheme_node->kwList->kwList[pos].ssShorter = -1;
   scheme_node->kwList->firstChar->addChar(param[0]);
   if (!scheme_node->kwList->matchCase) {
     scheme_node->kwList->firstChar->addChar(Character::toLowerCase(param[0]));
@@ -879,25 +1136,25 @@ void HRCParserImpl::addKeyword(SchemeNode* scheme_node, const Region* brgn, cons
   }
 }
 
-int HRCParserImpl::getSchemeKeywordsCount(const xercesc::DOMElement* elem)
+int HRCParserImpl::getSchemeKeywordsCount(const HRCNode* elem)
 {
   int result = 0;
-  for (xercesc::DOMNode* keywrd_count = elem->getFirstChild(); keywrd_count; keywrd_count = keywrd_count->getNextSibling()) {
-    if (keywrd_count->getNodeType() == xercesc::DOMNode::ELEMENT_NODE) {
+  for (const auto& keywrd_count : elem->getChildNodes()) {
+    if (keywrd_count->getNodeType() == HRCNode::ELEMENT_NODE) {
       if (xercesc::XMLString::equals(keywrd_count->getNodeName() , hrcTagWord) ||
           xercesc::XMLString::equals(keywrd_count->getNodeName() , hrcTagSymb)) {
         result++;
       }
       continue;
     }
-    if (keywrd_count->getNodeType() == xercesc::DOMNode::ENTITY_REFERENCE_NODE) {
-      result += getSchemeKeywordsCount(static_cast<xercesc::DOMElement*>(keywrd_count));
+    if (keywrd_count->getNodeType() == HRCNode::ENTITY_REFERENCE_NODE) {
+      result += getSchemeKeywordsCount(keywrd_count.get());
     }
   }
   return result;
 }
 
-void HRCParserImpl::loadRegions(SchemeNode* node, const xercesc::DOMElement* el, bool st)
+void HRCParserImpl::loadRegions(SchemeNode* node, const HRCNode* el, bool st)
 {
   static char rg_tmpl[8] = "region\0";
 
@@ -917,6 +1174,14 @@ void HRCParserImpl::loadRegions(SchemeNode* node, const xercesc::DOMElement* el,
     }
   }
 
+  // named brackets are known after the compilation
+  if (!deferCompile) {
+    loadNamedRegions(node, st);
+  }
+}
+
+void HRCParserImpl::loadNamedRegions(SchemeNode* node, bool st)
+{
   for (int i = 0; i < NAMED_REGIONS_NUM; i++) {
     if (st) {
       node->regionsn[i] = getNCRegion(node->start->getBracketName(i), false);
@@ -926,7 +1191,7 @@ void HRCParserImpl::loadRegions(SchemeNode* node, const xercesc::DOMElement* el,
   }
 }
 
-void HRCParserImpl::loadBlockRegions(SchemeNode* node, const xercesc::DOMElement* el)
+void HRCParserImpl::loadBlockRegions(SchemeNode* node, const HRCNode* el)
 {
   int i;
   static char rg_tmpl[9] = "region\0\0";
@@ -941,60 +1206,346 @@ void HRCParserImpl::loadBlockRegions(SchemeNode* node, const xercesc::DOMElement
   }
 }
 
+/**
+ * Compiles the deferred regexps and keyword lists with the load threads.
+ */
+void HRCParserImpl::compilePending()
+{
+  // end regexps refer the start ones as back RE, so they are compiled after them
+  for (int withBackRE = 0; withBackRE < 2; withBackRE++) {
+    std::vector<PendingRegExp*> batch;
+    for (auto& pending : pendingRegExps) {
+      if (pending.hasBackRE == (withBackRE != 0)) {
+        batch.push_back(&pending);
+      }
+    }
+    runParallel(loadThreads, batch.size(), [&batch](size_t idx) {
+      try {
+        batch[idx]->re->setRE(batch[idx]->pattern);
+      } catch (Exception &) {
+        // regexp is left not compiled, the error is logged by finishPending()
+      }
+    });
+  }
+  pendingRegExps.clear();
+  runParallel(loadThreads, pendingKeywords.size(), [this](size_t idx) {
+    pendingKeywords[idx]->buildTrie();
+  });
+  pendingKeywords.clear();
+}
+
+/**
+ * Checks the compiled regexps of the deferred nodes and loads their named regions
+ * in the order of the nodes creation. Could load new types, their nodes are added
+ * to the pending ones.
+ */
+void HRCParserImpl::finishPending()
+{
+  std::vector<PendingNode> nodes;
+  nodes.swap(pendingNodes);
+  FileTypeImpl* old_parseType = parseType;
+  for (const auto& pending : nodes) {
+    SchemeNode* node = pending.node;
+    if (!node->start->isOk()) {
+      spdlog::error("fault compiling regexp '{0}' in scheme '{1}'", pending.start.getChars(), pending.scheme->schemeName->getChars());
+    }
+    if (node->end != nullptr && !node->end->isOk()) {
+      spdlog::error("fault compiling regexp '{0}' in scheme '{1}'", pending.end.getChars(), pending.scheme->schemeName->getChars());
+    }
+    parseType = pending.scheme->fileType;
+    loadNamedRegions(node, true);
+    if (node->end != nullptr) {
+      loadNamedRegions(node, false);
+    }
+  }
+  parseType = old_parseType;
+}
+
+/**
+ * Adds the not resolved scheme references of the node to the worklist of its type.
+ */
+void HRCParserImpl::addSchemeLinks(SchemeImpl* scheme, SchemeNode* node)
+{
+  if (node->schemeName != nullptr && (node->type == SchemeNode::SNT_SCHEME || node->type == SchemeNode::SNT_INHERIT) && node->scheme == nullptr) {
+    addSchemeLink(node->schemeName.get(), {scheme, node, nullptr, false});
+  }
+  if (node->type == SchemeNode::SNT_INHERIT) {
+    for (auto vt : node->virtualEntryVector) {
+      if (vt->virtScheme == nullptr && vt->virtSchemeName != nullptr) {
+        addSchemeLink(vt->virtSchemeName.get(), {scheme, node, vt, false});
+      }
+      if (vt->substScheme == nullptr && vt->substSchemeName != nullptr) {
+        addSchemeLink(vt->substSchemeName.get(), {scheme, node, vt, true});
+      }
+    }
+  }
+}
+
+void HRCParserImpl::addSchemeLink(const String* name, const SchemeLink &link)
+{
+  LinkWorklist &worklist = linkWorklists[link.scheme->fileType];
+  auto target = worklist.targetIndex.find(name);
+  if (target == worklist.targetIndex.end()) {
+    target = worklist.targetIndex.emplace(SString(name), worklist.targets.size()).first;
+    worklist.targets.push_back({SString(name), std::vector<SchemeLink>()});
+  }
+  worklist.targets[target->second].links.push_back(link);
+}
+
+/**
+ * Resolves the scheme references of the loaded type. Every referred name
+ * is qualified once for all the references to it.
+ */
+void HRCParserImpl::resolveLinks(FileTypeImpl* type)
+{
+  auto worklist_it = linkWorklists.find(type);
+  if (worklist_it == linkWorklists.end()) {
+    return;
+  }
+  std::vector<LinkTarget> targets = std::move(worklist_it->second.targets);
+  linkWorklists.erase(worklist_it);
+
+  FileTypeImpl* old_parseType = parseType;
+  parseType = type;
+  for (auto& target : targets) {
+    String* qname = qualifyForeignName(&target.name, QNT_SCHEME, true);
+    SchemeImpl* scheme = qname != nullptr ? schemeHash.find(AtomTable::find(*qname))->second : nullptr;
+    delete qname;
+    for (auto& link : target.links) {
+      if (link.entry == nullptr) {
+        link.node->scheme = scheme;
+        if (scheme == nullptr) {
+          spdlog::error("cannot resolve scheme name '{0}' in scheme '{1}'", target.name.getChars(), link.scheme->schemeName->getChars());
+        }
+        link.node->schemeName.reset();
+      } else if (!link.subst) {
+        link.entry->virtScheme = scheme;
+        if (scheme == nullptr) {
+          spdlog::error("cannot virtualize scheme '{0}' in scheme '{1}'", target.name.getChars(), link.scheme->schemeName->getChars());
+        }
+        link.entry->virtSchemeName.reset();
+      } else {
+        link.entry->substScheme = scheme;
+        if (scheme == nullptr) {
+          spdlog::error("cannot virtualize using subst-scheme scheme '{0}' in scheme '{1}'", target.name.getChars(), link.scheme->schemeName->getChars());
+        }
+        link.entry->substSchemeName.reset();
+      }
+    }
+  }
+  parseType = old_parseType;
+}
+
+/**
+ * Resolves the links of the types loaded since the last call.
+ * Only the references of these types are visited, the types loaded
+ * while resolving are added to the same queue.
+ */
 void HRCParserImpl::updateLinks()
 {
-  while (structureChanged) {
-    structureChanged = false;
-    for (auto scheme_it = schemeHash.begin(); scheme_it != schemeHash.end(); ++scheme_it) {
-      SchemeImpl* scheme = scheme_it->second;
-      if (!scheme->fileType->loadDone) {
-        continue;
+  while (!linkReadyTypes.empty()) {
+    FileTypeImpl* type = linkReadyTypes.front();
+    linkReadyTypes.erase(linkReadyTypes.begin());
+    resolveLinks(type);
+  }
+}
+
+typedef std::bitset<SchemeImpl::DC_NUM> DispatchSet;
+
+/** Symbol classes, where the node could match.
+    Inherit nodes are handled by updateDispatchIndex.
+*/
+static DispatchSet getNodeDispatchSet(const SchemeNode* node)
+{
+  DispatchSet set;
+  switch (node->type) {
+    case SchemeNode::SNT_SCHEME:
+      if (!node->scheme) {
+        break;
       }
-      FileTypeImpl* old_parseType = parseType;
-      parseType = scheme->fileType;
-      for (size_t sni = 0; sni < scheme->nodes.size(); sni++) {
-        SchemeNode* snode = scheme->nodes.at(sni);
-        if (snode->schemeName != nullptr && (snode->type == SchemeNode::SNT_SCHEME || snode->type == SchemeNode::SNT_INHERIT) && snode->scheme == nullptr) {
-          String* schemeName = qualifyForeignName(snode->schemeName.get(), QNT_SCHEME, true);
-          if (schemeName != nullptr) {
-            snode->scheme = schemeHash.find(schemeName)->second;
-          } else {
-            spdlog::error("cannot resolve scheme name '{0}' in scheme '{1}'", snode->schemeName->getChars(), scheme->schemeName->getChars());
-          }
-          delete schemeName;
-          snode->schemeName.reset();
+    // fallthrough
+    case SchemeNode::SNT_RE:
+      if (!node->start) {
+        set.set();
+        break;
+      }
+      for (int c = 0; c < SchemeImpl::DC_OTHER; c++) {
+        if (node->start->canStartWith(c)) {
+          set.set(c);
         }
-        if (snode->type == SchemeNode::SNT_INHERIT) {
-          for (auto vt : snode->virtualEntryVector) {
-            if (vt->virtScheme == nullptr && vt->virtSchemeName != nullptr) {
-              String* vsn = qualifyForeignName(vt->virtSchemeName.get(), QNT_SCHEME, true);
-              if (vsn) {
-                vt->virtScheme = schemeHash.find(vsn)->second;
-              } else {
-                spdlog::error("cannot virtualize scheme '{0}' in scheme '{1}'", vt->virtSchemeName->getChars(), scheme->schemeName->getChars());
-              }
-              delete vsn;
-              vt->virtSchemeName.reset();
-            }
-            if (vt->substScheme == nullptr && vt->substSchemeName != nullptr) {
-              String* vsn = qualifyForeignName(vt->substSchemeName.get(), QNT_SCHEME, true);
-              if (vsn) {
-                vt->substScheme = schemeHash.find(vsn)->second;
-              } else {
-                spdlog::error("cannot virtualize using subst-scheme scheme '{0}' in scheme '{1}'", vt->substSchemeName->getChars(), scheme->schemeName->getChars());
-              }
-              delete vsn;
-              vt->substSchemeName.reset();
-            }
-          }
+      }
+      for (int c = SchemeImpl::DC_OTHER; c <= 0x100; c++) {
+        if (node->start->canStartWith(c)) {
+          set.set(SchemeImpl::DC_OTHER);
+          break;
         }
       }
-      parseType = old_parseType;
-      if (structureChanged) {
+      if (node->start->canMatchAtEnd()) {
+        set.set(SchemeImpl::DC_EOL);
+      }
+      break;
+    case SchemeNode::SNT_KEYWORDS:
+      if (!node->kwList || !node->kwList->num) {
         break;
       }
+      for (int c = 0; c < SchemeImpl::DC_OTHER; c++) {
+        if (node->kwList->firstChar->inClass(c)) {
+          set.set(c);
+        }
+      }
+      set.set(SchemeImpl::DC_OTHER);
+      if (!node->kwList->minKeywordLength) {
+        set.set(SchemeImpl::DC_EOL);
+      }
+      break;
+    default:
+      break;
+  }
+  return set;
+}
+
+/** Builds dispatch index of the schemes, loaded since the last call.
+    Inherit node could match at symbol, if it could be matched by the
+    inherited scheme or by any scheme, which virtually substitutes it.
+    Sets of the indexed schemes could grow with the new substitutions,
+    their lists are replaced then, the old ones are kept for the running parsers.
+*/
+void HRCParserImpl::updateDispatchIndex()
+{
+  std::vector<SchemeImpl*> schemes;
+  std::unordered_set<const SchemeImpl*> batch;
+  // schemes of the broken types are never linked, so they are not indexed
+  auto unindexed = std::remove_if(unindexedSchemes.begin(), unindexedSchemes.end(), [&](SchemeImpl * scheme) {
+    if (!scheme->fileType->loadDone) {
+      return false;
     }
+    schemes.push_back(scheme);
+    batch.insert(scheme);
+    return true;
+  });
+  unindexedSchemes.erase(unindexed, unindexedSchemes.end());
+  if (schemes.empty()) {
+    return;
   }
+
+  std::vector<SchemeImpl*> work(schemes);
+  for (auto scheme : schemes) {
+    scheme->dispatchSet.reset();
+    for (auto snode : scheme->nodes) {
+      if (snode->type != SchemeNode::SNT_INHERIT) {
+        continue;
+      }
+      if (snode->scheme) {
+        dispatchDependents[snode->scheme].push_back(scheme);
+      }
+      for (auto vt : snode->virtualEntryVector) {
+        if (vt->virtScheme && vt->substScheme) {
+          substSchemes[vt->virtScheme].push_back(vt->substScheme);
+          dispatchDependents[vt->substScheme].push_back(vt->virtScheme);
+          // the substituted scheme could be indexed already
+          work.push_back(vt->virtScheme);
+        }
+      }
+    }
+  }
+
+  std::unordered_map<const SchemeNode*, DispatchSet> nodeSets;
+  auto getNodeSet = [&nodeSets](const SchemeNode * node) {
+    auto it = nodeSets.find(node);
+    if (it == nodeSets.end()) {
+      it = nodeSets.emplace(node, getNodeDispatchSet(node)).first;
+    }
+    return it->second;
+  };
+  auto getSchemeSet = [&batch](const SchemeImpl * scheme) {
+    if (!scheme->dispatchReady && batch.count(scheme) == 0) {
+      return DispatchSet().set();
+    }
+    return scheme->dispatchSet;
+  };
+
+  // inherit chains and substitutions could be recursive,
+  // so the sets are extended until nothing changes
+  std::unordered_set<SchemeImpl*> grown;
+  while (!work.empty()) {
+    SchemeImpl* scheme = work.back();
+    work.pop_back();
+    DispatchSet set = scheme->dispatchSet;
+    for (auto snode : scheme->nodes) {
+      if (snode->type != SchemeNode::SNT_INHERIT) {
+        set |= getNodeSet(snode);
+      } else if (snode->scheme) {
+        set |= getSchemeSet(snode->scheme);
+      }
+    }
+    auto subst = substSchemes.find(scheme);
+    if (subst != substSchemes.end()) {
+      for (auto sscheme : subst->second) {
+        set |= getSchemeSet(sscheme);
+      }
+    }
+    if (set == scheme->dispatchSet) {
+      continue;
+    }
+    scheme->dispatchSet = set;
+    if (batch.count(scheme) == 0) {
+      grown.insert(scheme);
+    }
+    auto dependents = dispatchDependents.find(scheme);
+    if (dependents != dispatchDependents.end()) {
+      work.insert(work.end(), dependents->second.begin(), dependents->second.end());
+    }
+  }
+
+  for (auto scheme : schemes) {
+    scheme->dispatchReady = true;
+  }
+  for (auto scheme : schemes) {
+    buildDispatchLists(scheme);
+  }
+  for (auto scheme : grown) {
+    if (scheme->dispatchReady) {
+      retiredDispatchLists.push_back(std::move(scheme->dispatchLists));
+      buildDispatchLists(scheme);
+    }
+  }
+}
+
+void HRCParserImpl::buildDispatchLists(SchemeImpl* scheme)
+{
+  std::vector<DispatchSet> sets;
+  sets.reserve(scheme->nodes.size());
+  for (auto snode : scheme->nodes) {
+    if (snode->type != SchemeNode::SNT_INHERIT) {
+      sets.push_back(getNodeDispatchSet(snode));
+    } else if (snode->scheme == nullptr) {
+      sets.push_back(DispatchSet());
+    } else {
+      sets.push_back(snode->scheme->dispatchReady ? snode->scheme->dispatchSet : DispatchSet().set());
+    }
+  }
+  std::vector<std::vector<SchemeNode*>> lists;
+  unsigned char map[SchemeImpl::DC_NUM];
+  for (int dc = 0; dc < SchemeImpl::DC_NUM; dc++) {
+    std::vector<SchemeNode*> list;
+    for (size_t idx = 0; idx < scheme->nodes.size(); idx++) {
+      if (sets[idx][dc]) {
+        list.push_back(scheme->nodes[idx]);
+      }
+    }
+    size_t idx;
+    for (idx = 0; idx < lists.size(); idx++) {
+      if (lists[idx] == list) {
+        break;
+      }
+    }
+    if (idx == lists.size()) {
+      lists.push_back(list);
+    }
+    map[dc] = (unsigned char)idx;
+  }
+  std::copy(map, map + SchemeImpl::DC_NUM, scheme->dispatchMap);
+  scheme->dispatchLists = std::move(lists);
 }
 
 String* HRCParserImpl::qualifyOwnName(const String* name)
@@ -1022,7 +1573,7 @@ String* HRCParserImpl::qualifyOwnName(const String* name)
 
 bool HRCParserImpl::checkNameExist(const String* name, FileTypeImpl* parseType, QualifyNameType qntype, bool logErrors)
 {
-  if (qntype == QNT_DEFINE && regionNamesHash.find(name) == regionNamesHash.end()) {
+  if (qntype == QNT_DEFINE && regionNamesHash.find(AtomTable::find(*name)) == regionNamesHash.end()) {
     if (logErrors)
       spdlog::error("region '{0}', referenced in type '{1}', is not defined", name->getChars(), parseType->name->getChars());
     return false;
@@ -1030,7 +1581,7 @@ bool HRCParserImpl::checkNameExist(const String* name, FileTypeImpl* parseType,
     if (logErrors)
       spdlog::error("entity '{0}', referenced in type '{1}', is not defined", name->getChars(), parseType->name->getChars());
     return false;
-  } else if (qntype == QNT_SCHEME && schemeHash.find(name) == schemeHash.end()) {
+  } else if (qntype == QNT_SCHEME && schemeHash.find(AtomTable::find(*name)) == schemeHash.end()) {
     if (logErrors)
       spdlog::error("scheme '{0}', referenced in type '{1}', is not defined", name->getChars(), parseType->name->getChars());
     return false;
@@ -1046,7 +1597,7 @@ String* HRCParserImpl::qualifyForeignName(const String* name, QualifyNameType qn
   size_t colon = name->indexOf(':');
   if (colon != String::npos) { // qualified name
     CString prefix(name, 0, colon);
-    auto ft = fileTypeHash.find(&prefix);
+    auto ft = fileTypeHash.find(AtomTable::find(prefix));
     FileTypeImpl* prefType = nullptr;
     if (ft != fileTypeHash.end()) {
       prefType = ft->second;
@@ -1065,9 +1616,9 @@ String* HRCParserImpl::qualifyForeignName(const String* name, QualifyNameType qn
     }
   } else { // unqualified name
     for (int idx = -1; parseType != nullptr && idx < static_cast<int>(parseType->importVector.size()); idx++) {
-      const String* tname = parseType->getName();
+      const Atom* tname = parseType->name;
       if (idx > -1) {
-        tname = parseType->importVector.at(idx).get();
+        tname = parseType->importVector.at(idx);
       }
       FileTypeImpl* importer = fileTypeHash.find(tname)->second;
       if (!importer->type_loaded) {
@@ -1136,6 +1687,35 @@ String* HRCParserImpl::useEntities(const String* name)
   return newname;
 }
 
+/**
+ * Returns compiled regexp for the @c pattern (with substituted entities).
+ * Regexps with the same pattern, position moves mode and back RE are
+ * compiled once and shared, matching state is kept in CRegExpContext.
+ * Deferred regexp is compiled later by compilePending().
+ */
+std::shared_ptr<CRegExp> HRCParserImpl::getRegExp(const String* pattern, bool moves, CRegExp* backRE, bool deferred)
+{
+  auto& hashEntry = *regExpHash.emplace(SString(pattern), std::vector<RegExpEntry>()).first;
+  auto& entries = hashEntry.second;
+  for (const auto& entry : entries) {
+    if (entry.moves == moves && entry.backRE == backRE) {
+      return entry.re;
+    }
+  }
+  auto re = std::make_shared<CRegExp>();
+  re->setPositionMoves(moves);
+  if (backRE != nullptr) {
+    re->setBackRE(backRE);
+  }
+  if (deferred) {
+    pendingRegExps.push_back({re.get(), &hashEntry.first, backRE != nullptr});
+  } else {
+    re->setRE(pattern);
+  }
+  entries.push_back({moves, backRE, re});
+  return re;
+}
+
 const Region* HRCParserImpl::getNCRegion(const String* name, bool logErrors)
 {
   if (name == nullptr) {
@@ -1146,7 +1726,7 @@ const Region* HRCParserImpl::getNCRegion(const String* name, bool logErrors)
   if (qname == nullptr) {
     return nullptr;
   }
-  auto reg_ = regionNamesHash.find(qname);
+  auto reg_ = regionNamesHash.find(AtomTable::find(*qname));
   if (reg_ != regionNamesHash.end()) {
     reg = reg_->second;
   } else {
@@ -1167,7 +1747,7 @@ const Region* HRCParserImpl::getNCRegion(const String* name, bool logErrors)
   return reg;
 }
 
-const Region* HRCParserImpl::getNCRegion(const xercesc::DOMElement* el, const String &tag)
+const Region* HRCParserImpl::getNCRegion(const HRCNode* el, const String &tag)
 {
   const XMLCh* par = el->getAttribute(tag.getWChars());
   if (*par == '\0') {
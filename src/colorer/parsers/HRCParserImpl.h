@@ -5,10 +5,15 @@
 #include <colorer/HRCParser.h>
 #include <colorer/parsers/SchemeImpl.h>
 
+#include <exception>
 #include <xercesc/dom/DOM.hpp>
+#include <xercesc/parsers/XercesDOMParser.hpp>
 #include <colorer/xml/XmlInputSource.h>
 
 class FileTypeImpl;
+class HRCDatabaseImage;
+class HRCReader;
+class HRCNode;
 
 /** Implementation of HRCParser.
     Reads and mantains HRC database of syntax rules,
@@ -35,67 +40,158 @@ public:
 
   const String* getVersion();
 
+  void getRuleProfiles(std::vector<RuleProfile> &profiles);
+  void resetRuleProfiles();
+
+  bool saveImage(std::ostream &stream);
+  bool loadImage(const String* path);
+
+  void setLoadThreads(int threads);
+  void preloadSources(const std::vector<XmlInputSource*> &sources);
+  void loadAllTypes();
+
 protected:
   friend class FileTypeImpl;
+  friend class HRCDatabaseImage;
+  friend class HRCReader;
 
   enum QualifyNameType { QNT_DEFINE, QNT_SCHEME, QNT_ENTITY };
 
-  // types and packages
-  std::unordered_map<SString, FileTypeImpl*> fileTypeHash;
+  // types and packages, the hashes are keyed by the interned names
+  std::unordered_map<const Atom*, FileTypeImpl*> fileTypeHash;
   // types, not packages
   std::vector<FileTypeImpl*>    fileTypeVector;
 
-  std::unordered_map<SString, SchemeImpl*>   schemeHash;
+  std::unordered_map<const Atom*, SchemeImpl*> schemeHash;
   std::unordered_map<SString, int> disabledSchemes;
 
   std::vector<const Region*> regionNamesVector;
-  std::unordered_map<SString, const Region*> regionNamesHash;
+  std::unordered_map<const Atom*, const Region*> regionNamesHash;
   std::unordered_map<SString, String*> schemeEntitiesHash;
 
+  // compiled regexps, shared by all the places with the same pattern
+  struct RegExpEntry {
+    bool moves;
+    const CRegExp* backRE;
+    std::shared_ptr<CRegExp> re;
+  };
+  std::unordered_map<SString, std::vector<RegExpEntry>> regExpHash;
+
   String* versionName;
+  // mapped database image, types are loaded from it on request
+  std::unique_ptr<HRCDatabaseImage> image;
+
+  // sources to preload in the order of their loading, loaded ones are null
+  std::vector<XmlInputSource*> preloadQueue;
+  std::unordered_map<const XmlInputSource*, size_t> preloadIndex;
+  // documents of the preloaded sources, which are not added yet
+  struct ParsedSource {
+    std::unique_ptr<xercesc::XercesDOMParser> parser;
+    std::exception_ptr error;
+    size_t batch;
+  };
+  std::unordered_map<const XmlInputSource*, ParsedSource> parsedSources;
+  size_t preloadBatch;
+  int loadThreads;
+
+  // while all the types are loaded, regexps and keyword lists of the scheme nodes
+  // are compiled after the walk of their files
+  struct PendingNode {
+    SchemeImpl* scheme;
+    SchemeNode* node;
+    SString start;
+    SString end;
+  };
+  struct PendingRegExp {
+    CRegExp* re;
+    const SString* pattern;
+    bool hasBackRE;
+  };
+  bool deferCompile;
+  std::vector<PendingRegExp> pendingRegExps;
+  std::vector<PendingNode> pendingNodes;
+  std::vector<KeywordList*> pendingKeywords;
+
+  // not resolved scheme references of the type, grouped by the referred name
+  struct SchemeLink {
+    SchemeImpl* scheme;
+    SchemeNode* node;
+    // null for the scheme of the node itself
+    VirtualEntry* entry;
+    bool subst;
+  };
+  struct LinkTarget {
+    SString name;
+    std::vector<SchemeLink> links;
+  };
+  struct LinkWorklist {
+    std::vector<LinkTarget> targets;
+    std::unordered_map<SString, size_t> targetIndex;
+  };
+  std::unordered_map<const FileTypeImpl*, LinkWorklist> linkWorklists;
+  // loaded types, whose links are resolved by the next updateLinks()
+  std::vector<FileTypeImpl*> linkReadyTypes;
+
+  // schemes without dispatch index, it is built by the next updateDispatchIndex()
+  std::vector<SchemeImpl*> unindexedSchemes;
+  // schemes, which virtually substitute the scheme
+  std::unordered_map<const SchemeImpl*, std::vector<SchemeImpl*>> substSchemes;
+  // schemes, whose dispatch sets include the set of the scheme
+  std::unordered_map<const SchemeImpl*, std::vector<SchemeImpl*>> dispatchDependents;
+  // replaced dispatch lists, parsers could still refer them
+  std::vector<std::vector<std::vector<SchemeNode*>>> retiredDispatchLists;
 
   FileTypeImpl* parseProtoType;
   FileTypeImpl* parseType;
   XmlInputSource* current_input_source;
-  bool structureChanged;
   bool updateStarted;
 
   void loadFileType(FileType* filetype);
   void unloadFileType(FileTypeImpl* filetype);
 
+  void loadImageType(FileTypeImpl* type);
+  void preloadNextBatch(size_t pos);
+  void dropImageSchemes(FileTypeImpl* type);
   void parseHRC(XmlInputSource* is);
-  void parseHrcBlock(const xercesc::DOMElement* elem);
-  void parseHrcBlockElements(const xercesc::DOMElement* elem);
-  void addPrototype(const xercesc::DOMElement* elem);
-  void parsePrototypeBlock(const xercesc::DOMElement* elem);
-  void addPrototypeLocation(const xercesc::DOMElement* elem);
-  void addPrototypeDetectParam(const xercesc::DOMElement* elem);
-  void addPrototypeParameters(const xercesc::DOMElement* elem);
-  void addType(const xercesc::DOMElement* elem);
-  void parseTypeBlock(const xercesc::DOMElement* elem);
-  void addTypeRegion(const xercesc::DOMElement* elem);
-  void addTypeEntity(const xercesc::DOMElement* elem);
-  void addTypeImport(const xercesc::DOMElement* elem);
-
-  void addScheme(const xercesc::DOMElement* elem);
-  void parseSchemeBlock(SchemeImpl* scheme, const xercesc::DOMElement* elem);
-  void addSchemeNodes(SchemeImpl* scheme, const xercesc::DOMElement* elem);
-  void addSchemeInherit(SchemeImpl* scheme, const xercesc::DOMElement* elem);
-  void addSchemeRegexp(SchemeImpl* scheme, const xercesc::DOMElement* elem);
-  void addSchemeBlock(SchemeImpl* scheme, const xercesc::DOMElement* elem);
-  void addSchemeKeywords(SchemeImpl* scheme, const xercesc::DOMElement* elem);
-  int getSchemeKeywordsCount(const xercesc::DOMElement* elem);
-  void addKeyword(SchemeNode* scheme_node, const Region* brgn, const xercesc::DOMElement* elem);
-  void loadBlockRegions(SchemeNode* node, const xercesc::DOMElement* elem);
-  void loadRegions(SchemeNode* node, const xercesc::DOMElement* elem, bool st);
+  static std::unique_ptr<xercesc::XercesDOMParser> parseDocument(XmlInputSource* is);
+  void compilePending();
+  void finishPending();
+  void startHrc(const HRCNode* root);
+  void addPrototype(const HRCNode* elem);
+  void parsePrototypeBlock(const HRCNode* elem);
+  void addPrototypeLocation(const HRCNode* elem);
+  void addPrototypeDetectParam(const HRCNode* elem);
+  void addPrototypeParameters(const HRCNode* elem);
+  FileTypeImpl* startType(const HRCNode* elem);
+  void endType(FileTypeImpl* type);
+  void addTypeRegion(const HRCNode* elem);
+  void addTypeEntity(const HRCNode* elem);
+  void addTypeImport(const HRCNode* elem);
+
+  SchemeImpl* startScheme(const HRCNode* elem);
+  void addSchemeInherit(SchemeImpl* scheme, const HRCNode* elem);
+  void addSchemeRegexp(SchemeImpl* scheme, const HRCNode* elem);
+  void addSchemeBlock(SchemeImpl* scheme, const HRCNode* elem);
+  void addSchemeKeywords(SchemeImpl* scheme, const HRCNode* elem);
+  int getSchemeKeywordsCount(const HRCNode* elem);
+  void addKeyword(SchemeNode* scheme_node, const Region* brgn, const HRCNode* elem);
+  void loadBlockRegions(SchemeNode* node, const HRCNode* elem);
+  void loadRegions(SchemeNode* node, const HRCNode* elem, bool st);
+  void loadNamedRegions(SchemeNode* node, bool st);
 
   String* qualifyOwnName(const String* name);
   bool checkNameExist(const String* name, FileTypeImpl* parseType, QualifyNameType qntype, bool logErrors);
   String* qualifyForeignName(const String* name, QualifyNameType qntype, bool logErrors);
 
+  void addSchemeLinks(SchemeImpl* scheme, SchemeNode* node);
+  void addSchemeLink(const String* name, const SchemeLink &link);
+  void resolveLinks(FileTypeImpl* type);
   void updateLinks();
+  void updateDispatchIndex();
+  void buildDispatchLists(SchemeImpl* scheme);
   String* useEntities(const String* name);
-  const Region* getNCRegion(const xercesc::DOMElement* elem, const String& tag);
+  std::shared_ptr<CRegExp> getRegExp(const String* pattern, bool moves, CRegExp* backRE, bool deferred = false);
+  const Region* getNCRegion(const HRCNode* elem, const String& tag);
   const Region* getNCRegion(const String* name, bool logErrors);
 };
 
@@ -0,0 +1,358 @@
+#include <xercesc/sax2/Attributes.hpp>
+#include <xercesc/sax2/SAX2XMLReader.hpp>
+#include <xercesc/sax2/XMLReaderFactory.hpp>
+#include <xercesc/util/XMLUni.hpp>
+#include <colorer/parsers/HRCReader.h>
+#include <colorer/parsers/HRCParserImpl.h>
+#include <colorer/xml/XmlParserErrorHandler.h>
+#include <colorer/xml/BaseEntityResolver.h>
+#include <colorer/xml/XmlTagDefs.h>
+#include <colorer/xml/XStr.h>
+
+static const XMLCh emptyString[] = {chNull};
+
+HRCNode::HRCNode(NodeType type, const XMLCh* name): type(type)
+{
+  assign(this->name, name);
+  assign(data, nullptr);
+}
+
+void HRCNode::assign(XmlString &str, const XMLCh* value)
+{
+  if (value == nullptr) {
+    value = emptyString;
+  }
+  str.assign(value, value + xercesc::XMLString::stringLen(value) + 1);
+}
+
+const XMLCh* HRCNode::getAttribute(const XMLCh* name) const
+{
+  for (const auto& attr : attributes) {
+    if (xercesc::XMLString::equals(attr.first.data(), name)) {
+      return attr.second.data();
+    }
+  }
+  return emptyString;
+}
+
+bool HRCNode::hasAttribute(const XMLCh* name) const
+{
+  for (const auto& attr : attributes) {
+    if (xercesc::XMLString::equals(attr.first.data(), name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void HRCNode::setAttribute(const XMLCh* name, const XMLCh* value)
+{
+  attributes.emplace_back();
+  assign(attributes.back().first, name);
+  assign(attributes.back().second, value);
+}
+
+void HRCNode::appendData(const XMLCh* chars, size_t length)
+{
+  data.insert(data.end() - 1, chars, chars + length);
+}
+
+HRCNode* HRCNode::getLastChild() const
+{
+  return children.empty() ? nullptr : children.back().get();
+}
+
+HRCNode* HRCNode::appendChild(std::unique_ptr<HRCNode> node)
+{
+  children.push_back(std::move(node));
+  return children.back().get();
+}
+
+
+HRCReader::HRCReader(HRCParserImpl* hrcParser):
+  hrcParser(hrcParser), entityDepth(0), inCDATA(false)
+{
+}
+
+HRCReader::~HRCReader()
+{
+}
+
+void HRCReader::parse(XmlInputSource* is)
+{
+  std::unique_ptr<xercesc::SAX2XMLReader> xml_reader(xercesc::XMLReaderFactory::createXMLReader());
+  XmlParserErrorHandler error_handler;
+  BaseEntityResolver resolver;
+  // the same document, as the DOM parser builds: no namespaces, no DTD validation
+  xml_reader->setFeature(xercesc::XMLUni::fgSAX2CoreNameSpaces, false);
+  xml_reader->setFeature(xercesc::XMLUni::fgSAX2CoreValidation, false);
+  xml_reader->setFeature(xercesc::XMLUni::fgXercesLoadExternalDTD, false);
+  xml_reader->setFeature(xercesc::XMLUni::fgXercesSkipDTDValidation, true);
+  xml_reader->setContentHandler(this);
+  xml_reader->setLexicalHandler(this);
+  xml_reader->setErrorHandler(&error_handler);
+  xml_reader->setXMLEntityResolver(&resolver);
+  xml_reader->parse(*is->getInputSource());
+  if (error_handler.getSawErrors()) {
+    throw HRCParserException(SString("Error reading hrc file '") + CString(is->getInputSource()->getSystemId()) + "'");
+  }
+}
+
+void HRCReader::parse(const xercesc::DOMDocument* doc)
+{
+  const xercesc::DOMElement* root = doc->getDocumentElement();
+  if (root == nullptr) {
+    throw HRCParserException(SString("Incorrect hrc-file structure. Main '<hrc>' block not found. Current file ") + \
+                             CString(hrcParser->current_input_source->getInputSource()->getSystemId()));
+  }
+  walk(root);
+}
+
+void HRCReader::walk(const xercesc::DOMNode* node)
+{
+  switch (node->getNodeType()) {
+    case xercesc::DOMNode::ELEMENT_NODE: {
+      std::unique_ptr<HRCNode> elem(new HRCNode(HRCNode::ELEMENT_NODE, node->getNodeName()));
+      const xercesc::DOMNamedNodeMap* attrs = node->getAttributes();
+      for (XMLSize_t idx = 0; idx < attrs->getLength(); idx++) {
+        auto* attr = static_cast<const xercesc::DOMAttr*>(attrs->item(idx));
+        elem->setAttribute(attr->getName(), attr->getValue());
+      }
+      openElement(std::move(elem));
+      for (xercesc::DOMNode* child = node->getFirstChild(); child != nullptr; child = child->getNextSibling()) {
+        walk(child);
+      }
+      closeElement();
+      break;
+    }
+    case xercesc::DOMNode::TEXT_NODE: {
+      const XMLCh* text = static_cast<const xercesc::DOMText*>(node)->getData();
+      addText(text, xercesc::XMLString::stringLen(text));
+      break;
+    }
+    case xercesc::DOMNode::CDATA_SECTION_NODE: {
+      const XMLCh* text = static_cast<const xercesc::DOMCDATASection*>(node)->getData();
+      startCDATA();
+      addText(text, xercesc::XMLString::stringLen(text));
+      endCDATA();
+      break;
+    }
+    case xercesc::DOMNode::ENTITY_REFERENCE_NODE:
+      startEntity(node->getNodeName());
+      for (xercesc::DOMNode* child = node->getFirstChild(); child != nullptr; child = child->getNextSibling()) {
+        walk(child);
+      }
+      endEntity(node->getNodeName());
+      break;
+    default:
+      addOtherNode();
+      break;
+  }
+}
+
+void HRCReader::startElement(const XMLCh* const uri, const XMLCh* const localname, const XMLCh* const qname,
+                             const xercesc::Attributes &attrs)
+{
+  std::unique_ptr<HRCNode> elem(new HRCNode(HRCNode::ELEMENT_NODE, qname));
+  for (XMLSize_t idx = 0; idx < attrs.getLength(); idx++) {
+    elem->setAttribute(attrs.getQName(idx), attrs.getValue(idx));
+  }
+  openElement(std::move(elem));
+}
+
+void HRCReader::endElement(const XMLCh* const uri, const XMLCh* const localname, const XMLCh* const qname)
+{
+  closeElement();
+}
+
+void HRCReader::characters(const XMLCh* const chars, const XMLSize_t length)
+{
+  addText(chars, length);
+}
+
+void HRCReader::ignorableWhitespace(const XMLCh* const chars, const XMLSize_t length)
+{
+  addText(chars, length);
+}
+
+void HRCReader::processingInstruction(const XMLCh* const target, const XMLCh* const data)
+{
+  addOtherNode();
+}
+
+void HRCReader::comment(const XMLCh* const chars, const XMLSize_t length)
+{
+  addOtherNode();
+}
+
+void HRCReader::startCDATA()
+{
+  if (buffer) {
+    bufferPath.back()->appendChild(std::unique_ptr<HRCNode>(new HRCNode(HRCNode::CDATA_SECTION_NODE)));
+  }
+  inCDATA = true;
+}
+
+void HRCReader::endCDATA()
+{
+  inCDATA = false;
+}
+
+void HRCReader::startEntity(const XMLCh* const name)
+{
+  entityDepth++;
+  if (buffer) {
+    bufferPath.push_back(bufferPath.back()->appendChild(std::unique_ptr<HRCNode>(new HRCNode(HRCNode::ENTITY_REFERENCE_NODE, name))));
+  }
+}
+
+void HRCReader::endEntity(const XMLCh* const name)
+{
+  entityDepth--;
+  if (buffer && bufferPath.size() > 1 && bufferPath.back()->getNodeType() == HRCNode::ENTITY_REFERENCE_NODE) {
+    bufferPath.pop_back();
+  }
+}
+
+void HRCReader::addText(const XMLCh* chars, size_t length)
+{
+  if (!buffer) {
+    return;
+  }
+  // text is appended to the last text node, or to the current CDATA section
+  HRCNode::NodeType type = inCDATA ? HRCNode::CDATA_SECTION_NODE : HRCNode::TEXT_NODE;
+  HRCNode* last = bufferPath.back()->getLastChild();
+  if (last == nullptr || last->getNodeType() != type) {
+    last = bufferPath.back()->appendChild(std::unique_ptr<HRCNode>(new HRCNode(type)));
+  }
+  last->appendData(chars, length);
+}
+
+void HRCReader::addOtherNode()
+{
+  if (buffer) {
+    bufferPath.back()->appendChild(std::unique_ptr<HRCNode>(new HRCNode(HRCNode::OTHER_NODE)));
+  }
+}
+
+void HRCReader::openElement(std::unique_ptr<HRCNode> elem)
+{
+  if (buffer) {
+    bufferPath.push_back(bufferPath.back()->appendChild(std::move(elem)));
+    return;
+  }
+  if (frames.empty()) {
+    hrcParser->startHrc(elem.get());
+    frames.push_back({FT_ROOT, entityDepth, nullptr, nullptr, nullptr});
+    return;
+  }
+
+  const Frame &frame = frames.back();
+  const XMLCh* name = elem->getNodeName();
+  bool buffered = false;
+  switch (frame.type) {
+    case FT_ROOT:
+      // elements of the nested entities are not read
+      if (entityDepth - frame.entityDepth > 1) {
+        break;
+      }
+      if (xercesc::XMLString::equals(name, hrcTagPrototype) || xercesc::XMLString::equals(name, hrcTagPackage)) {
+        buffered = true;
+        break;
+      }
+      if (xercesc::XMLString::equals(name, hrcTagType)) {
+        FileTypeImpl* outerType = hrcParser->parseType;
+        FileTypeImpl* type = hrcParser->startType(elem.get());
+        if (type != nullptr) {
+          frames.push_back({FT_TYPE, entityDepth, type, outerType, nullptr});
+          return;
+        }
+        break;
+      }
+      if (!xercesc::XMLString::equals(name, hrcTagAnnotation)) {
+        spdlog::warn("Unused element '{0}'. Current file {1}.", *XStr(name).get_stdstr(), *XStr(hrcParser->current_input_source->getInputSource()->getSystemId()).get_stdstr());
+      }
+      break;
+    case FT_TYPE:
+      if (xercesc::XMLString::equals(name, hrcTagRegion) || xercesc::XMLString::equals(name, hrcTagEntity) ||
+          xercesc::XMLString::equals(name, hrcTagImport)) {
+        buffered = true;
+        break;
+      }
+      if (xercesc::XMLString::equals(name, hrcTagScheme)) {
+        SchemeImpl* scheme = hrcParser->startScheme(elem.get());
+        if (scheme != nullptr) {
+          frames.push_back({FT_SCHEME, entityDepth, frame.fileType, nullptr, scheme});
+          return;
+        }
+      }
+      break;
+    case FT_SCHEME:
+      buffered = xercesc::XMLString::equals(name, hrcTagInherit) || xercesc::XMLString::equals(name, hrcTagRegexp) ||
+                 xercesc::XMLString::equals(name, hrcTagBlock) || xercesc::XMLString::equals(name, hrcTagKeywords);
+      break;
+    default:
+      break;
+  }
+
+  if (buffered) {
+    buffer = std::move(elem);
+    bufferPath.push_back(buffer.get());
+  } else {
+    frames.push_back({FT_SKIP, entityDepth, nullptr, nullptr, nullptr});
+  }
+}
+
+void HRCReader::closeElement()
+{
+  if (buffer) {
+    if (bufferPath.size() > 1) {
+      bufferPath.pop_back();
+      return;
+    }
+    // the element could load other types, so the buffer is released before
+    std::unique_ptr<HRCNode> elem = std::move(buffer);
+    bufferPath.clear();
+    addBufferedElement(frames.back(), elem.get());
+    return;
+  }
+
+  Frame frame = frames.back();
+  frames.pop_back();
+  if (frame.type == FT_TYPE) {
+    hrcParser->endType(frame.fileType);
+    hrcParser->parseType = frame.outerType;
+  }
+}
+
+void HRCReader::addBufferedElement(const Frame &frame, const HRCNode* elem)
+{
+  const XMLCh* name = elem->getNodeName();
+  switch (frame.type) {
+    case FT_ROOT:
+      hrcParser->addPrototype(elem);
+      break;
+    case FT_TYPE:
+      if (xercesc::XMLString::equals(name, hrcTagRegion)) {
+        hrcParser->addTypeRegion(elem);
+      } else if (xercesc::XMLString::equals(name, hrcTagEntity)) {
+        hrcParser->addTypeEntity(elem);
+      } else {
+        hrcParser->addTypeImport(elem);
+      }
+      break;
+    case FT_SCHEME:
+      if (xercesc::XMLString::equals(name, hrcTagInherit)) {
+        hrcParser->addSchemeInherit(frame.scheme, elem);
+      } else if (xercesc::XMLString::equals(name, hrcTagRegexp)) {
+        hrcParser->addSchemeRegexp(frame.scheme, elem);
+      } else if (xercesc::XMLString::equals(name, hrcTagBlock)) {
+        hrcParser->addSchemeBlock(frame.scheme, elem);
+      } else {
+        hrcParser->addSchemeKeywords(frame.scheme, elem);
+      }
+      break;
+    default:
+      break;
+  }
+}
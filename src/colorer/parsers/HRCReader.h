@@ -0,0 +1,146 @@
+#ifndef _COLORER_HRCREADER_H_
+#define _COLORER_HRCREADER_H_
+
+#include <memory>
+#include <vector>
+#include <xercesc/dom/DOM.hpp>
+#include <xercesc/sax2/DefaultHandler.hpp>
+#include <colorer/xml/XmlInputSource.h>
+
+class HRCParserImpl;
+class FileTypeImpl;
+class SchemeImpl;
+
+/**
+ * Node of the HRC element, buffered by HRCReader.
+ * Element keeps its attributes and content nodes in the same structure,
+ * as DOM does: text is split by the other nodes, entity references are
+ * kept as nodes with the content of the entity.
+ * @ingroup colorer_parsers
+ */
+class HRCNode
+{
+public:
+  enum NodeType { ELEMENT_NODE, TEXT_NODE, CDATA_SECTION_NODE, ENTITY_REFERENCE_NODE, OTHER_NODE };
+
+  explicit HRCNode(NodeType type, const XMLCh* name = nullptr);
+
+  NodeType getNodeType() const;
+  const XMLCh* getNodeName() const;
+  /** @return Value of the attribute, or empty string, if there is no such attribute */
+  const XMLCh* getAttribute(const XMLCh* name) const;
+  bool hasAttribute(const XMLCh* name) const;
+  void setAttribute(const XMLCh* name, const XMLCh* value);
+  /** Text of the text and CDATA nodes */
+  const XMLCh* getData() const;
+  void appendData(const XMLCh* chars, size_t length);
+
+  const std::vector<std::unique_ptr<HRCNode>> &getChildNodes() const;
+  HRCNode* getLastChild() const;
+  HRCNode* appendChild(std::unique_ptr<HRCNode> node);
+
+private:
+  // zero terminated string
+  typedef std::vector<XMLCh> XmlString;
+
+  NodeType type;
+  XmlString name;
+  std::vector<std::pair<XmlString, XmlString>> attributes;
+  XmlString data;
+  std::vector<std::unique_ptr<HRCNode>> children;
+
+  static void assign(XmlString &str, const XMLCh* value);
+};
+
+inline HRCNode::NodeType HRCNode::getNodeType() const
+{
+  return type;
+}
+
+inline const XMLCh* HRCNode::getNodeName() const
+{
+  return name.data();
+}
+
+inline const XMLCh* HRCNode::getData() const
+{
+  return data.data();
+}
+
+inline const std::vector<std::unique_ptr<HRCNode>> &HRCNode::getChildNodes() const
+{
+  return children;
+}
+
+/**
+ * Streaming reader of the HRC files.
+ * Reads HRC file with SAX parser and builds prototypes, types and schemes
+ * of HRCParserImpl as their elements are seen. Root, type and scheme elements
+ * are not kept, their child elements (prototypes, regions, entities, scheme nodes)
+ * are buffered into HRCNode trees until their end, and passed to HRCParserImpl.
+ *
+ * Preloaded DOM documents are walked with the same handler, so the database
+ * doesn't depend on the way, the file is read.
+ * @ingroup colorer_parsers
+ */
+class HRCReader : public xercesc::DefaultHandler
+{
+public:
+  explicit HRCReader(HRCParserImpl* hrcParser);
+  ~HRCReader();
+
+  /**
+   * Reads HRC file with SAX parser.
+   * @throw HRCParserException If the file is not well-formed or is not HRC.
+   */
+  void parse(XmlInputSource* is);
+  /**
+   * Reads parsed HRC document.
+   * @throw HRCParserException If the document is not HRC.
+   */
+  void parse(const xercesc::DOMDocument* doc);
+
+  void startElement(const XMLCh* const uri, const XMLCh* const localname, const XMLCh* const qname,
+                    const xercesc::Attributes &attrs) override;
+  void endElement(const XMLCh* const uri, const XMLCh* const localname, const XMLCh* const qname) override;
+  void characters(const XMLCh* const chars, const XMLSize_t length) override;
+  void ignorableWhitespace(const XMLCh* const chars, const XMLSize_t length) override;
+  void processingInstruction(const XMLCh* const target, const XMLCh* const data) override;
+  void comment(const XMLCh* const chars, const XMLSize_t length) override;
+  void startCDATA() override;
+  void endCDATA() override;
+  void startEntity(const XMLCh* const name) override;
+  void endEntity(const XMLCh* const name) override;
+
+private:
+  enum FrameType { FT_ROOT, FT_TYPE, FT_SCHEME, FT_SKIP };
+
+  // opened element, which is not buffered
+  struct Frame {
+    FrameType type;
+    int entityDepth;
+    FileTypeImpl* fileType;
+    FileTypeImpl* outerType;
+    SchemeImpl* scheme;
+  };
+
+  HRCParserImpl* hrcParser;
+  std::vector<Frame> frames;
+  int entityDepth;
+  bool inCDATA;
+  // buffered element and the path to the current node in it
+  std::unique_ptr<HRCNode> buffer;
+  std::vector<HRCNode*> bufferPath;
+
+  void openElement(std::unique_ptr<HRCNode> elem);
+  void closeElement();
+  void addBufferedElement(const Frame &frame, const HRCNode* elem);
+  void addText(const XMLCh* chars, size_t length);
+  void addOtherNode();
+  void walk(const xercesc::DOMNode* node);
+
+  HRCReader(HRCReader const &) = delete;
+  HRCReader &operator=(HRCReader const &) = delete;
+};
+
+#endif
@@ -1,3 +1,4 @@
+#include <map>
 #include <colorer/parsers/KeywordList.h>
 
 KeywordList::KeywordList()
@@ -14,47 +15,60 @@ KeywordList::~KeywordList()
   delete[] kwList;
 }
 
-int kwCompare(const void* e1, const void* e2)
-{
-  return ((KeywordInfo*)e1)->keyword->compareTo(*((KeywordInfo*)e2)->keyword);
-}
-
-int kwCompareI(const void* e1, const void* e2)
-{
-  return ((KeywordInfo*)e1)->keyword->compareToIgnoreCase(*((KeywordInfo*)e2)->keyword);
-}
-
-void KeywordList::sortList()
+/* Builds trie of keywords symbols, for example:
+   get, getPar, gets
+   root -g-> 1 -e-> 2 -t-> 3 (get) -P-> 4 -a-> 5 -r-> 6 (getPar)
+                                   -s-> 7 (gets)
+   Nodes are stored in breadth first order, all edges of a node
+   are stored together, sorted by symbol.
+   If keyword is repeated, the first word and the first symbol are used.
+*/
+void KeywordList::buildTrie()
 {
-  if (num < 2) {
-    return;
+  std::vector<std::map<wchar, int>> children(1);
+  std::vector<int> words(1, -1);
+  std::vector<int> symbols(1, -1);
+  for (int i = 0; i < num; i++) {
+    const SString& keyword = *kwList[i].keyword;
+    int node = 0;
+    for (size_t pos = 0; pos < keyword.length(); pos++) {
+      wchar c = matchCase ? keyword[pos] : Character::toLowerCase(keyword[pos]);
+      auto child = children[node].find(c);
+      if (child == children[node].end()) {
+        children.emplace_back();
+        words.push_back(-1);
+        symbols.push_back(-1);
+        child = children[node].insert(std::make_pair(c, (int)children.size() - 1)).first;
+      }
+      node = child->second;
+    }
+    std::vector<int>& ends = kwList[i].isSymbol ? symbols : words;
+    if (ends[node] == -1) {
+      ends[node] = i;
+    }
   }
 
-  if (matchCase) {
-    qsort((void*)kwList, num, sizeof(KeywordInfo), &kwCompare);
-  } else {
-    qsort((void*)kwList, num, sizeof(KeywordInfo), &kwCompareI);
+  // renumbers nodes in breadth first order
+  std::vector<int> order(1, 0);
+  std::vector<int> index(children.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    index[order[i]] = (int)i;
+    for (auto& child : children[order[i]]) {
+      order.push_back(child.second);
+    }
   }
-}
-
-/* Searches previous elements num with same partial name
-   for example:
-   3: getParameterName  0
-   2: getParameter      0
-   1: getParam          0
-   0: getPar            -1
-*/
-void KeywordList::substrIndex()
-{
-  for (int i = num - 1; i > 0; i--)
-    for (int ii = i - 1; ii != 0; ii--) {
-      if ((*kwList[ii].keyword)[0] != (*kwList[i].keyword)[0]) {
-        break;
-      }
-      if (kwList[ii].keyword->length() < kwList[i].keyword->length() &&
-          CString(kwList[i].keyword.get(), 0, kwList[ii].keyword->length()).equals(kwList[ii].keyword.get())) {
-        kwList[i].ssShorter = ii;
-        break;
-      }
+  trie.resize(order.size());
+  edgeSymbols.clear();
+  edgeNodes.clear();
+  for (size_t i = 0; i < order.size(); i++) {
+    TrieNode& tn = trie[i];
+    tn.word = words[order[i]];
+    tn.symbol = symbols[order[i]];
+    tn.edges = (int)edgeSymbols.size();
+    tn.edgesNum = (int)children[order[i]].size();
+    for (auto& child : children[order[i]]) {
+      edgeSymbols.push_back(child.first);
+      edgeNodes.push_back(index[child.second]);
     }
+  }
 }
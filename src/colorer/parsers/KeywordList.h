@@ -1,23 +1,25 @@
 #ifndef _COLORER_KEYWORDLIST_H_
 #define _COLORER_KEYWORDLIST_H_
 
+#include <vector>
 #include <colorer/Common.h>
 #include <colorer/Region.h>
 #include <colorer/unicode/CharacterClass.h>
+#include <colorer/unicode/Character.h>
 
 /** Information about one parsed keyword.
-    Contains keyword, symbol specifier, region reference
-    and internal optimization field.
+    Contains keyword, symbol specifier and region reference.
     @ingroup colorer_parsers
 */
 struct KeywordInfo {
   std::unique_ptr<const SString> keyword;
   const Region* region;
   bool isSymbol;
-  int  ssShorter;
 };
 
 /** List of keywords.
+    Keywords are searched with the trie, built over
+    keywords symbols (lower cased, if case is ignored).
     @ingroup colorer_parsers
 */
 class KeywordList
@@ -30,12 +32,74 @@ public:
   KeywordInfo* kwList;
   KeywordList();
   ~KeywordList();
-  void sortList();
-  void substrIndex();
 
+  /** Builds keywords trie, called after all the keywords are added. */
+  void buildTrie();
 
+  /** Returns trie node, reached from @c node with symbol @c c,
+      or -1, if there is no such node. Root node is 0.
+  */
+  int nextNode(int node, wchar c) const;
+  /** Does any keyword end in trie @c node. */
+  bool isKeywordEnd(int node) const;
+  /** Returns index of the keyword, which ends in trie @c node, or -1.
+      @param wordBounds Are there word bounds around the keyword,
+             if not, only symbol keywords are returned.
+  */
+  int getKeyword(int node, bool wordBounds) const;
+
+private:
+  struct TrieNode {
+    // first word and symbol keywords, ending in the node
+    int word;
+    int symbol;
+    // range of node's edges, sorted by symbol
+    int edges;
+    int edgesNum;
+  };
+  std::vector<TrieNode> trie;
+  std::vector<wchar> edgeSymbols;
+  std::vector<int> edgeNodes;
 };
 
-#endif //_COLORER_KEYWORDLIST_H_
+inline int KeywordList::nextNode(int node, wchar c) const
+{
+  if (!matchCase) {
+    c = Character::toLowerCase(c);
+  }
+  const TrieNode& tn = trie[node];
+  const wchar* symbols = edgeSymbols.data() + tn.edges;
+  int left = 0;
+  int right = tn.edgesNum;
+  while (left < right) {
+    int mid = (left + right) / 2;
+    if (symbols[mid] < c) {
+      left = mid + 1;
+    } else {
+      right = mid;
+    }
+  }
+  if (left == tn.edgesNum || symbols[left] != c) {
+    return -1;
+  }
+  return edgeNodes[tn.edges + left];
+}
 
+inline bool KeywordList::isKeywordEnd(int node) const
+{
+  return trie[node].word != -1 || trie[node].symbol != -1;
+}
 
+inline int KeywordList::getKeyword(int node, bool wordBounds) const
+{
+  const TrieNode& tn = trie[node];
+  if (!wordBounds || tn.word == -1) {
+    return tn.symbol;
+  }
+  if (tn.symbol == -1 || tn.word < tn.symbol) {
+    return tn.word;
+  }
+  return tn.symbol;
+}
+
+#endif //_COLORER_KEYWORDLIST_H_
@@ -0,0 +1,408 @@
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <colorer/parsers/ParseCacheSnapshot.h>
+
+static const char SNAPSHOT_MAGIC[4] = {'C', 'L', 'R', 'C'};
+// limit of the virtual entries list, protects from the broken snapshots
+static const uint64_t MAX_VIRTUAL_ENTRIES = 0x10000;
+
+static void writeNumber(std::ostream& stream, uint64_t value)
+{
+  while (value >= 0x80) {
+    stream.put(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  stream.put(static_cast<char>(value));
+}
+
+static bool readNumber(std::istream& stream, uint64_t* value)
+{
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int c = stream.get();
+    if (c == std::char_traits<char>::eof()) {
+      return false;
+    }
+    *value |= static_cast<uint64_t>(c & 0x7F) << shift;
+    if (!(c & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// signed values are zigzag encoded, so the small negative ones are short
+static void writeSigned(std::ostream& stream, int value)
+{
+  writeNumber(stream, (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31));
+}
+
+static bool readSigned(std::istream& stream, int* value)
+{
+  uint64_t v;
+  if (!readNumber(stream, &v) || v > 0xFFFFFFFF) {
+    return false;
+  }
+  uint32_t u = static_cast<uint32_t>(v);
+  *value = static_cast<int>((u >> 1) ^ (0 - (u & 1)));
+  return true;
+}
+
+static void writeString(std::ostream& stream, const String* string)
+{
+  size_t len = string ? string->length() : 0;
+  writeNumber(stream, len);
+  for (size_t i = 0; i < len; i++) {
+    writeNumber(stream, (*string)[i]);
+  }
+}
+
+static bool readString(std::istream& stream, SString* string)
+{
+  uint64_t len, c;
+  if (!readNumber(stream, &len)) {
+    return false;
+  }
+  for (uint64_t i = 0; i < len; i++) {
+    if (!readNumber(stream, &c)) {
+      return false;
+    }
+    string->append(static_cast<wchar>(c));
+  }
+  return true;
+}
+
+ParseCacheSnapshot::ParseCacheSnapshot(SchemeImpl* baseScheme_, LineSource* lineSource_)
+  : baseScheme(baseScheme_), lineSource(lineSource_)
+{
+}
+
+void ParseCacheSnapshot::addScheme(SchemeImpl* scheme)
+{
+  if (scheme && schemeIndex.emplace(scheme, schemes.size()).second) {
+    schemes.push_back(scheme);
+  }
+}
+
+void ParseCacheSnapshot::collectSchemes()
+{
+  schemes.clear();
+  schemeIndex.clear();
+  nodeIndex.clear();
+  virtualIndex.clear();
+  addScheme(baseScheme);
+  // schemes are added to the end of the list, while it is scanned
+  for (size_t idx = 0; idx < schemes.size(); idx++) {
+    SchemeImpl* scheme = schemes[idx];
+    for (size_t no = 0; no < scheme->nodes.size(); no++) {
+      SchemeNode* node = scheme->nodes[no];
+      nodeIndex[node] = NodeRef{idx, no};
+      if (node->type == SchemeNode::SNT_SCHEME || node->type == SchemeNode::SNT_INHERIT) {
+        addScheme(node->scheme);
+      }
+      if (node->type == SchemeNode::SNT_INHERIT) {
+        virtualIndex[&node->virtualEntryVector] = NodeRef{idx, no};
+        for (auto ve : node->virtualEntryVector) {
+          addScheme(ve->virtScheme);
+          addScheme(ve->substScheme);
+        }
+      }
+    }
+  }
+}
+
+uint64_t ParseCacheSnapshot::textHash(int endLine)
+{
+  // FNV-1a over the line lengths and symbols
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  for (int lno = 0; lno <= endLine; lno++) {
+    SString* line = lineSource->getLine(lno);
+    if (line == nullptr) {
+      return 0;
+    }
+    size_t len = line->length();
+    hash = (hash ^ len) * 0x100000001B3ULL;
+    for (size_t i = 0; i < len; i++) {
+      hash = (hash ^ (*line)[i]) * 0x100000001B3ULL;
+    }
+  }
+  return hash;
+}
+
+bool ParseCacheSnapshot::write(std::ostream& stream, const String* key, const ParseCache* root, int endLine)
+{
+  if (baseScheme == nullptr || lineSource == nullptr || endLine < 0) {
+    return false;
+  }
+  uint64_t hash = textHash(endLine);
+  if (hash == 0) {
+    return false;
+  }
+  collectSchemes();
+
+  stream.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+  writeNumber(stream, FORMAT_VERSION);
+  writeString(stream, key);
+  writeNumber(stream, endLine);
+  for (int i = 0; i < 8; i++) {
+    stream.put(static_cast<char>(hash >> (i * 8)));
+  }
+  writeNumber(stream, schemes.size());
+  for (auto scheme : schemes) {
+    writeString(stream, scheme->getName());
+    writeNumber(stream, scheme->nodes.size());
+  }
+
+  size_t count = root->childrenAfter(endLine + 1);
+  writeNumber(stream, count);
+  int prevLine = 0;
+  for (size_t idx = 0; idx < count; idx++) {
+    prevLine = writeEntry(stream, root->children[idx], prevLine, endLine);
+    if (prevLine == -1) {
+      return false;
+    }
+  }
+  return stream.good();
+}
+
+int ParseCacheSnapshot::writeEntry(std::ostream& stream, const ParseCache* entry, int prevLine, int endLine)
+{
+  int eline = entry->eline > endLine + 1 ? endLine + 1 : entry->eline;
+  // entries of the schemes, unreachable from the base one, can't be referenced
+  auto scheme = schemeIndex.find(entry->scheme);
+  auto clender = nodeIndex.find(entry->clender);
+  if (scheme == schemeIndex.end() || clender == nodeIndex.end()) {
+    return -1;
+  }
+  writeNumber(stream, scheme->second);
+  writeNumber(stream, clender->second.scheme);
+  writeNumber(stream, clender->second.node);
+  writeNumber(stream, entry->sline - prevLine);
+  writeNumber(stream, eline - entry->sline);
+
+  const SMatches& match = entry->matchstart;
+  writeNumber(stream, match.cMatch);
+  for (int i = 0; i < match.cMatch; i++) {
+    writeSigned(stream, match.s[i]);
+    writeSigned(stream, match.e[i] - match.s[i]);
+  }
+  writeNumber(stream, match.cnMatch);
+  for (int i = 0; i < match.cnMatch; i++) {
+    writeSigned(stream, match.ns[i]);
+    writeSigned(stream, match.ne[i] - match.ns[i]);
+  }
+
+  size_t vcount = 0;
+  while (entry->vcache && entry->vcache[vcount]) {
+    vcount++;
+  }
+  writeNumber(stream, vcount);
+  for (size_t i = 0; i < vcount; i++) {
+    auto inherit = virtualIndex.find(entry->vcache[i]);
+    if (inherit == virtualIndex.end()) {
+      return -1;
+    }
+    writeNumber(stream, inherit->second.scheme);
+    writeNumber(stream, inherit->second.node);
+  }
+
+  size_t count = entry->childrenAfter(endLine + 1);
+  writeNumber(stream, count);
+  prevLine = entry->sline;
+  for (size_t idx = 0; idx < count; idx++) {
+    prevLine = writeEntry(stream, entry->children[idx], prevLine, endLine);
+    if (prevLine == -1) {
+      return -1;
+    }
+  }
+  return eline;
+}
+
+int ParseCacheSnapshot::read(std::istream& stream, const String* key, ParseCache* root, ParseCacheArena* arena)
+{
+  if (baseScheme == nullptr || lineSource == nullptr) {
+    return -1;
+  }
+  char magic[sizeof(SNAPSHOT_MAGIC)];
+  if (!stream.read(magic, sizeof(magic)) || memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0) {
+    return -1;
+  }
+  uint64_t version, endLine;
+  SString readKey;
+  if (!readNumber(stream, &version) || version != FORMAT_VERSION) {
+    return -1;
+  }
+  if (!readString(stream, &readKey) || !(key ? readKey == *key : readKey.length() == 0)) {
+    return -1;
+  }
+  if (!readNumber(stream, &endLine) || endLine >= 0x7FFFFFF) {
+    return -1;
+  }
+  uint64_t hash = 0;
+  for (int i = 0; i < 8; i++) {
+    int c = stream.get();
+    if (c == std::char_traits<char>::eof()) {
+      return -1;
+    }
+    hash |= static_cast<uint64_t>(c & 0xFF) << (i * 8);
+  }
+  if (hash != textHash(static_cast<int>(endLine))) {
+    return -1;
+  }
+
+  collectSchemes();
+  std::unordered_map<const Atom*, SchemeImpl*> schemeNames;
+  for (auto scheme : schemes) {
+    schemeNames.emplace(scheme->schemeName, scheme);
+  }
+  uint64_t count;
+  if (!readNumber(stream, &count)) {
+    return -1;
+  }
+  std::vector<SchemeImpl*> readSchemes;
+  for (uint64_t idx = 0; idx < count; idx++) {
+    SString name;
+    uint64_t nodes;
+    if (!readString(stream, &name) || !readNumber(stream, &nodes)) {
+      return -1;
+    }
+    auto it = schemeNames.find(AtomTable::find(name));
+    if (it == schemeNames.end() || it->second->nodes.size() != nodes) {
+      return -1;
+    }
+    readSchemes.push_back(it->second);
+  }
+
+  if (!readNumber(stream, &count)) {
+    return -1;
+  }
+  // tree is read with the explicit stack, so the depth of the broken
+  // snapshot is limited by its size only
+  struct ReadLevel {
+    ParseCache* entry;
+    uint64_t childrenLeft;
+    int prevLine;
+  };
+  std::vector<ReadLevel> levels;
+  levels.push_back(ReadLevel{root, count, 0});
+  while (!levels.empty()) {
+    ReadLevel& level = levels.back();
+    if (level.childrenLeft == 0) {
+      levels.pop_back();
+      continue;
+    }
+    level.childrenLeft--;
+    if (!readEntry(stream, level.entry, level.prevLine, static_cast<int>(endLine), readSchemes, arena, &count)) {
+      return -1;
+    }
+    ParseCache* entry = level.entry->children.back();
+    level.prevLine = entry->eline;
+    levels.push_back(ReadLevel{entry, count, entry->sline});
+  }
+  return static_cast<int>(endLine);
+}
+
+bool ParseCacheSnapshot::readNode(std::istream& stream, const std::vector<SchemeImpl*>& readSchemes, SchemeNode** node)
+{
+  uint64_t sidx, nidx;
+  if (!readNumber(stream, &sidx) || sidx >= readSchemes.size()) {
+    return false;
+  }
+  if (!readNumber(stream, &nidx) || nidx >= readSchemes[sidx]->nodes.size()) {
+    return false;
+  }
+  *node = readSchemes[sidx]->nodes[nidx];
+  return true;
+}
+
+bool ParseCacheSnapshot::readEntry(std::istream& stream, ParseCache* parent, int prevLine, int endLine,
+                                   const std::vector<SchemeImpl*>& readSchemes, ParseCacheArena* arena,
+                                   uint64_t* childrenCount)
+{
+  uint64_t sidx, sline, lines;
+  SchemeNode* clender;
+  if (!readNumber(stream, &sidx) || sidx >= readSchemes.size()) {
+    return false;
+  }
+  if (!readNode(stream, readSchemes, &clender) || clender->type != SchemeNode::SNT_SCHEME) {
+    return false;
+  }
+  if (!readNumber(stream, &sline) || !readNumber(stream, &lines)) {
+    return false;
+  }
+  sline += prevLine;
+  if (sline < 1 || sline + lines > static_cast<uint64_t>(endLine) + 1 ||
+      sline + lines > static_cast<uint64_t>(parent->eline)) {
+    return false;
+  }
+  SString* line = lineSource->getLine(static_cast<size_t>(sline - 1));
+  if (line == nullptr) {
+    return false;
+  }
+
+  ParseCache* entry = arena->newCache();
+  parent->children.push_back(entry);
+  entry->parent = parent;
+  entry->sline = static_cast<int>(sline);
+  entry->eline = static_cast<int>(sline + lines);
+  entry->scheme = readSchemes[sidx];
+  entry->clender = clender;
+  arena->copyLine(entry->sline - 1, line, &entry->backLine);
+
+  // positions of the unused matches are kept unset
+  SMatches& match = entry->matchstart;
+  for (int i = 0; i < MATCHES_NUM; i++) {
+    match.s[i] = match.e[i] = -1;
+  }
+  for (int i = 0; i < NAMED_MATCHES_NUM; i++) {
+    match.ns[i] = match.ne[i] = -1;
+  }
+  int len = static_cast<int>(entry->backLine.length());
+  uint64_t mcount;
+  if (!readNumber(stream, &mcount) || mcount > MATCHES_NUM) {
+    return false;
+  }
+  match.cMatch = static_cast<int>(mcount);
+  for (int i = 0; i < match.cMatch; i++) {
+    int s, l;
+    if (!readSigned(stream, &s) || !readSigned(stream, &l) || s < -1 || s > len || l < -len - 1 || s + l > len) {
+      return false;
+    }
+    match.s[i] = s;
+    match.e[i] = s + l;
+  }
+  if (!readNumber(stream, &mcount) || mcount > NAMED_MATCHES_NUM) {
+    return false;
+  }
+  match.cnMatch = static_cast<int>(mcount);
+  for (int i = 0; i < match.cnMatch; i++) {
+    int s, l;
+    if (!readSigned(stream, &s) || !readSigned(stream, &l) || s < -1 || s > len || l < -len - 1 || s + l > len) {
+      return false;
+    }
+    match.ns[i] = s;
+    match.ne[i] = s + l;
+  }
+
+  uint64_t vcount;
+  if (!readNumber(stream, &vcount) || vcount > MAX_VIRTUAL_ENTRIES) {
+    return false;
+  }
+  if (vcount) {
+    entry->vcache = arena->newVirtualEntries(static_cast<size_t>(vcount));
+    for (uint64_t i = 0; i <= vcount; i++) {
+      entry->vcache[i] = nullptr;
+    }
+    for (uint64_t i = 0; i < vcount; i++) {
+      SchemeNode* inherit;
+      if (!readNode(stream, readSchemes, &inherit) || inherit->type != SchemeNode::SNT_INHERIT ||
+          inherit->virtualEntryVector.empty()) {
+        return false;
+      }
+      entry->vcache[i] = &inherit->virtualEntryVector;
+    }
+  }
+
+  return readNumber(stream, childrenCount);
+}
@@ -0,0 +1,75 @@
+#ifndef _COLORER_PARSECACHESNAPSHOT_H_
+#define _COLORER_PARSECACHESNAPSHOT_H_
+
+#include <cstdint>
+#include <iosfwd>
+#include <unordered_map>
+#include <colorer/parsers/TextParserHelpers.h>
+
+/**
+ * Binary snapshot of the parse cache tree.
+ * Snapshot keeps the cache entries with their line ranges, start RE matches
+ * and virtual entries. Schemes are referenced by their names, scheme nodes -
+ * by their positions in the schemes, so the snapshot could be used with the same
+ * HRC only. Snapshot is bound to the text by the hash of the cached lines,
+ * lines of the start REs are not stored and taken from the text on load.
+ *
+ * All integers are written as variable length numbers,
+ * line numbers are stored relative to the previous entry.
+ * @ingroup colorer_parsers
+ */
+class ParseCacheSnapshot
+{
+public:
+  /**
+   * @param baseScheme Root scheme of the cache
+   * @param lineSource Text of the cache
+   */
+  ParseCacheSnapshot(SchemeImpl* baseScheme, LineSource* lineSource);
+
+  /**
+   * Writes cache tree of lines up to @c endLine.
+   * Entries, continued after the last line, end at the next one.
+   * @param key Identification of the HRC and the file type
+   * @return false, if the text lines are not available, the cache references
+   *         schemes, unreachable from the base one, or the stream has failed
+   */
+  bool write(std::ostream& stream, const String* key, const ParseCache* root, int endLine);
+  /**
+   * Reads cache tree into the empty root entry.
+   * @return Last line, covered by the read cache, or -1, if the snapshot
+   *         is made for another text, key, HRC, or the stream is broken.
+   *         In this case read entries are left in the root and must be cleared.
+   */
+  int read(std::istream& stream, const String* key, ParseCache* root, ParseCacheArena* arena);
+
+private:
+  static const unsigned int FORMAT_VERSION = 1;
+
+  struct NodeRef {
+    size_t scheme;
+    size_t node;
+  };
+
+  SchemeImpl* baseScheme;
+  LineSource* lineSource;
+  // schemes, reachable from the base scheme, in the order of their search
+  std::vector<SchemeImpl*> schemes;
+  std::unordered_map<const SchemeImpl*, size_t> schemeIndex;
+  std::unordered_map<const SchemeNode*, NodeRef> nodeIndex;
+  std::unordered_map<const VirtualEntryVector*, NodeRef> virtualIndex;
+
+  void collectSchemes();
+  void addScheme(SchemeImpl* scheme);
+  uint64_t textHash(int endLine);
+
+  // returns the written end line of the entry, -1 if the entry can't be written
+  int writeEntry(std::ostream& stream, const ParseCache* entry, int prevLine, int endLine);
+  // reads the entry into the parent's children, except its own children
+  bool readEntry(std::istream& stream, ParseCache* parent, int prevLine, int endLine,
+                 const std::vector<SchemeImpl*>& readSchemes, ParseCacheArena* arena,
+                 uint64_t* childrenCount);
+  bool readNode(std::istream& stream, const std::vector<SchemeImpl*>& readSchemes, SchemeNode** node);
+};
+
+#endif
@@ -1,5 +1,6 @@
 #include <cstdio>
 #include <cstdlib>
+#include <fstream>
 #ifdef __unix__
 #include <dirent.h>
 #include <sys/stat.h>
@@ -26,14 +27,11 @@
 
 ParserFactory::ParserFactory(): hrc_parser(new HRCParserImpl())
 {
-  RegExpStack = nullptr;
-  RegExpStack_Size = 0;
 }
 
 ParserFactory::~ParserFactory()
 {
   delete hrc_parser;
-  delete[] RegExpStack;
 }
 
 SString ParserFactory::searchCatalog() const
@@ -142,7 +140,7 @@ void ParserFactory::getPossibleCatalogPaths(std::vector<SString> &paths) const
 }
 #endif
 
-void ParserFactory::loadCatalog(const String* catalog_path)
+void ParserFactory::loadCatalog(const String* catalog_path, const String* hrc_image)
 {
   if (!catalog_path) {
     base_catalog_path = searchCatalog();
@@ -155,7 +153,15 @@ void ParserFactory::loadCatalog(const String* catalog_path)
 
 
   parseCatalog(base_catalog_path);
+  if (hrc_image != nullptr) {
+    if (hrc_parser->loadImage(hrc_image)) {
+      spdlog::debug("hrc image '{0}' loaded", hrc_image->getChars());
+      return;
+    }
+    spdlog::warn("Can't load hrc image '{0}', hrc files are used", hrc_image->getChars());
+  }
   spdlog::debug("begin load hrc files");
+  std::vector<uXmlInputSource> sources;
   for (auto location : hrc_locations) {
     try {
       spdlog::debug("try load '{0}'", location.getChars());
@@ -164,26 +170,43 @@ void ParserFactory::loadCatalog(const String* catalog_path)
         std::vector<SString> paths;
         XmlInputSource::getFileFromDir(clear_path.get(), paths);
         for (auto files : paths) {
-          loadHrc(&files, &base_catalog_path);
+          sources.push_back(XmlInputSource::newInstance(files.getWChars(), base_catalog_path.getWChars()));
         }
       } else {
-        loadHrc(clear_path.get(), &base_catalog_path);
+        sources.push_back(XmlInputSource::newInstance(clear_path->getWChars(), base_catalog_path.getWChars()));
       }
     } catch (const Exception &e) {
       spdlog::error("{0}", e.what());
     }
   }
 
+  // files are read in parallel, if the parser has load threads, and added in the catalog order
+  std::vector<XmlInputSource*> preload;
+  for (const auto& source : sources) {
+    preload.push_back(source.get());
+  }
+  hrc_parser->preloadSources(preload);
+  for (const auto& source : sources) {
+    loadHrc(source.get());
+  }
+
   spdlog::debug("end load hrc files");
 }
 
-void ParserFactory::loadHrc(const String* hrc_path, const String* base_path) const
+void ParserFactory::saveHrcImage(const String* hrc_image)
+{
+  std::ofstream stream(hrc_image->getChars(), std::ios::binary);
+  if (!stream || !hrc_parser->saveImage(stream)) {
+    throw ParserFactoryException(SString("Can't write hrc image '") + hrc_image + "'");
+  }
+}
+
+void ParserFactory::loadHrc(XmlInputSource* source) const
 {
-  uXmlInputSource dfis = XmlInputSource::newInstance(hrc_path->getWChars(), base_path->getWChars());
   try {
-    hrc_parser->loadSource(dfis.get());
+    hrc_parser->loadSource(source);
   } catch (Exception &e) {
-    spdlog::error("Can't load hrc: {0}", XStr(dfis->getInputSource()->getSystemId()).get_char());
+    spdlog::error("Can't load hrc: {0}", XStr(source->getInputSource()->getSystemId()).get_char());
     spdlog::error("{0}", e.what());
   }
 }
@@ -97,9 +97,16 @@ public:
   /**
   * @param catalog_path Path to catalog.xml file. If null,
   *        standard search method is used.
+  * @param hrc_image Path to the precompiled HRC database image. If it is loaded,
+  *        HRC files of the catalog are not used.
   * @throw ParserFactoryException If can't load specified catalog.
   */
-  void loadCatalog(const String* catalog_path);
+  void loadCatalog(const String* catalog_path, const String* hrc_image = nullptr);
+  /**
+  * Writes precompiled image of the loaded HRC database.
+  * @throw ParserFactoryException If can't write the image.
+  */
+  void saveHrcImage(const String* hrc_image);
   void addHrd(std::unique_ptr<HRDNode> hrd);
 private:
 
@@ -108,7 +115,7 @@ private:
 
   void parseCatalog(const SString &catalog_path);
 
-  void loadHrc(const String* hrc_path, const String* base_path) const;
+  void loadHrc(XmlInputSource* source) const;
 
   SString base_catalog_path;
   std::vector<SString> hrc_locations;
@@ -2,8 +2,10 @@
 #define _COLORER_HRCPARSERPELPERS_H_
 
 #include <vector>
+#include <bitset>
 #include <colorer/cregexp/cregexp.h>
 #include <colorer/Scheme.h>
+#include <colorer/unicode/AtomTable.h>
 #include <colorer/parsers/SchemeNode.h>
 
 
@@ -18,10 +20,18 @@ class SchemeImpl : public Scheme
 {
   friend class HRCParserImpl;
   friend class TextParserImpl;
+  friend class ParseCacheSnapshot;
+  friend class HRCDatabaseImage;
 public:
+  /** Symbol classes of the dispatch index: ASCII symbols
+      are the classes by themselves, then all other symbols
+      and the end of line.
+  */
+  enum { DC_OTHER = 0x80, DC_EOL, DC_NUM };
+
   const String* getName() const
   {
-    return schemeName.get();
+    return schemeName;
   }
 
   FileType* getFileType() const
@@ -29,15 +39,43 @@ public:
     return (FileType*)fileType;
   }
 
+  /** HRC file, which defines this scheme */
+  const String* getSourceLocation() const
+  {
+    return sourceLocation.get();
+  }
+
 
 protected:
-  UString schemeName;
+  const Atom* schemeName;
   std::vector<SchemeNode*> nodes;
   FileTypeImpl* fileType;
+  UString sourceLocation;
+  // dispatch index: for each symbol class the list of nodes
+  // (in original order), which could match at such symbol
+  unsigned char dispatchMap[DC_NUM];
+  std::vector<std::vector<SchemeNode*>> dispatchLists;
+  // symbol classes, where any node of the scheme could match
+  std::bitset<DC_NUM> dispatchSet;
+  bool dispatchReady = false;
+
+  /** Returns nodes, which could match at position @c pos of @c str */
+  const std::vector<SchemeNode*> &getNodes(const String* str, int pos) const
+  {
+    if (dispatchLists.empty()) {
+      return nodes;
+    }
+    int dc = DC_EOL;
+    if (pos < (int)str->length()) {
+      wchar c = (*str)[pos];
+      dc = c < DC_OTHER ? c : DC_OTHER;
+    }
+    return dispatchLists[dispatchMap[dc]];
+  }
 
   SchemeImpl(const String* sn)
   {
-    schemeName.reset(new SString(sn));
+    schemeName = AtomTable::intern(*sn);
     fileType = nullptr;
   }
 
@@ -3,6 +3,29 @@
 
 const char* schemeNodeTypeNames[] = { "EMPTY", "RE", "SCHEME", "KEYWORDS", "INHERIT" };
 
+SearchProfile::SearchProfile()
+{
+  reset();
+}
+
+void SearchProfile::add(bool matched, int searchSteps, long long searchTime)
+{
+  attempts.fetch_add(1, std::memory_order_relaxed);
+  if (matched) {
+    matches.fetch_add(1, std::memory_order_relaxed);
+  }
+  steps.fetch_add(searchSteps, std::memory_order_relaxed);
+  time.fetch_add(searchTime, std::memory_order_relaxed);
+}
+
+void SearchProfile::reset()
+{
+  attempts = 0;
+  matches = 0;
+  steps = 0;
+  time = 0;
+}
+
 SchemeNode::SchemeNode()
 {
   virtualEntryVector.reserve(5);
@@ -13,7 +36,10 @@ SchemeNode::SchemeNode()
   worddiv = nullptr;
   start = nullptr;
   end = nullptr;
+  innerRegion = false;
   lowPriority = 0;
+  lowContentPriority = false;
+  stepLimitHits = 0;
 
   //!!regions cleanup
   region = nullptr;
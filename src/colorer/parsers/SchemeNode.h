@@ -2,6 +2,7 @@
 #define _COLORER_SCHEMENODE_H_
 
 #include <vector>
+#include <atomic>
 #include <colorer/Common.h>
 #include <colorer/Region.h>
 #include <colorer/parsers/KeywordList.h>
@@ -17,6 +18,24 @@ typedef std::vector<VirtualEntry*> VirtualEntryVector;
 #define REGIONS_NUM MATCHES_NUM
 #define NAMED_REGIONS_NUM NAMED_MATCHES_NUM
 
+/** Search statistics of the RE or keyword list,
+    collected by the parsers with the profiling turned on.
+    @ingroup colorer_parsers
+*/
+struct SearchProfile
+{
+  std::atomic<long long> attempts;
+  std::atomic<long long> matches;
+  // backtracking steps of the RE matching
+  std::atomic<long long> steps;
+  // search time in nanoseconds
+  std::atomic<long long> time;
+
+  SearchProfile();
+  void add(bool matched, int searchSteps, long long searchTime);
+  void reset();
+};
+
 /** Scheme node.
     @ingroup colorer_parsers
 */
@@ -39,11 +58,17 @@ public:
   const Region* regionsn[NAMED_REGIONS_NUM];
   const Region* regione[REGIONS_NUM];
   const Region* regionen[NAMED_REGIONS_NUM];
-  std::unique_ptr<CRegExp> start;
-  std::unique_ptr<CRegExp> end;
+  // compiled regexps can be shared with other nodes
+  std::shared_ptr<CRegExp> start;
+  std::shared_ptr<CRegExp> end;
   bool innerRegion;
   bool lowPriority;
   bool lowContentPriority;
+  // number of start/end RE matches, stopped by the backtracking step limits
+  mutable std::atomic<int> stepLimitHits;
+  // statistics of the start RE or keyword list, and of the block end RE
+  mutable SearchProfile startProfile;
+  mutable SearchProfile endProfile;
 
 
   SchemeNode();
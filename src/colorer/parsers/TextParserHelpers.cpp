@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <cstring>
+#include <new>
 #include <colorer/parsers/TextParserHelpers.h>
 
 
@@ -5,59 +8,396 @@
 // parser's cache structures
 ParseCache::ParseCache()
 {
-  children = next = prev = parent = nullptr;
-  backLine = nullptr;
+  parent = nullptr;
   vcache = nullptr;
 }
 
 ParseCache::~ParseCache()
 {
   CTRACE(spdlog::trace("[TPCache] ~ParseCache():{0},{1}-{2}", scheme->getName()->getChars(), sline, eline));
-  delete backLine;
-  delete children;
-  prev = nullptr;
+  // children and data are freed by the arena
+}
 
-  while (next) {
-    ParseCache* tmp;
-    tmp = next;
-    while (tmp->next) {
-      tmp = tmp->next;
+ParseCache* ParseCache::searchLine(int ln, ParseCache** cache)
+{
+  ParseCache* tmp = this;
+  *cache = nullptr;
+  if (sline > ln || eline < ln) {
+    return nullptr;
+  }
+  while (true) {
+    CTRACE(spdlog::trace("[TPCache] searchLine() tmp:{0},{1}-{2}", tmp->scheme->getName()->getChars(), tmp->sline, tmp->eline));
+    // children are not overlapped, only the last one,
+    // started before the line, could contain it
+    size_t idx = tmp->childrenAfter(ln);
+    if (idx == 0) {
+      return tmp;
     }
-    while (tmp->prev) {
-      tmp = tmp->prev;
-      delete tmp->next;
-      tmp->next = nullptr;
+    ParseCache* child = tmp->children[idx - 1];
+    if (child->eline < ln) {
+      *cache = child; // last child
+      return tmp;
     }
-    delete next;
-    next = nullptr;
+    tmp = child;
   }
+}
 
-  delete[] vcache;
+size_t ParseCache::childrenAfter(int ln) const
+{
+  auto it = std::upper_bound(children.begin(), children.end(), ln,
+                             [](int l, const ParseCache* child) { return l < child->sline; });
+  return it - children.begin();
 }
 
-ParseCache* ParseCache::searchLine(int ln, ParseCache** cache)
+void ParseCache::dropChildren(const ParseCache* child, ParseCacheArena* arena)
 {
-  ParseCache* r1 = nullptr, *r2 = nullptr, *tmp = this;
-  *cache = nullptr;
-  while (tmp) {
-    CTRACE(spdlog::trace("[TPCache] searchLine() tmp:{0},{1}-{2}", tmp->scheme->getName()->getChars(), tmp->sline, tmp->eline));
-    if (tmp->sline <= ln && tmp->eline >= ln) {
-	  if (tmp->children) {
-		r1 = tmp->children->searchLine(ln, &r2);
-	  }
-      if (r1) {
-        *cache = r2;
-        return r1;
+  size_t idx = 0;
+  if (child) {
+    idx = childrenAfter(child->sline);
+    while (idx > 0 && children[idx - 1] != child) {
+      idx--;
+    }
+  }
+  for (size_t i = idx; i < children.size(); i++) {
+    arena->freeCache(children[i]);
+  }
+  children.resize(idx);
+}
+
+/**
+ * New number of the line after lines insertion or deletion.
+ * Deleted lines are moved to the line, which follows them.
+ */
+static int shiftLine(int line, int at, int delta)
+{
+  if (line < at) {
+    return line;
+  }
+  return line + delta < at ? at : line + delta;
+}
+
+void ParseCache::shiftLines(int at, int delta)
+{
+  // entry starts at the line, next to its parent block start
+  sline = shiftLine(sline - 1, at, delta) + 1;
+  eline = shiftLine(eline, at, delta);
+  for (auto child : children) {
+    child->shiftLines(at, delta);
+  }
+}
+
+void ParseCache::deleteLines(int at, int count, ParseCacheArena* arena)
+{
+  size_t kept = 0;
+  for (auto child : children) {
+    // entry with the block start and end inside the deleted lines is dropped
+    if (child->sline - 1 >= at && child->eline < at + count) {
+      arena->freeCache(child);
+      continue;
+    }
+    child->sline = shiftLine(child->sline - 1, at, -count) + 1;
+    child->eline = shiftLine(child->eline, at, -count);
+    child->deleteLines(at, count, arena);
+    children[kept++] = child;
+  }
+  children.resize(kept);
+}
+
+/////////////////////////////////////////////////////////////////////////
+// parser's cache storage
+ParseCacheArena::ParseCacheArena()
+{
+  entriesUsed = ENTRIES_IN_BLOCK;
+  freeEntries = nullptr;
+  dataPos = 0;
+  dataUsed = 0;
+  compactedSize = 0;
+  spareBlock = nullptr;
+  sharedLine = -1;
+  sharedEnd = mark();
+}
+
+ParseCacheArena::~ParseCacheArena()
+{
+  // entries must be already freed with clear()
+  for (auto block : entryBlocks) {
+    ::operator delete(block);
+  }
+  for (auto& block : dataBlocks) {
+    delete[] block.data;
+  }
+  delete[] spareBlock;
+}
+
+ParseCache* ParseCacheArena::newCache()
+{
+  void* slot;
+  if (freeEntries) {
+    slot = freeEntries;
+    freeEntries = *static_cast<void**>(slot);
+  } else {
+    if (entriesUsed == ENTRIES_IN_BLOCK) {
+      entryBlocks.push_back(static_cast<char*>(::operator new(ENTRIES_IN_BLOCK * sizeof(ParseCache))));
+      entriesUsed = 0;
+    }
+    slot = entryBlocks.back() + entriesUsed * sizeof(ParseCache);
+    entriesUsed++;
+  }
+  return new (slot) ParseCache();
+}
+
+void ParseCacheArena::freeCache(ParseCache* entry)
+{
+  for (auto child : entry->children) {
+    freeCache(child);
+  }
+  entry->~ParseCache();
+  *reinterpret_cast<void**>(entry) = freeEntries;
+  freeEntries = entry;
+}
+
+void ParseCacheArena::destroyTree(ParseCache* entry)
+{
+  for (auto child : entry->children) {
+    destroyTree(child);
+  }
+  entry->~ParseCache();
+}
+
+void ParseCacheArena::clear(ParseCache* root)
+{
+  for (auto child : root->children) {
+    destroyTree(child);
+  }
+  root->children.clear();
+  root->vcache = nullptr;
+  root->backLine.buf = nullptr;
+  root->backLine.len = 0;
+
+  // keeps the first blocks for the next generation
+  for (size_t idx = 1; idx < entryBlocks.size(); idx++) {
+    ::operator delete(entryBlocks[idx]);
+  }
+  entryBlocks.resize(entryBlocks.empty() ? 0 : 1);
+  entriesUsed = entryBlocks.empty() ? ENTRIES_IN_BLOCK : 0;
+  freeEntries = nullptr;
+  release(Mark{0, 0, 0});
+  compactedSize = 0;
+}
+
+void* ParseCacheArena::allocData(size_t size)
+{
+  size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+  if (dataBlocks.empty() || dataPos + size > dataBlocks.back().size) {
+    DataBlock block;
+    if (size > DATA_BLOCK_SIZE) {
+      block.data = new char[size];
+      block.size = size;
+    } else if (spareBlock) {
+      block.data = spareBlock;
+      block.size = DATA_BLOCK_SIZE;
+      spareBlock = nullptr;
+    } else {
+      block.data = new char[DATA_BLOCK_SIZE];
+      block.size = DATA_BLOCK_SIZE;
+    }
+    dataBlocks.push_back(block);
+    dataPos = 0;
+  }
+  void* ret = dataBlocks.back().data + dataPos;
+  dataPos += size;
+  dataUsed += size;
+  return ret;
+}
+
+void ParseCacheArena::freeBlock(const DataBlock& block)
+{
+  if (block.size == DATA_BLOCK_SIZE && !spareBlock) {
+    spareBlock = block.data;
+  } else {
+    delete[] block.data;
+  }
+}
+
+void ParseCacheArena::copyLine(int lno, const String* line, LineCopy* copy)
+{
+  size_t len = line->length();
+  if (lno != sharedLine || len != sharedCopy.len) {
+    auto* buf = static_cast<wchar*>(allocData(len * sizeof(wchar)));
+    const wchar* src = line->getWBuffer();
+    if (src) {
+      memcpy(buf, src, len * sizeof(wchar));
+    } else {
+      for (size_t i = 0; i < len; i++) {
+        buf[i] = (*line)[i];
       }
-      *cache = r2; // last child
-      return tmp;
     }
-    if (tmp->sline <= ln) {
-      *cache = tmp;
+    sharedLine = lno;
+    sharedCopy.buf = buf;
+    sharedCopy.len = len;
+    sharedEnd = mark();
+  }
+  copy->buf = sharedCopy.buf;
+  copy->len = sharedCopy.len;
+}
+
+VirtualEntryVector** ParseCacheArena::newVirtualEntries(size_t count)
+{
+  return static_cast<VirtualEntryVector**>(allocData((count + 1) * sizeof(VirtualEntryVector*)));
+}
+
+ParseCacheArena::Mark ParseCacheArena::mark() const
+{
+  return Mark{dataBlocks.size(), dataPos, dataUsed};
+}
+
+void ParseCacheArena::release(const Mark& mark)
+{
+  if (mark.used == dataUsed) {
+    return;
+  }
+  while (dataBlocks.size() > mark.blocks) {
+    freeBlock(dataBlocks.back());
+    dataBlocks.pop_back();
+  }
+  dataPos = mark.pos;
+  dataUsed = mark.used;
+  if (sharedEnd.used > dataUsed) {
+    sharedLine = -1;
+  }
+}
+
+void ParseCacheArena::startParse(ParseCache* root, bool compact)
+{
+  sharedLine = -1;
+  if (!compact || dataUsed <= compactedSize * 2 + DATA_BLOCK_SIZE * 4) {
+    return;
+  }
+  std::vector<DataBlock> old_blocks;
+  old_blocks.swap(dataBlocks);
+  dataPos = 0;
+  dataUsed = 0;
+  LineCopy last_old, last_new;
+  compactTree(root, &last_old, &last_new);
+  for (auto& block : old_blocks) {
+    freeBlock(block);
+  }
+  compactedSize = dataUsed;
+  CTRACE(spdlog::trace("[TPCache] cache data compacted to {0} bytes", dataUsed));
+}
+
+void ParseCacheArena::compactTree(ParseCache* entry, LineCopy* last_old, LineCopy* last_new)
+{
+  if (entry->backLine.buf) {
+    // shared line copies are placed next to each other in the tree
+    if (entry->backLine.buf != last_old->buf || entry->backLine.len != last_old->len) {
+      last_old->buf = entry->backLine.buf;
+      last_old->len = entry->backLine.len;
+      auto* buf = static_cast<wchar*>(allocData(last_old->len * sizeof(wchar)));
+      memcpy(buf, last_old->buf, last_old->len * sizeof(wchar));
+      last_new->buf = buf;
+      last_new->len = last_old->len;
+    }
+    entry->backLine.buf = last_new->buf;
+  }
+  if (entry->vcache) {
+    size_t count = 0;
+    while (entry->vcache[count]) {
+      count++;
+    }
+    VirtualEntryVector** vcache = newVirtualEntries(count);
+    memcpy(vcache, entry->vcache, (count + 1) * sizeof(VirtualEntryVector*));
+    entry->vcache = vcache;
+  }
+  for (auto child : entry->children) {
+    compactTree(child, last_old, last_new);
+  }
+}
+
+void ParseCacheArena::adopt(ParseCacheArena* other)
+{
+  // the current blocks of this storage are kept the last ones
+  size_t entry_pos = entryBlocks.empty() ? 0 : entryBlocks.size() - 1;
+  entryBlocks.insert(entryBlocks.begin() + entry_pos, other->entryBlocks.begin(), other->entryBlocks.end());
+  if (other->freeEntries) {
+    void* tail = other->freeEntries;
+    while (*static_cast<void**>(tail)) {
+      tail = *static_cast<void**>(tail);
+    }
+    *static_cast<void**>(tail) = freeEntries;
+    freeEntries = other->freeEntries;
+  }
+
+  if (dataBlocks.empty()) {
+    dataBlocks = other->dataBlocks;
+    dataPos = other->dataPos;
+  } else {
+    dataBlocks.insert(dataBlocks.end() - 1, other->dataBlocks.begin(), other->dataBlocks.end());
+  }
+  dataUsed += other->dataUsed;
+  compactedSize += other->dataUsed;
+  sharedLine = -1;
+
+  other->entryBlocks.clear();
+  other->entriesUsed = ENTRIES_IN_BLOCK;
+  other->freeEntries = nullptr;
+  other->dataBlocks.clear();
+  other->dataPos = 0;
+  other->dataUsed = 0;
+  other->compactedSize = 0;
+  other->sharedLine = -1;
+  other->sharedEnd = other->mark();
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Parse events log
+void ParseEventLog::clearLine(size_t lno, String* line)
+{
+  events.push_back(Event{EV_CLEAR_LINE, (int)lno, 0, 0, nullptr, nullptr});
+}
+
+void ParseEventLog::addRegion(size_t lno, String* line, int sx, int ex, const Region* region)
+{
+  events.push_back(Event{EV_ADD_REGION, (int)lno, sx, ex, region, nullptr});
+}
+
+void ParseEventLog::enterScheme(size_t lno, String* line, int sx, int ex, const Region* region, const Scheme* scheme)
+{
+  events.push_back(Event{EV_ENTER_SCHEME, (int)lno, sx, ex, region, scheme});
+}
+
+void ParseEventLog::leaveScheme(size_t lno, String* line, int sx, int ex, const Region* region, const Scheme* scheme)
+{
+  events.push_back(Event{EV_LEAVE_SCHEME, (int)lno, sx, ex, region, scheme});
+}
+
+void ParseEventLog::replay(int from, LineSource* lineSource, RegionHandler* handler) const
+{
+  // events are recorded in the order of lines
+  auto it = std::lower_bound(events.begin(), events.end(), from,
+                             [](const Event& ev, int lno) { return ev.lno < lno; });
+  int lno = -1;
+  SString* line = nullptr;
+  for (; it != events.end(); ++it) {
+    if (it->lno != lno) {
+      lno = it->lno;
+      line = lineSource->getLine(lno);
+    }
+    switch (it->type) {
+      case EV_CLEAR_LINE:
+        handler->clearLine(lno, line);
+        break;
+      case EV_ADD_REGION:
+        handler->addRegion(lno, line, it->sx, it->ex, it->region);
+        break;
+      case EV_ENTER_SCHEME:
+        handler->enterScheme(lno, line, it->sx, it->ex, it->region, it->scheme);
+        break;
+      case EV_LEAVE_SCHEME:
+        handler->leaveScheme(lno, line, it->sx, it->ex, it->region, it->scheme);
+        break;
     }
-    tmp = tmp->next;
   }
-  return nullptr;
 }
 
 /////////////////////////////////////////////////////////////////////////
@@ -69,6 +409,7 @@ VTList::VTList()
   last = this;
   shadowlast = nullptr;
   nodesnum = 0;
+  freeItems = nullptr;
 }
 
 VTList::~VTList()
@@ -78,6 +419,32 @@ VTList::~VTList()
   if (!prev && next) {
     next->deltree();
   }
+  while (freeItems) {
+    VTList* item = freeItems;
+    freeItems = item->next;
+    item->next = nullptr;
+    delete item;
+  }
+}
+
+VTList* VTList::newItem()
+{
+  if (!freeItems) {
+    return new VTList();
+  }
+  VTList* item = freeItems;
+  freeItems = item->next;
+  item->vlist = nullptr;
+  item->prev = item->next = item->shadowlast = nullptr;
+  item->last = item;
+  return item;
+}
+
+void VTList::freeItem(VTList* item)
+{
+  item->prev = nullptr;
+  item->next = freeItems;
+  freeItems = item;
 }
 
 void VTList::deltree()
@@ -94,7 +461,7 @@ bool VTList::push(SchemeNode* node)
   if (!node || node->virtualEntryVector.size() == 0) {
     return false;
   }
-  newitem = new VTList();
+  newitem = newItem();
   if (last->next) {
     last->next->prev = newitem;
     newitem->next = last->next;
@@ -117,7 +484,7 @@ bool VTList::pop()
   }
   ditem->prev->next = ditem->next;
   last = ditem->prev;
-  delete ditem;
+  freeItem(ditem);
   nodesnum--;
   return true;
 }
@@ -155,21 +522,24 @@ void VTList::popvirt()
 void VTList::clear()
 {
   nodesnum = 0;
-  if (!prev && next) {
-    next->deltree();
-    next = nullptr;
+  if (!prev) {
+    while (next) {
+      VTList* item = next;
+      next = item->next;
+      freeItem(item);
+    }
   }
   last = this;
 }
 
-VirtualEntryVector** VTList::store()
+VirtualEntryVector** VTList::store(ParseCacheArena* arena)
 {
   VirtualEntryVector** store;
   int i = 0;
   if (!nodesnum || last == this) {
     return nullptr;
   }
-  store = new VirtualEntryVector*[nodesnum + 1];
+  store = arena->newVirtualEntries(nodesnum);
   for (VTList* list = this->next; list; list = list->next) {
     store[i++] = list->vlist;
     if (list == this->last) {
@@ -189,7 +559,7 @@ bool VTList::restore(VirtualEntryVector** store)
 //  nodesnum = store[0].shadowlast;
   prevpos = last = nullptr;
   for (int i = 0; store[i] != nullptr; i++) {
-    pos->next = new VTList;
+    pos->next = newItem();
     prevpos = pos;
     pos = pos->next;
     pos->prev = prevpos;
@@ -200,5 +570,24 @@ bool VTList::restore(VirtualEntryVector** store)
   return true;
 }
 
+/** Checks, if the list has the same virtual entries, as the stored one.
+*/
+bool VTList::isStored(VirtualEntryVector** store)
+{
+  int i = 0;
+  if (nodesnum && last != this) {
+    for (VTList* list = this->next; list; list = list->next) {
+      if (!store || store[i] != list->vlist) {
+        return false;
+      }
+      i++;
+      if (list == this->last) {
+        break;
+      }
+    }
+  }
+  return !store || store[i] == nullptr;
+}
+
 
 
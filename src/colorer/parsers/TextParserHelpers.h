@@ -2,6 +2,8 @@
 #define _COLORER_TEXTPARSERPELPERS_H_
 
 #include <colorer/parsers/HRCParserImpl.h>
+#include <colorer/LineSource.h>
+#include <colorer/RegionHandler.h>
 
 #if !defined COLORERMODE || defined NAMED_MATCHES_IN_HASH
 #error need (COLORERMODE & !NAMED_MATCHES_IN_HASH) in cregexp
@@ -10,9 +12,17 @@
 #define MATCH_NOTHING 0
 #define MATCH_RE 1
 #define MATCH_SCHEME 2
+#define MATCH_SCHEME_ENTER 3
 
 #define LINE_NEXT 0
 #define LINE_REPARSE 1
+#define LINE_NESTED 2
+
+#define VT_NONE 0
+#define VT_PUSHED 1
+#define VT_VIRTUAL 2
+
+class ParseCacheArena;
 
 /** Dynamic parser's list of virtual entries.
     @ingroup colorer_parsers
@@ -22,6 +32,10 @@ class VTList
   VirtualEntryVector* vlist;
   VTList* prev, *next, *last, *shadowlast;
   int nodesnum;
+  // unused list items, kept by the root item for reuse
+  VTList* freeItems;
+  VTList* newItem();
+  void freeItem(VTList* item);
 public:
   VTList();
   ~VTList();
@@ -31,8 +45,36 @@ public:
   SchemeImpl* pushvirt(SchemeImpl* scheme);
   void popvirt();
   void clear();
-  VirtualEntryVector** store();
+  VirtualEntryVector** store(ParseCacheArena* arena);
   bool restore(VirtualEntryVector** store);
+  bool isStored(VirtualEntryVector** store);
+};
+
+/**
+ * Copy of the text line, stored in the parse cache arena.
+ * Copy is shared by all the cache entries, started at the same line.
+ */
+class LineCopy : public String
+{
+public:
+  LineCopy(): buf(nullptr), len(0) {};
+  ~LineCopy() {};
+
+  wchar operator[](size_t i) const override
+  {
+    return buf[i];
+  }
+  size_t length() const override
+  {
+    return len;
+  }
+  const wchar* getWBuffer() const override
+  {
+    return buf;
+  }
+
+  const wchar* buf;
+  size_t len;
 };
 
 /**
@@ -65,12 +107,15 @@ public:
   /**
    * Copy of the line with parent's start RE.
    */
-  SString* backLine;
+  LineCopy backLine;
 
   /**
-   * Tree structure references in parse cache
+   * Tree structure references in parse cache.
+   * Children are sorted by their lines, so the line
+   * is searched with binary search on each level.
    */
-  ParseCache* children, *next, *prev, *parent;
+  std::vector<ParseCache*> children;
+  ParseCache* parent;
   ParseCache();
   ~ParseCache();
   /**
@@ -80,8 +125,196 @@ public:
    * @return       Cache entry, assigned to the specified line number
    */
   ParseCache* searchLine(int ln, ParseCache** cache);
+  /**
+   * Index of the first child, which starts after the specified line.
+   */
+  size_t childrenAfter(int ln) const;
+  /**
+   * Deletes children after the specified one, all children,
+   * if @c child is null.
+   */
+  void dropChildren(const ParseCache* child, ParseCacheArena* arena);
+  /**
+   * Changes line numbers of this entry and all its
+   * children after lines insertion or deletion.
+   * @param at     First inserted or deleted line
+   * @param delta  Number of inserted lines, or negative number of deleted ones
+   */
+  void shiftLines(int at, int delta);
+  /**
+   * Changes line numbers of the children after lines deletion.
+   * Children, which are entirely inside the deleted lines, are freed.
+   * @param at     First deleted line
+   * @param count  Number of deleted lines
+   */
+  void deleteLines(int at, int count, ParseCacheArena* arena);
 };
 
-#endif
+/**
+ * Storage of the parse cache generation.
+ * Cache entries are taken from the pool of fixed size slots,
+ * line copies and virtual entry lists are bump allocated in large blocks.
+ * All the storage is freed at once, when the cache is cleared.
+ * Data of the dropped entries is not freed, it is moved out by
+ * the compaction, when the storage mostly contains such garbage.
+ *
+ * @ingroup colorer_parsers
+ */
+class ParseCacheArena
+{
+public:
+  /** Position in the data storage */
+  struct Mark {
+    size_t blocks;
+    size_t pos;
+    size_t used;
+  };
+
+  ParseCacheArena();
+  ~ParseCacheArena();
+
+  ParseCache* newCache();
+  /** Returns cache entry with all its children into the pool */
+  void freeCache(ParseCache* entry);
+  /** Frees all the cache entries and data, except the root entry */
+  void clear(ParseCache* root);
+
+  /**
+   * Copies text line into the storage. Copy of the same line is
+   * shared, while it is not released.
+   */
+  void copyLine(int lno, const String* line, LineCopy* copy);
+  /** Allocates null terminated list of virtual entries */
+  VirtualEntryVector** newVirtualEntries(size_t count);
+
+  Mark mark() const;
+  /** Frees all the data, allocated after the mark */
+  void release(const Mark& mark);
+
+  /**
+   * Prepares storage for the next parse. Line copies of the previous
+   * parse are not shared anymore, data of the cache tree is compacted,
+   * if requested and the most of the storage is garbage.
+   */
+  void startParse(ParseCache* root, bool compact);
+
+  /**
+   * Takes all the entries and data of another storage. The storage
+   * of the adopted entries is freed together with this one.
+   */
+  void adopt(ParseCacheArena* other);
+private:
+  static const size_t ENTRIES_IN_BLOCK = 256;
+  static const size_t DATA_BLOCK_SIZE = 0x10000;
+
+  struct DataBlock {
+    char* data;
+    size_t size;
+  };
 
+  std::vector<char*> entryBlocks;
+  size_t entriesUsed;
+  void* freeEntries;
+
+  std::vector<DataBlock> dataBlocks;
+  size_t dataPos;
+  size_t dataUsed;
+  // used data size after the last compaction
+  size_t compactedSize;
+  char* spareBlock;
+
+  int sharedLine;
+  LineCopy sharedCopy;
+  Mark sharedEnd;
+
+  void* allocData(size_t size);
+  void freeBlock(const DataBlock& block);
+  void destroyTree(ParseCache* entry);
+  void compactTree(ParseCache* entry, LineCopy* last_old, LineCopy* last_new);
+};
 
+/**
+ * Scheme, which nodes are searched for the match at the current
+ * position. Inherited schemes are searched in the nested frames.
+ * @ingroup colorer_parsers
+ */
+struct SearchFrame {
+  const std::vector<SchemeNode*>* nodes;
+  size_t idx;
+  /** Change of the virtual entries list, made to enter this scheme (VT_*) */
+  int vtChange;
+};
+
+/**
+ * Region handler, which records the parse events, so they could be
+ * passed to another handler later. Events of the speculative parse
+ * are kept, until it is known, which of them are valid.
+ * @ingroup colorer_parsers
+ */
+class ParseEventLog : public RegionHandler
+{
+public:
+  void clearLine(size_t lno, String* line) override;
+  void addRegion(size_t lno, String* line, int sx, int ex, const Region* region) override;
+  void enterScheme(size_t lno, String* line, int sx, int ex, const Region* region, const Scheme* scheme) override;
+  void leaveScheme(size_t lno, String* line, int sx, int ex, const Region* region, const Scheme* scheme) override;
+
+  /**
+   * Passes the recorded events of the lines, starting from @c from,
+   * to the handler. Lines of the events are requested from @c lineSource.
+   */
+  void replay(int from, LineSource* lineSource, RegionHandler* handler) const;
+private:
+  enum EventType { EV_CLEAR_LINE, EV_ADD_REGION, EV_ENTER_SCHEME, EV_LEAVE_SCHEME };
+  struct Event {
+    EventType type;
+    int lno;
+    int sx, ex;
+    const Region* region;
+    const Scheme* scheme;
+  };
+  std::vector<Event> events;
+};
+
+#define LEVEL_LINE 0
+#define LEVEL_SCAN 1
+
+/**
+ * Scheme level in the parser's stack. Level is created for each
+ * block scheme, entered by the parser, and keeps parse state of
+ * the block and the state of the outer level, restored on its end.
+ * @ingroup colorer_parsers
+ */
+struct ParseLevel {
+  /** Block of this level, null for the root scheme */
+  const SchemeNode* block;
+  /** Position in the line parse: LEVEL_LINE - at the start of a line, LEVEL_SCAN - in the line */
+  int state;
+  /** End of the block is found in the current line */
+  bool blockEnd;
+  /** Line length before the content is cut by the block end */
+  int parentLen;
+  /** Line of the last search */
+  int searchLine;
+  /** Search frames of this level start at this index */
+  size_t searchBase;
+  int lowLen, hiLen;
+
+  /** Start RE match of the block and the copy of its line */
+  SMatches match;
+  LineCopy backLine;
+  ParseCacheArena::Mark lineMark;
+  /** Cache entry of the block, if the cache is updated */
+  ParseCache* cacheEntry;
+  int openLine;
+  bool virtualized;
+
+  /** State of the outer level */
+  SchemeImpl* outerScheme;
+  int outerSchemeStart;
+  SMatches outerMatchend;
+  SMatches* outerBackMatch;
+  const String* outerBackLine;
+};
+
+#endif
@@ -1,28 +1,95 @@
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <colorer/parsers/ParseCacheSnapshot.h>
 #include <colorer/parsers/TextParserImpl.h>
 #include <colorer/unicode/Character.h>
-#include <colorer/unicode/DString.h>
+
+/**
+ * Speculative parse of the text chunk in the separate thread.
+ * The chunk is parsed from the root scheme by its own parser,
+ * events and cache are kept for the merge with the main parse.
+ */
+struct ParseWorker : public LineSource {
+  SString* getLine(size_t lno) override
+  {
+    return source->getLine(lno);
+  }
+
+  // start line and the line after the end of the chunk
+  int sline, eline;
+  // lines are requested without startJob/endJob calls
+  LineSource* source;
+  TextParserImpl parser;
+  ParseEventLog log;
+  bool failed;
+  std::thread thread;
+};
+
+/**
+ * Chunks of the parallel parse, merged by the main parser in the order of lines.
+ */
+struct ParallelParse {
+  ~ParallelParse()
+  {
+    // chunks, not reached by the main parse, are not needed anymore
+    for (auto& worker : workers) {
+      if (worker->thread.joinable()) {
+        worker->parser.breakParse();
+        worker->thread.join();
+      }
+    }
+  }
+
+  std::vector<std::unique_ptr<ParseWorker>> workers;
+  size_t next;
+  // first line of the next chunk to merge, -1 - all chunks are merged
+  int mergeLine;
+  int end;
+  // chunk, which cache is checked for the convergence
+  ParseWorker* speculative;
+};
 
 TextParserImpl::TextParserImpl()
 {
   CTRACE(spdlog::trace("[TextParserImpl] constructor"));
+  arena = new ParseCacheArena();
   cache = new ParseCache();
+  convergedLine = -1;
+  parsing = false;
+  parseResult = 0;
   clearCache();
   lineSource = nullptr;
   regionHandler = nullptr;
   picked = nullptr;
   baseScheme = nullptr;
   memset(&matchend, 0, sizeof(SMatches));
+  endBackLine = nullptr;
+  endBackMatch = nullptr;
   maxBlockSize = 1000;
+  matchStepLimit = 0;
+  lineStepLimit = 0;
+  mergedLimitHits = 0;
+  parseThreads = 1;
+  parallel = nullptr;
+  profiling = false;
 }
 
 TextParserImpl::~TextParserImpl()
 {
+  // suspended parse is dropped without notifications
+  if (parsing) {
+    parsing = false;
+    delete vtlist;
+  }
   clearCache();
   delete cache;
+  delete arena;
 }
 
 void TextParserImpl::setFileType(FileType* type)
 {
+  stopParse();
   baseScheme = nullptr;
   if (type != nullptr) {
     baseScheme = (SchemeImpl*)(type->getBaseScheme());
@@ -42,6 +109,199 @@ void TextParserImpl::setRegionHandler(RegionHandler* rh)
 
 int TextParserImpl::parse(int from, int num, TextParseMode mode)
 {
+  if (parseThreads > 1 && mode == TPM_CACHE_UPDATE && num >= PARALLEL_CHUNK_LINES * 2) {
+    return parseParallel(from, num);
+  }
+  startParse(from, num, mode);
+  return parseStep(-1);
+}
+
+/**
+ * Parses the first chunk of the lines in the calling thread, while the
+ * other chunks are parsed speculatively from the root scheme by the workers.
+ * Chunks are merged, when the main parse reaches their start.
+ */
+int TextParserImpl::parseParallel(int from, int num)
+{
+  int chunks = std::min(parseThreads, num / PARALLEL_CHUNK_LINES);
+  // safe points are searched in the cache, before it is updated
+  std::vector<int> lines = splitLines(from, num, chunks);
+
+  startParse(from, num, TPM_CACHE_UPDATE);
+  // update of the cache, which could converge, is not split
+  if (!parsing || !oldCache.empty() || lines.size() < 3) {
+    return parseStep(-1);
+  }
+
+  ParallelParse chunkParse;
+  for (size_t idx = 1; idx < lines.size() - 1; idx++) {
+    auto* worker = new ParseWorker();
+    chunkParse.workers.emplace_back(worker);
+    worker->sline = lines[idx];
+    worker->eline = lines[idx + 1];
+    worker->source = lineSource;
+    worker->failed = false;
+    worker->parser.baseScheme = baseScheme;
+    worker->parser.maxBlockSize = maxBlockSize;
+    worker->parser.setStepLimits(matchStepLimit, lineStepLimit);
+    worker->parser.setProfiling(profiling);
+    worker->parser.setLineSource(worker);
+    worker->parser.setRegionHandler(&worker->log);
+    worker->thread = std::thread([worker]() {
+      try {
+        worker->parser.parse(worker->sline, worker->eline - worker->sline, TPM_CACHE_UPDATE);
+      } catch (...) {
+        // chunk is parsed by the main parser
+        worker->failed = true;
+      }
+    });
+  }
+  chunkParse.next = 0;
+  chunkParse.mergeLine = lines[1];
+  chunkParse.end = from + num;
+  chunkParse.speculative = nullptr;
+
+  parallel = &chunkParse;
+  int result;
+  try {
+    result = parseStep(-1);
+  } catch (...) {
+    parallel = nullptr;
+    throw;
+  }
+  parallel = nullptr;
+  return result;
+}
+
+/**
+ * Splits the lines into chunks of the same size. If the chunk start is
+ * inside the block in the cache of the previous parse, it is moved after
+ * the block end, so the speculative parse from the root scheme is likely
+ * to be valid.
+ */
+std::vector<int> TextParserImpl::splitLines(int from, int num, int chunks)
+{
+  std::vector<int> lines;
+  lines.push_back(from);
+  for (int idx = 1; idx < chunks; idx++) {
+    int line = from + (int)((long long)num * idx / chunks);
+    int limit = from + (int)((long long)num * (idx + 1) / chunks) - PARALLEL_CHUNK_LINES / 2;
+    int safe = line;
+    while (safe <= cacheEndLine && safe < limit) {
+      size_t after = cache->childrenAfter(safe);
+      if (after == 0 || cache->children[after - 1]->eline < safe) {
+        break;
+      }
+      if (cache->children[after - 1]->eline >= limit) {
+        safe = limit;
+        break;
+      }
+      safe = cache->children[after - 1]->eline + 1;
+    }
+    if (safe < limit) {
+      line = safe;
+    }
+    if (line > lines.back()) {
+      lines.push_back(line);
+    }
+  }
+  lines.push_back(from + num);
+  return lines;
+}
+
+/**
+ * Merges the speculative chunk at its first line. If the parser is in the
+ * root scheme, as the worker has supposed, the chunk's events and cache are
+ * taken, and the parse continues after the chunk. Otherwise the chunk's cache
+ * is used as the old cache, and the chunk is parsed until the parser state
+ * converges with it.
+ */
+void TextParserImpl::mergeChunk()
+{
+  ParseWorker* worker = parallel->workers[parallel->next].get();
+  parallel->next++;
+  parallel->mergeLine = parallel->next < parallel->workers.size() ? parallel->workers[parallel->next]->sline : -1;
+  // previous chunk has not converged
+  dropOldCache();
+  parallel->speculative = nullptr;
+
+  worker->thread.join();
+  if (worker->failed) {
+    CTRACE(spdlog::trace("[TextParserImpl] parallel chunk {0} failed", worker->sline));
+    return;
+  }
+  arena->adopt(worker->parser.arena);
+  ParseCache* chunkCache = worker->parser.cache;
+  for (auto child : chunkCache->children) {
+    child->parent = cache;
+  }
+
+  if (parent == cache && levels.size() == 1) {
+    CTRACE(spdlog::trace("[TextParserImpl] parallel chunk {0} is valid", worker->sline));
+    levels.clear();
+    cache->children.insert(cache->children.end(), chunkCache->children.begin(), chunkCache->children.end());
+    chunkCache->children.clear();
+    worker->log.replay(worker->sline, lineSource, regionHandler);
+    mergedLimitHits += worker->parser.getStepLimitHits();
+    resumeAt(worker->eline);
+    return;
+  }
+
+  CTRACE(spdlog::trace("[TextParserImpl] parallel chunk {0} is reparsed", worker->sline));
+  // in the chunk's cache all the current levels are finished before the chunk
+  for (ParseCache* p = parent; p; p = p->parent) {
+    OldCacheLevel level = { p, worker->sline - 1, arena->newCache() };
+    level.tail->scheme = p->scheme;
+    level.tail->sline = p->sline;
+    level.tail->eline = 0x7FFFFFFF;
+    if (p == cache) {
+      level.tail->children.swap(chunkCache->children);
+    }
+    oldCache.push_back(level);
+  }
+  changedLine = worker->sline;
+  cacheEndLine = worker->eline - 1;
+  parallel->speculative = worker;
+}
+
+/**
+ * Takes the rest of the speculative chunk after the line,
+ * where the parser state has converged with it.
+ */
+void TextParserImpl::mergeConverged()
+{
+  ParseWorker* worker = parallel->speculative;
+  int line = convergedLine;
+  CTRACE(spdlog::trace("[TextParserImpl] parallel chunk {0} converged at line {1}", worker->sline, line));
+  spliceCache();
+  dropOldCache();
+  parallel->speculative = nullptr;
+  worker->log.replay(line, lineSource, regionHandler);
+  mergedLimitHits += worker->parser.getStepLimitHits();
+  resumeAt(worker->eline);
+}
+
+/**
+ * Continues the parallel parse from the line, which state is taken from the cache.
+ */
+void TextParserImpl::resumeAt(int line)
+{
+  gy = line;
+  gy2 = parallel->end;
+  gx = 0;
+  len = -1;
+  clearLine = -1;
+  endLine = line - 1;
+  schemeStart = -1;
+  changedLine = 0x7FFFFFFF;
+  parent = cache->searchLine(line, &forward);
+}
+
+void TextParserImpl::startParse(int from, int num, TextParseMode mode)
+{
+  if (parsing) {
+    stopParse();
+  }
   gx = 0;
   gy = from;
   gy2 = from + num;
@@ -51,20 +311,24 @@ int TextParserImpl::parse(int from, int num, TextParseMode mode)
   schemeStart = -1;
   breakParsing = false;
   updateCache = (mode == TPM_CACHE_UPDATE);
+  parseResult = from;
 
   CTRACE(spdlog::trace("[TextParserImpl] parse from={0}, num={1}", from, num));
   /* Check for initial bad conditions */
   if (regionHandler == nullptr) {
-    return from;
+    return;
   }
   if (lineSource == nullptr) {
-    return from;
+    return;
   }
   if (baseScheme == nullptr) {
-    return from;
+    return;
   }
 
   vtlist = new VTList();
+  arena->startParse(cache, updateCache);
+  levels.clear();
+  searchStack.clear();
 
   lineSource->startJob(from);
   regionHandler->startParsing(from);
@@ -84,34 +348,56 @@ int TextParserImpl::parse(int from, int num, TextParseMode mode)
   cachedParent = parent;
   cachedForward = forward;
   CTRACE(spdlog::trace("[TextParserImpl] parse: cache filled"));
+  if (!parent) {
+    delete vtlist;
+    return;
+  }
 
+  /* Old cache is kept, while the parser state could converge with it */
+  if (updateCache && from <= cacheEndLine && changedLine < cacheEndLine) {
+    detachCache();
+  }
+  parsing = true;
+}
 
-  do {
-    if (!forward) {
-      if (!parent) {
-        return from;
-      }
+int TextParserImpl::parseStep(int time)
+{
+  if (!parsing) {
+    return parseResult;
+  }
+  stepLines = 0;
+  stepTimed = time >= 0;
+  if (stepTimed) {
+    stepDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(time);
+  }
+
+  while (true) {
+    if (levels.empty()) {
+      // starts the parse of the next cached level
       if (updateCache) {
-        delete parent->children;
-        parent->children = nullptr;
+        parent->dropChildren(forward, arena);
       }
-    } else {
-      if (updateCache) {
-        delete forward->next;
-        forward->next = nullptr;
+      baseScheme = parent->scheme;
+
+      CTRACE(spdlog::trace("[TextParserImpl] parse: goes into colorize()"));
+      if (parent != cache) {
+        vtlist->restore(parent->vcache);
+        endBackLine = &parent->backLine;
+        endBackMatch = &parent->matchstart;
+        startColorize(parent->clender);
+      } else {
+        startColorize(nullptr);
       }
     }
-    baseScheme = parent->scheme;
-
-    stackLevel = 0;
-    CTRACE(spdlog::trace("[TextParserImpl] parse: goes into colorize()"));
+    if (!colorize()) {
+      if (parallel && gy == parallel->mergeLine) {
+        mergeChunk();
+        continue;
+      }
+      return -1;
+    }
     if (parent != cache) {
-      vtlist->restore(parent->vcache);
-      parent->clender->end->setBackTrace(parent->backLine, &parent->matchstart);
-      colorize(parent->clender->end.get(), parent->clender->lowContentPriority);
       vtlist->clear();
-    } else {
-      colorize(nullptr, false);
     }
 
     if (updateCache) {
@@ -126,28 +412,188 @@ int TextParserImpl::parse(int from, int num, TextParseMode mode)
 
     forward = parent;
     parent = parent->parent;
-  } while (parent);
+    if (!parent) {
+      if (parallel && convergedLine != -1) {
+        mergeConverged();
+        continue;
+      }
+      break;
+    }
+  }
+
+  bool converged = convergedLine != -1;
+  if (converged) {
+    spliceCache();
+  }
+  dropOldCache();
+  if (updateCache) {
+    if (!converged) {
+      cacheEndLine = endLine;
+    }
+    changedLine = 0x7FFFFFFF;
+  }
+  parsing = false;
   regionHandler->endParsing(endLine);
   lineSource->endJob(endLine);
   delete vtlist;
-  return endLine;
+  parseResult = converged ? cacheEndLine : endLine;
+  return parseResult;
 }
 
-void TextParserImpl::clearCache()
+int TextParserImpl::stopParse()
+{
+  if (!parsing) {
+    return -1;
+  }
+  // parse is suspended before the line gy, all the levels are finished on it
+  gy2 = gy;
+  return parseStep(-1);
+}
+
+/**
+ * Detaches the cache tree parts after the parse start line at all
+ * cache levels. They are deleted by the update parse anyway, but now
+ * they are kept for the convergence check.
+ */
+void TextParserImpl::detachCache()
+{
+  ParseCache* f = forward;
+  for (ParseCache* p = parent; p; f = p, p = p->parent) {
+    // detached children are kept in the holder entry
+    OldCacheLevel level = { p, p->eline, arena->newCache() };
+    level.tail->scheme = p->scheme;
+    level.tail->sline = p->sline;
+    level.tail->eline = 0x7FFFFFFF;
+    size_t idx = f ? p->childrenAfter(f->sline) : 0;
+    level.tail->children.assign(p->children.begin() + idx, p->children.end());
+    p->children.resize(idx);
+    oldCache.push_back(level);
+  }
+}
+
+/**
+ * Compares the parser state at the start of current line with the
+ * state, stored in the old cache for this line. States are the same,
+ * if both have the same chains of the scheme levels and the same
+ * virtual entries. In this case the rest of the text is parsed in
+ * the same way, as it was parsed before.
+ */
+bool TextParserImpl::checkConvergence()
+{
+  newChain.clear();
+  oldChain.clear();
+  for (ParseCache* p = parent; p; p = p->parent) {
+    newChain.push_back(p);
+  }
+
+  // deepest detached level, which still contains the line in the old cache
+  int level = 0;
+  while (level < (int)oldCache.size() - 1 && oldCache[level].eline < gy) {
+    level++;
+  }
+  ParseCache* forward_old;
+  ParseCache* deepest = oldCache[level].tail->searchLine(gy, &forward_old);
+  if (deepest == oldCache[level].tail) {
+    deepest = nullptr;
+  }
+
+  for (ParseCache* p = deepest; p && p != oldCache[level].entry; p = p->parent) {
+    oldChain.push_back(p);
+  }
+  for (size_t idx = level; idx < oldCache.size(); idx++) {
+    oldChain.push_back(oldCache[idx].entry);
+  }
+
+  if (newChain.size() != oldChain.size()) {
+    return false;
+  }
+  // levels are compared from the root, the outer levels of the
+  // different states usually differ, while the inner ones could be the same
+  for (size_t idx = newChain.size(); idx-- > 0;) {
+    if (newChain[idx] != oldChain[idx] && !isSameCacheState(newChain[idx], oldChain[idx])) {
+      return false;
+    }
+  }
+  return vtlist->isStored(oldChain[0]->vcache);
+}
+
+bool TextParserImpl::isSameCacheState(const ParseCache* n, const ParseCache* o)
+{
+  if (n->scheme != o->scheme || n->clender != o->clender || n->sline != o->sline) {
+    return false;
+  }
+  const SMatches& nm = n->matchstart;
+  const SMatches& om = o->matchstart;
+  if (nm.cMatch != om.cMatch || nm.cnMatch != om.cnMatch) {
+    return false;
+  }
+  for (int i = 0; i < nm.cMatch; i++) {
+    if (nm.s[i] != om.s[i] || nm.e[i] != om.e[i]) {
+      return false;
+    }
+  }
+  for (int i = 0; i < nm.cnMatch; i++) {
+    if (nm.ns[i] != om.ns[i] || nm.ne[i] != om.ne[i]) {
+      return false;
+    }
+  }
+  // back trace of the end regexp
+  return n->backLine == o->backLine;
+}
+
+/**
+ * Moves the old cache entries after the converged line into the new
+ * cache levels, and restores the old end lines of these levels.
+ */
+void TextParserImpl::spliceCache()
+{
+  for (size_t idx = 0; idx < newChain.size(); idx++) {
+    ParseCache* n = newChain[idx];
+    ParseCache* o = oldChain[idx];
+    ParseCache* list = o;
+    int eline = o->eline;
+    for (auto& level : oldCache) {
+      if (level.entry == o) {
+        list = level.tail;
+        eline = level.eline;
+        break;
+      }
+    }
+
+    size_t after = list->childrenAfter(convergedLine);
+    for (size_t i = after; i < list->children.size(); i++) {
+      list->children[i]->parent = n;
+      n->children.push_back(list->children[i]);
+    }
+    list->children.resize(after);
+    if (n != cache) {
+      n->eline = eline;
+    }
+  }
+  CTRACE(spdlog::trace("[TPCache] cache converged at line {0}", convergedLine));
+}
+
+void TextParserImpl::dropOldCache()
 {
-  ParseCache* tmp, *tmp2;
-  tmp = cache->next;
-  while (tmp) {
-    tmp2 = tmp->next;
-    delete tmp;
-    tmp = tmp2;
+  for (auto& level : oldCache) {
+    arena->freeCache(level.tail);
   }
-  delete cache->children;
-  delete cache->backLine;
-  cache->backLine = nullptr;
+  oldCache.clear();
+  newChain.clear();
+  oldChain.clear();
+  convergedLine = -1;
+}
+
+void TextParserImpl::clearCache()
+{
+  stopParse();
+  dropOldCache();
+  arena->clear(cache);
   cache->sline = 0;
   cache->eline = 0x7FFFFFF;
-  cache->children = cache->parent = cache->next = nullptr;
+  cache->parent = nullptr;
+  cacheEndLine = -1;
+  changedLine = 0x7FFFFFFF;
 }
 
 void TextParserImpl::breakParse()
@@ -217,138 +663,151 @@ void TextParserImpl::leaveScheme(int lno, SMatches* match, const SchemeNode* sch
 
 void TextParserImpl::fillInvisibleSchemes(ParseCache* ch)
 {
-  if (!ch->parent || ch == cache) {
-    return;
+  std::vector<ParseCache*> chain;
+  for (; ch->parent && ch != cache; ch = ch->parent) {
+    chain.push_back(ch);
   }
   /* Fills output stream with valid "pseudo" enterScheme */
-  fillInvisibleSchemes(ch->parent);
-  enterScheme(gy, 0, 0, ch->clender->region);
-  return;
+  for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+    enterScheme(gy, 0, 0, (*it)->clender->region);
+  }
 }
 
 int TextParserImpl::searchKW(const SchemeNode* node, int no, int lowlen, int hilen)
 {
-  if (!node->kwList->num) {
+  const KeywordList* kwList = node->kwList.get();
+  if (!kwList->num) {
     return MATCH_NOTHING;
   }
 
-  if (node->kwList->minKeywordLength + gx > lowlen) {
+  if (kwList->minKeywordLength + gx > lowlen) {
     return MATCH_NOTHING;
   }
-  if (gx < lowlen && !node->kwList->firstChar->inClass((*str)[gx])) {
+  // line symbols are read directly from its buffer
+  const wchar* line = str->getWBuffer();
+  if (gx < lowlen && !kwList->firstChar->inClass(line[gx])) {
     return MATCH_NOTHING;
   }
 
-  int left = 0;
-  int right = node->kwList->num;
-  while (true) {
-    int pos = left + (right - left) / 2;
-    int kwlen = node->kwList->kwList[pos].keyword->length();
-    if (lowlen < gx + kwlen) {
-      kwlen = lowlen - gx;
-    }
-
-    int cr;
-    if (node->kwList->matchCase) {
-      cr = node->kwList->kwList[pos].keyword->compareTo(DString(*str, gx, kwlen));
+  // word bound before keyword is the same for all the words
+  bool badStart = false;
+  if (gx) {
+    if (!node->worddiv) {
+      badStart = Character::isLetterOrDigit(line[gx - 1]) || line[gx - 1] == '_';
     } else {
-      cr = node->kwList->kwList[pos].keyword->compareToIgnoreCase(DString(*str, gx, kwlen));
-    }
-
-    if (cr == 0 && right - left == 1) {
-      bool badbound = false;
-      if (!node->kwList->kwList[pos].isSymbol) {
-        if (!node->worddiv) {
-          if (gx && (Character::isLetterOrDigit((*str)[gx - 1]) || (*str)[gx - 1] == '_')) {
-            badbound = true;
-          }
-          if (gx + kwlen < lowlen &&
-              (Character::isLetterOrDigit((*str)[gx + kwlen]) || (*str)[gx + kwlen] == '_')) {
-            badbound = true;
-          }
-        } else {
-          // custom check for word bound
-          if (gx && !node->worddiv->inClass((*str)[gx - 1])) {
-            badbound = true;
-          }
-          if (gx + kwlen < lowlen &&
-              !node->worddiv->inClass((*str)[gx + kwlen])) {
-            badbound = true;
-          }
-        }
-      }
-      if (!badbound) {
-        CTRACE(spdlog::trace("[TextParserImpl] KW matched. gx={0}, region={1}", gx, node->kwList->kwList[pos].region->getName()->getChars()));
-        addRegion(gy, gx, gx + kwlen, node->kwList->kwList[pos].region);
-        gx += kwlen;
-        return MATCH_RE;
-      }
+      // custom check for word bound
+      badStart = !node->worddiv->inClass(line[gx - 1]);
     }
-    if (right - left == 1) {
-      left = node->kwList->kwList[pos].ssShorter;
-      if (left != -1) {
-        right = left + 1;
-        continue;
-      }
+  }
+
+  // walks the keywords trie, the longest keyword with good bounds is taken
+  int found = -1;
+  int kwlen = 0;
+  int trieNode = 0;
+  for (int pos = gx; pos < lowlen;) {
+    trieNode = kwList->nextNode(trieNode, line[pos]);
+    if (trieNode == -1) {
       break;
     }
-    if (cr == 1) {
-      right = pos;
+    pos++;
+    if (!kwList->isKeywordEnd(trieNode)) {
+      continue;
+    }
+    bool wordBounds = !badStart;
+    if (wordBounds && pos < lowlen) {
+      if (!node->worddiv) {
+        wordBounds = !(Character::isLetterOrDigit(line[pos]) || line[pos] == '_');
+      } else {
+        wordBounds = node->worddiv->inClass(line[pos]);
+      }
     }
-    if (cr == 0 || cr == -1) {
-      left = pos;
+    int kw = kwList->getKeyword(trieNode, wordBounds);
+    if (kw == -1) {
+      continue;
     }
+    found = kw;
+    kwlen = pos - gx;
   }
-  return MATCH_NOTHING;
+
+  if (found == -1) {
+    return MATCH_NOTHING;
+  }
+  CTRACE(spdlog::trace("[TextParserImpl] KW matched. gx={0}, region={1}", gx, kwList->kwList[found].region->getName()->getChars()));
+  addRegion(gy, gx, gx + kwlen, kwList->kwList[found].region);
+  gx += kwlen;
+  return MATCH_RE;
 }
 
 int TextParserImpl::searchRE(SchemeImpl* cscheme, int no, int lowLen, int hiLen)
 {
-  int i, re_result;
-  SchemeImpl* ssubst = nullptr;
-  SMatches match;
-  ParseCache* OldCacheF = nullptr;
-  ParseCache* OldCacheP = nullptr;
-  ParseCache* ResF = nullptr;
-  ParseCache* ResP = nullptr;
+  ParseLevel& level = levels.back();
 
   CTRACE(spdlog::trace("[TextParserImpl] searchRE: entered scheme \"{0}\"", cscheme->getName()->getChars()));
 
   if (!cscheme) {
     return MATCH_NOTHING;
   }
-  for (auto schemeNode : cscheme->nodes) {
-    CTRACE(spdlog::trace("[TextParserImpl] searchRE: processing node:{0}/{1}, type:{2}", idx + 1, cscheme->nodes.size(), schemeNodeTypeNames[schemeNode->type]));
+  level.searchLine = no;
+  level.searchBase = searchStack.size();
+  level.lowLen = lowLen;
+  level.hiLen = hiLen;
+  searchStack.push_back(SearchFrame{&cscheme->getNodes(str, gx), 0, VT_NONE});
+  return continueSearch(level);
+}
+
+/**
+ * Searches the scheme nodes of the level's search frames for the match
+ * at the current position. If the block scheme is matched, the new
+ * level is entered and the search frames are kept, while it is parsed.
+ */
+int TextParserImpl::continueSearch(ParseLevel& level)
+{
+  int i;
+  SMatches match;
+
+  while (searchStack.size() > level.searchBase) {
+    SearchFrame& frame = searchStack.back();
+    if (frame.idx == frame.nodes->size()) {
+      popSearch();
+      continue;
+    }
+    SchemeNode* schemeNode = (*frame.nodes)[frame.idx++];
+    CTRACE(spdlog::trace("[TextParserImpl] searchRE: processing node:{0}/{1}, type:{2}", frame.idx, frame.nodes->size(), schemeNodeTypeNames[schemeNode->type]));
     switch (schemeNode->type) {
       case SchemeNode::SNT_EMPTY: break;
-      case SchemeNode::SNT_INHERIT:
+      case SchemeNode::SNT_INHERIT: {
         if (!schemeNode->scheme) {
           break;
         }
-        ssubst = vtlist->pushvirt(schemeNode->scheme);
+        int vtChange = VT_VIRTUAL;
+        SchemeImpl* ssubst = vtlist->pushvirt(schemeNode->scheme);
         if (!ssubst) {
-          bool b = vtlist->push(schemeNode);
-          re_result = searchRE(schemeNode->scheme, no, lowLen, hiLen);
-          if (b) {
-            vtlist->pop();
-          }
-        } else {
-          re_result = searchRE(ssubst, no, lowLen, hiLen);
-          vtlist->popvirt();
-        }
-        if (re_result != MATCH_NOTHING) {
-          return re_result;
+          vtChange = vtlist->push(schemeNode) ? VT_PUSHED : VT_NONE;
+          ssubst = schemeNode->scheme;
         }
+        searchStack.push_back(SearchFrame{&ssubst->getNodes(str, gx), 0, vtChange});
         break;
+      }
 
-      case SchemeNode::SNT_KEYWORDS:
-        if (searchKW(schemeNode, no, lowLen, hiLen) == MATCH_RE) {
+      case SchemeNode::SNT_KEYWORDS: {
+        std::chrono::steady_clock::time_point start;
+        if (profiling) {
+          start = std::chrono::steady_clock::now();
+        }
+        bool matched = searchKW(schemeNode, level.searchLine, level.lowLen, level.hiLen) == MATCH_RE;
+        if (profiling) {
+          schemeNode->startProfile.add(matched, 0, elapsedTime(start));
+        }
+        if (matched) {
+          dropSearch(level);
           return MATCH_RE;
         }
         break;
+      }
 
       case SchemeNode::SNT_RE:
-        if (!schemeNode->start->parse(str, gx, schemeNode->lowPriority ? lowLen : hiLen, &match, schemeStart)) {
+        reContext.setBackTrace(nullptr, nullptr);
+        if (!matchRE(schemeNode, false, gx, schemeNode->lowPriority ? level.lowLen : level.hiLen, &match)) {
           break;
         }
         CTRACE(spdlog::trace("[TextParserImpl] RE matched. gx={0}", gx));
@@ -364,220 +823,476 @@ int TextParserImpl::searchRE(SchemeImpl* cscheme, int no, int lowLen, int hiLen)
           break;
         }
         gx = match.e[0];
+        dropSearch(level);
         return MATCH_RE;
 
       case SchemeNode::SNT_SCHEME: {
         if (!schemeNode->scheme) {
           break;
         }
-        if (!schemeNode->start->parse(str, gx,
-                                      schemeNode->lowPriority ? lowLen : hiLen, &match, schemeStart)) {
+        reContext.setBackTrace(nullptr, nullptr);
+        if (!matchRE(schemeNode, false, gx,
+                     schemeNode->lowPriority ? level.lowLen : level.hiLen, &match)) {
+          break;
+        }
+        if (match.s[0] == match.e[0] && isEmptyBlockLoop(schemeNode)) {
           break;
         }
 
         CTRACE(spdlog::trace("[TextParserImpl] Scheme matched. gx={0}", gx));
+        enterBlock(schemeNode, &match, level.searchLine);
+        return MATCH_SCHEME_ENTER;
+      }
+    }
+  }
+  return MATCH_NOTHING;
+}
 
-        gx = match.e[0];
-        ssubst = vtlist->pushvirt(schemeNode->scheme);
-        if (!ssubst) {
-          ssubst = schemeNode->scheme;
-        }
+long long TextParserImpl::elapsedTime(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
 
-        auto* backLine = new SString(str);
-        if (updateCache) {
-          ResF = forward;
-          ResP = parent;
-          if (forward) {
-            forward->next = new ParseCache;
-            forward->next->prev = forward;
-            OldCacheF = forward->next;
-            OldCacheP = parent ? parent : forward->parent;
-            parent = forward->next;
-            forward = nullptr;
-          } else {
-            forward = new ParseCache;
-            parent->children = forward;
-            OldCacheF = forward;
-            OldCacheP = parent;
-            parent = forward;
-            forward = nullptr;
-          }
-          OldCacheF->parent = OldCacheP;
-          OldCacheF->sline = gy + 1;
-          OldCacheF->eline = 0x7FFFFFFF;
-          OldCacheF->scheme = ssubst;
-          OldCacheF->matchstart = match;
-          OldCacheF->clender = schemeNode;
-          OldCacheF->backLine = backLine;
-        }
+void TextParserImpl::popSearch()
+{
+  int vtChange = searchStack.back().vtChange;
+  searchStack.pop_back();
+  if (vtChange == VT_PUSHED) {
+    vtlist->pop();
+  } else if (vtChange == VT_VIRTUAL) {
+    vtlist->popvirt();
+  }
+}
 
-        int ogy = gy;
-        bool zeroLength;
+void TextParserImpl::dropSearch(const ParseLevel& level)
+{
+  while (searchStack.size() > level.searchBase) {
+    popSearch();
+  }
+}
 
-        SchemeImpl* o_scheme = baseScheme;
-        int o_schemeStart = schemeStart;
-        SMatches o_matchend = matchend;
-        SMatches* o_match;
-        CString* o_str;
-        schemeNode->end->getBackTrace((const String**)&o_str, &o_match);
+/**
+ * Checks, if the block with empty start RE match is entered again at the
+ * same position. Such a block could be nested infinitely without moving
+ * the parse position.
+ */
+bool TextParserImpl::isEmptyBlockLoop(const SchemeNode* schemeNode)
+{
+  for (auto it = levels.rbegin(); it != levels.rend() && it->block; ++it) {
+    if (it->openLine != gy || it->match.e[0] != gx) {
+      break;
+    }
+    if (it->block == schemeNode) {
+      return true;
+    }
+  }
+  return false;
+}
 
-        baseScheme = ssubst;
-        schemeStart = gx;
-        schemeNode->end->setBackTrace(backLine, &match);
+/**
+ * Pushes the new level for the matched block scheme and
+ * saves the state of the current level.
+ */
+void TextParserImpl::enterBlock(const SchemeNode* schemeNode, SMatches* match, int no)
+{
+  gx = match->e[0];
+  SchemeImpl* ssubst = vtlist->pushvirt(schemeNode->scheme);
+  if (!ssubst) {
+    ssubst = schemeNode->scheme;
+  }
 
-        enterScheme(no, &match, schemeNode);
+  levels.emplace_back();
+  ParseLevel& level = levels.back();
+  level.block = schemeNode;
+  level.state = LEVEL_LINE;
+  level.blockEnd = false;
+  level.match = *match;
+  level.openLine = gy;
+  level.virtualized = ssubst != schemeNode->scheme;
 
-        colorize(schemeNode->end.get(), schemeNode->lowContentPriority);
+  // copy is freed, if the scheme is not cached
+  level.lineMark = arena->mark();
+  arena->copyLine(gy, str, &level.backLine);
+  level.cacheEntry = nullptr;
+  if (updateCache) {
+    // new entry is always the last one on its level
+    ParseCache* entry = arena->newCache();
+    parent->children.push_back(entry);
+    entry->parent = parent;
+    parent = entry;
+    entry->sline = gy + 1;
+    entry->eline = 0x7FFFFFFF;
+    entry->scheme = ssubst;
+    entry->matchstart = *match;
+    entry->clender = schemeNode;
+    entry->backLine.buf = level.backLine.buf;
+    entry->backLine.len = level.backLine.len;
+    level.cacheEntry = entry;
+  }
 
-        if (gy < gy2) {
-          leaveScheme(gy, &matchend, schemeNode);
-        }
-        gx = matchend.e[0];
-        /* (empty-block.test) Check if the consumed scheme is zero-length */
-        zeroLength = (match.s[0] == matchend.e[0] && ogy == gy);
-
-        schemeNode->end->setBackTrace(o_str, o_match);
-        matchend = o_matchend;
-        schemeStart = o_schemeStart;
-        baseScheme = o_scheme;
-
-        if (updateCache) {
-          if (ogy == gy) {
-            delete OldCacheF;
-            if (ResF) {
-              ResF->next = nullptr;
-            } else {
-              ResP->children = nullptr;
-            }
-            forward = ResF;
-            parent = ResP;
-          } else {
-            OldCacheF->eline = gy;
-            OldCacheF->vcache = vtlist->store();
-            forward = OldCacheF;
-            parent = OldCacheP;
-          }
-        } else {
-          delete backLine;
-        }
-        if (ssubst != schemeNode->scheme) {
-          vtlist->popvirt();
-        }
-        /* (empty-block.test) skips block if it has zero length and spread over single line */
-        if (zeroLength) {
-          break;
-        }
+  level.outerScheme = baseScheme;
+  level.outerSchemeStart = schemeStart;
+  level.outerMatchend = matchend;
+  level.outerBackMatch = endBackMatch;
+  level.outerBackLine = endBackLine;
 
-        return MATCH_SCHEME;
-      }
-    }
-  }
-  return MATCH_NOTHING;
+  baseScheme = ssubst;
+  schemeStart = gx;
+  endBackLine = &level.backLine;
+  endBackMatch = &level.match;
+
+  enterScheme(no, &level.match, schemeNode);
+  len = -1;
 }
 
-bool TextParserImpl::colorize(CRegExp* root_end_re, bool lowContentPriority)
+/**
+ * Pops the finished level and continues the outer level
+ * from the point, where its block was matched.
+ */
+void TextParserImpl::leaveBlock()
 {
-  len = -1;
+  ParseLevel& level = levels.back();
+  const SchemeNode* schemeNode = level.block;
+  if (levels.size() == 1) {
+    // root level is finished by the parse loop
+    levels.pop_back();
+    return;
+  }
 
-  /* Direct check for recursion level */
-  if (stackLevel > MAX_RECURSION_LEVEL) {
-    return true;
+  if (gy < gy2) {
+    leaveScheme(gy, &matchend, schemeNode);
   }
-  stackLevel++;
-
-  for (; gy < gy2;) {
-    CTRACE(spdlog::trace("[TextParserImpl] colorize: line no {0}", gy));
-    // clears line at start,
-    // prevents multiple requests on each line
-    if (clearLine != gy) {
-      clearLine = gy;
-      str = lineSource->getLine(gy);
-      if (str == nullptr) {
-        throw Exception(SString("null String passed into the parser: ") + SString(gy));
-      }
-      regionHandler->clearLine(gy, str);
-    }
-    // hack to include invisible regions in start of block
-    // when parsing with cache information
-    if (!invisibleSchemesFilled) {
-      invisibleSchemesFilled = true;
-      fillInvisibleSchemes(parent);
-    }
-    // updates length
-    if (len < 0) {
-      len = str->length();
-    }
-    endLine = gy;
+  gx = matchend.e[0];
+  /* (empty-block.test) Check if the consumed scheme is zero-length */
+  bool zeroLength = (level.match.s[0] == matchend.e[0] && level.openLine == gy);
 
-    // searches for the end of parent block
-    int res = 0;
-    if (root_end_re) {
-      res = root_end_re->parse(str, gx, len, &matchend, schemeStart);
-    }
-    if (!res) {
-      matchend.s[0] = matchend.e[0] = gx + maxBlockSize > len ? len : gx + maxBlockSize;
+  endBackLine = level.outerBackLine;
+  endBackMatch = level.outerBackMatch;
+  matchend = level.outerMatchend;
+  schemeStart = level.outerSchemeStart;
+  baseScheme = level.outerScheme;
+
+  if (updateCache) {
+    ParseCache* entry = level.cacheEntry;
+    parent = entry->parent;
+    if (level.openLine == gy) {
+      parent->children.pop_back();
+      arena->freeCache(entry);
+      arena->release(level.lineMark);
+    } else {
+      entry->eline = gy;
+      entry->vcache = vtlist->store(arena);
     }
+  } else {
+    arena->release(level.lineMark);
+  }
+  if (level.virtualized) {
+    vtlist->popvirt();
+  }
+  levels.pop_back();
 
-    int parent_len = len;
-    /*
-    BUG: <regexp match="/.{3}\M$/" region="def:Error" priority="low"/>
-    $ at the end of current schema
-    */
-    if (lowContentPriority) {
-      len = matchend.s[0];
+  ParseLevel& outer = levels.back();
+  int re_result = MATCH_SCHEME;
+  /* (empty-block.test) skips block if it has zero length and spread over single line */
+  if (zeroLength) {
+    re_result = continueSearch(outer);
+    if (re_result == MATCH_SCHEME_ENTER) {
+      return;
     }
+  } else {
+    dropSearch(outer);
+  }
+  outer.state = checkSearchResult(outer, re_result) ? LEVEL_LINE : LEVEL_SCAN;
+}
 
-    int ret = LINE_NEXT;
-    for (; gx <= matchend.s[0];) { //    '<' or '<=' ???
-      if (breakParsing) {
-        gy = gy2;
-        break;
-      }
-      if (picked != nullptr && gx + 11 <= matchend.s[0] && (*str)[gx] == 'C') {
-        int ci;
-        static char id[] = "fnq%Qtrjhg";
-        for (ci = 0; ci < 10; ci++) if ((*str)[gx + 1 + ci] != id[ci] - 5) {
-            break;
-          }
-        if (ci == 10) {
-          addRegion(gy, gx, gx + 11, picked);
-          gx += 11;
-          continue;
-        }
-      }
-      int oy = gy;
-      int re_result = searchRE(baseScheme, gy, matchend.s[0], matchend.s[0] + maxBlockSize > len ? len : matchend.s[0] + maxBlockSize);
-      if ((re_result == MATCH_SCHEME && (oy != gy || matchend.s[0] < gx)) ||
-          (re_result == MATCH_RE && matchend.s[0] < gx)) {
-        len = -1;
-        ret = LINE_REPARSE;
-        break;
-      }
-      if (oy == gy) {
-        len = parent_len;
+/**
+ * Runs start or end RE of scheme @c node with the parser's matching context,
+ * matches, stopped by the step limits, are counted in the node.
+ */
+bool TextParserImpl::matchRE(const SchemeNode* node, bool blockEnd, int pos, int eol, SMatches* match)
+{
+  CRegExp* re = blockEnd ? node->end.get() : node->start.get();
+  std::chrono::steady_clock::time_point start;
+  if (profiling) {
+    start = std::chrono::steady_clock::now();
+  }
+  bool matched = re->parse(&reContext, str, pos, eol, match, schemeStart);
+  if (profiling) {
+    SearchProfile& profile = blockEnd ? node->endProfile : node->startProfile;
+    profile.add(matched, reContext.getLastSteps(), elapsedTime(start));
+  }
+  if (matched) {
+    return true;
+  }
+  if (reContext.isLimitExceeded()) {
+    node->stepLimitHits++;
+    CTRACE(spdlog::trace("[TextParserImpl] step limit exceeded, line {0}, pos {1}", gy, pos));
+  }
+  return false;
+}
+
+/**
+ * Pushes the root level of the parse for the block,
+ * started before the current position.
+ */
+void TextParserImpl::startColorize(const SchemeNode* block)
+{
+  levels.emplace_back();
+  ParseLevel& root = levels.back();
+  root.block = block;
+  root.state = LEVEL_LINE;
+  root.blockEnd = false;
+  root.openLine = -1;
+  root.virtualized = false;
+  len = -1;
+}
+
+/**
+ * Parses the block, started with startColorize, until its end, or until
+ * the end of the parsed lines. Nested blocks are parsed in the levels
+ * of the explicit stack, so the nesting depth is not limited.
+ * @return false, if the parse step time is over, and the parse is suspended
+ *         before the next line.
+ */
+bool TextParserImpl::colorize()
+{
+  while (!levels.empty()) {
+    ParseLevel& level = levels.back();
+    if (level.state == LEVEL_LINE) {
+      if (clearLine != gy && gy < gy2 && isStepOver()) {
+        return false;
       }
-      if (re_result == MATCH_NOTHING) {
-        gx++;
+      if (!startLine(level)) {
+        leaveBlock();
+        continue;
       }
+      level.state = LEVEL_SCAN;
+    }
+
+    int ret = scanLine(level);
+    if (ret == LINE_NESTED) {
+      continue;
     }
     if (ret == LINE_REPARSE) {
+      level.state = LEVEL_LINE;
       continue;
     }
 
     schemeStart = -1;
-    if (res) {
-      stackLevel--;
-      return true;
+    if (level.blockEnd) {
+      leaveBlock();
+      continue;
     }
     len = -1;
     gy++;
     gx = 0;
+    level.state = LEVEL_LINE;
   }
-  stackLevel--;
   return true;
 }
 
+bool TextParserImpl::isStepOver()
+{
+  // parallel chunk is merged at its first line
+  if (parallel && gy == parallel->mergeLine) {
+    return true;
+  }
+  return stepTimed && stepLines > 0 && std::chrono::steady_clock::now() >= stepDeadline;
+}
+
+/**
+ * Prepares the level for the parse of the current line.
+ * @return false, if the level is finished before the line.
+ */
+bool TextParserImpl::startLine(ParseLevel& level)
+{
+  if (gy >= gy2) {
+    return false;
+  }
+  CTRACE(spdlog::trace("[TextParserImpl] colorize: line no {0}", gy));
+  // clears line at start,
+  // prevents multiple requests on each line
+  if (clearLine != gy) {
+    // stops, when the rest of the text is already parsed into the cache
+    if (!oldCache.empty() && gy > cachedLineNo && gy > changedLine && gy <= cacheEndLine &&
+        checkConvergence()) {
+      convergedLine = gy;
+      gy2 = gy;
+      return false;
+    }
+    clearLine = gy;
+    stepLines++;
+    str = lineSource->getLine(gy);
+    if (str == nullptr) {
+      throw Exception(SString("null String passed into the parser: ") + SString(gy));
+    }
+    regionHandler->clearLine(gy, str);
+    reContext.setStepBudget(lineStepLimit > 0 ? lineStepLimit : -1);
+  }
+  // hack to include invisible regions in start of block
+  // when parsing with cache information
+  if (!invisibleSchemesFilled) {
+    invisibleSchemesFilled = true;
+    fillInvisibleSchemes(parent);
+  }
+  // updates length
+  if (len < 0) {
+    len = str->length();
+  }
+  endLine = gy;
+
+  // searches for the end of parent block
+  level.blockEnd = false;
+  if (level.block && level.block->end) {
+    reContext.setBackTrace(endBackLine, endBackMatch);
+    level.blockEnd = matchRE(level.block, true, gx, len, &matchend);
+  }
+  if (!level.blockEnd) {
+    matchend.s[0] = matchend.e[0] = gx + maxBlockSize > len ? len : gx + maxBlockSize;
+  }
+
+  level.parentLen = len;
+  /*
+  BUG: <regexp match="/.{3}\M$/" region="def:Error" priority="low"/>
+  $ at the end of current schema
+  */
+  if (level.block && level.block->lowContentPriority) {
+    len = matchend.s[0];
+  }
+  return true;
+}
+
+/**
+ * Parses the current line with the level's scheme until the block end.
+ * @return LINE_NEXT, if the line is parsed, LINE_REPARSE, if the line
+ *         should be parsed again, LINE_NESTED, if the nested block is entered.
+ */
+int TextParserImpl::scanLine(ParseLevel& level)
+{
+  for (; gx <= matchend.s[0];) { //    '<' or '<=' ???
+    if (breakParsing) {
+      gy = gy2;
+      break;
+    }
+    if (picked != nullptr && gx + 11 <= matchend.s[0] && (*str)[gx] == 'C') {
+      int ci;
+      static char id[] = "fnq%Qtrjhg";
+      for (ci = 0; ci < 10; ci++) if ((*str)[gx + 1 + ci] != id[ci] - 5) {
+          break;
+        }
+      if (ci == 10) {
+        addRegion(gy, gx, gx + 11, picked);
+        gx += 11;
+        continue;
+      }
+    }
+    int re_result = searchRE(baseScheme, gy, matchend.s[0], matchend.s[0] + maxBlockSize > len ? len : matchend.s[0] + maxBlockSize);
+    if (re_result == MATCH_SCHEME_ENTER) {
+      return LINE_NESTED;
+    }
+    if (checkSearchResult(level, re_result)) {
+      return LINE_REPARSE;
+    }
+  }
+  return LINE_NEXT;
+}
+
+/**
+ * Moves the parse position after the search.
+ * @return true, if the line should be parsed again.
+ */
+bool TextParserImpl::checkSearchResult(ParseLevel& level, int re_result)
+{
+  if ((re_result == MATCH_SCHEME && (level.searchLine != gy || matchend.s[0] < gx)) ||
+      (re_result == MATCH_RE && matchend.s[0] < gx)) {
+    len = -1;
+    return true;
+  }
+  if (level.searchLine == gy) {
+    len = level.parentLen;
+  }
+  if (re_result == MATCH_NOTHING) {
+    gx++;
+  }
+  return false;
+}
+
 void TextParserImpl::setMaxBlockSize(int max_block_size)
 {
   maxBlockSize = max_block_size;
 }
+
+void TextParserImpl::setStepLimits(int match_limit, int line_limit)
+{
+  reContext.setStepLimit(match_limit);
+  matchStepLimit = match_limit;
+  lineStepLimit = line_limit;
+  if (lineStepLimit <= 0) {
+    reContext.setStepBudget(-1);
+  }
+}
+
+int TextParserImpl::getStepLimitHits()
+{
+  return reContext.getLimitHits() + mergedLimitHits;
+}
+
+void TextParserImpl::setParseThreads(int threads)
+{
+  parseThreads = threads;
+}
+
+void TextParserImpl::setProfiling(bool enable)
+{
+  profiling = enable;
+}
+
+void TextParserImpl::setLastChangedLine(int line)
+{
+  changedLine = line;
+}
+
+void TextParserImpl::linesInserted(int at, int count)
+{
+  stopParse();
+  for (auto child : cache->children) {
+    child->shiftLines(at, count);
+  }
+  if (cacheEndLine >= at) {
+    cacheEndLine += count;
+  }
+}
+
+void TextParserImpl::linesDeleted(int at, int count)
+{
+  stopParse();
+  cache->deleteLines(at, count, arena);
+  if (cacheEndLine >= at) {
+    cacheEndLine = cacheEndLine - count < at ? at : cacheEndLine - count;
+  }
+}
+
+bool TextParserImpl::saveCache(std::ostream& stream, const String* key, int lastLine)
+{
+  stopParse();
+  int endLine = lastLine < cacheEndLine ? lastLine : cacheEndLine;
+  if (endLine < 0) {
+    return false;
+  }
+  ParseCacheSnapshot snapshot(baseScheme, lineSource);
+  return snapshot.write(stream, key, cache, endLine);
+}
+
+int TextParserImpl::loadCache(std::istream& stream, const String* key)
+{
+  clearCache();
+  ParseCacheSnapshot snapshot(baseScheme, lineSource);
+  int endLine = snapshot.read(stream, key, cache, arena);
+  if (endLine == -1) {
+    clearCache();
+    return -1;
+  }
+  cache->scheme = baseScheme;
+  cacheEndLine = endLine;
+  return endLine;
+}
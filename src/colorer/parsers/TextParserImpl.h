@@ -1,10 +1,12 @@
 #ifndef _COLORER_TEXTPARSERIMPL_H_
 #define _COLORER_TEXTPARSERIMPL_H_
 
+#include<chrono>
+#include<deque>
 #include<colorer/TextParser.h>
 #include<colorer/parsers/TextParserHelpers.h>
 
-#define MAX_RECURSION_LEVEL 100
+struct ParallelParse;
 
 /**
  * Implementation of TextParser interface.
@@ -25,21 +27,41 @@ public:
   void setRegionHandler(RegionHandler* rh);
 
   int  parse(int from, int num, TextParseMode mode);
+  void startParse(int from, int num, TextParseMode mode);
+  int  parseStep(int time);
+  int  stopParse();
   void breakParse();
   void clearCache();
   void setMaxBlockSize(int max_block_size);
+  void setStepLimits(int match_limit, int line_limit);
+  int  getStepLimitHits();
+  void setParseThreads(int threads);
+  void setProfiling(bool enable);
+  void setLastChangedLine(int line);
+  void linesInserted(int at, int count);
+  void linesDeleted(int at, int count);
+  bool saveCache(std::ostream& stream, const String* key, int lastLine);
+  int  loadCache(std::istream& stream, const String* key);
 private:
   SString* str;
-  int stackLevel;
   int gx, gy, gy2, len;
   int clearLine, endLine, schemeStart;
   SchemeImpl* baseScheme;
 
   bool breakParsing;
+  // parse is started and not finished yet
+  bool parsing;
+  int parseResult;
+  // time limit of the current parse step
+  bool stepTimed;
+  std::chrono::steady_clock::time_point stepDeadline;
+  int stepLines;
   bool first, invisibleSchemesFilled;
   bool drawing, updateCache;
   const Region* picked;
 
+  // storage of the cache entries and their data
+  ParseCacheArena* arena;
   ParseCache* cache;
   ParseCache* parent, *forward;
 
@@ -47,12 +69,50 @@ private:
   ParseCache* cachedParent, *cachedForward;
 
   SMatches matchend;
+  // back trace of the current block's end regexp (\y \Y operators)
+  const String* endBackLine;
+  SMatches* endBackMatch;
+  // matching state for all the regexps, used by this parser
+  CRegExpContext reContext;
   VTList* vtlist;
+  // stack of the entered scheme levels and their search frames
+  std::deque<ParseLevel> levels;
+  std::vector<SearchFrame> searchStack;
 
   LineSource* lineSource;
   RegionHandler* regionHandler;
   // maximum block size of regexp in string line
   int maxBlockSize;
+  // backtracking step limits of the single match and of the text line, 0 - no limit
+  int matchStepLimit;
+  int lineStepLimit;
+  // step limit hits of the parallel chunks, used by this parser
+  int mergedLimitHits;
+
+  // minimum number of lines in the chunk of the parallel parse
+  static const int PARALLEL_CHUNK_LINES = 2048;
+  int parseThreads;
+  // chunks of the current parallel parse
+  ParallelParse* parallel;
+  // search statistics are collected in the scheme nodes
+  bool profiling;
+
+  // last changed line of text, 0x7FFFFFFF - all lines could be changed
+  int changedLine;
+  // last line, covered by the cache
+  int cacheEndLine;
+  // cache level, detached at the start of the update parse:
+  // entry with its old end line and the holder of its old children after the parse start
+  struct OldCacheLevel {
+    ParseCache* entry;
+    int eline;
+    ParseCache* tail;
+  };
+  // detached levels from the start line to the root
+  std::vector<OldCacheLevel> oldCache;
+  // line and cache chains, where the parser state converged with the old cache
+  int convergedLine;
+  std::vector<ParseCache*> newChain, oldChain;
 
   void fillInvisibleSchemes(ParseCache* cache);
   void addRegion(int lno, int sx, int ex, const Region* region);
@@ -63,7 +123,32 @@ private:
 
   int searchKW(const SchemeNode* node, int no, int lowLen, int hiLen);
   int searchRE(SchemeImpl* cscheme, int no, int lowLen, int hiLen);
-  bool colorize(CRegExp* root_end_re, bool lowContentPriority);
+  int continueSearch(ParseLevel& level);
+  void popSearch();
+  void dropSearch(const ParseLevel& level);
+  bool matchRE(const SchemeNode* node, bool blockEnd, int pos, int eol, SMatches* match);
+  static long long elapsedTime(std::chrono::steady_clock::time_point start);
+  bool isEmptyBlockLoop(const SchemeNode* schemeNode);
+  void enterBlock(const SchemeNode* schemeNode, SMatches* match, int no);
+  void leaveBlock();
+  void startColorize(const SchemeNode* block);
+  bool colorize();
+  bool isStepOver();
+  bool startLine(ParseLevel& level);
+  int scanLine(ParseLevel& level);
+  bool checkSearchResult(ParseLevel& level, int re_result);
+
+  int parseParallel(int from, int num);
+  std::vector<int> splitLines(int from, int num, int chunks);
+  void mergeChunk();
+  void mergeConverged();
+  void resumeAt(int line);
+
+  void detachCache();
+  bool checkConvergence();
+  bool isSameCacheState(const ParseCache* n, const ParseCache* o);
+  void spliceCache();
+  void dropOldCache();
 };
 
 #endif
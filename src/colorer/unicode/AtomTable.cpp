@@ -0,0 +1,66 @@
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <colorer/unicode/AtomTable.h>
+
+// lookups share the lock, only the new atoms take it exclusively
+struct Atoms {
+  std::shared_mutex mutex;
+  // atoms by the hash code of their string, so the string is stored only in the atom
+  std::unordered_multimap<size_t, const Atom*> hash;
+  size_t count = 0;
+};
+
+// atoms are referred from the static objects, so the table is never destroyed
+static Atoms &atoms()
+{
+  static auto* table = new Atoms();
+  return *table;
+}
+
+static const Atom* findAtom(const Atoms &table, const String &name, size_t hc)
+{
+  auto range = table.hash.equal_range(hc);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (name.equals(it->second)) {
+      return it->second;
+    }
+  }
+  return nullptr;
+}
+
+const Atom* AtomTable::intern(const String &name)
+{
+  size_t hc = name.hashCode();
+  Atoms &table = atoms();
+  {
+    std::shared_lock<std::shared_mutex> lock(table.mutex);
+    const Atom* atom = findAtom(table, name, hc);
+    if (atom != nullptr) {
+      return atom;
+    }
+  }
+  // atom could be added by another thread between the locks
+  std::unique_lock<std::shared_mutex> lock(table.mutex);
+  const Atom* atom = findAtom(table, name, hc);
+  if (atom == nullptr) {
+    atom = new Atom(name, table.count++);
+    table.hash.emplace(hc, atom);
+  }
+  return atom;
+}
+
+const Atom* AtomTable::find(const String &name)
+{
+  size_t hc = name.hashCode();
+  Atoms &table = atoms();
+  std::shared_lock<std::shared_mutex> lock(table.mutex);
+  return findAtom(table, name, hc);
+}
+
+size_t AtomTable::size()
+{
+  Atoms &table = atoms();
+  std::shared_lock<std::shared_mutex> lock(table.mutex);
+  return table.count;
+}
@@ -0,0 +1,48 @@
+#ifndef _COLORER_ATOMTABLE_H_
+#define _COLORER_ATOMTABLE_H_
+
+#include <colorer/unicode/SString.h>
+
+/**
+ * Interned string.
+ * Equal strings are interned into the same atom, so atoms
+ * are compared and hashed by their addresses.
+ * Atoms are never deleted.
+ * @ingroup unicode
+ */
+class Atom : public SString
+{
+public:
+  /** Sequential number of the atom in the AtomTable */
+  size_t getAtomID() const
+  {
+    return atomID;
+  }
+
+private:
+  friend class AtomTable;
+  Atom(const String &name, size_t id): SString(name), atomID(id) {}
+
+  size_t atomID;
+
+  Atom(Atom const &) = delete;
+  Atom &operator=(Atom const &) = delete;
+};
+
+/**
+ * Global table of the interned strings: region, scheme and type names.
+ * Could be used from several threads.
+ * @ingroup unicode
+ */
+class AtomTable
+{
+public:
+  /** @return Atom of the string, it is created if the string was not interned yet */
+  static const Atom* intern(const String &name);
+  /** @return Atom of the string, or null if the string was not interned */
+  static const Atom* find(const String &name);
+  /** @return Number of the interned strings */
+  static size_t size();
+};
+
+#endif
@@ -196,6 +196,25 @@ CString::~CString()
   if (type == ST_UTF8) delete[] stream_wstr;
 }
 
+const wchar* CString::getWBuffer() const
+{
+  const wchar* buf = nullptr;
+  switch (type) {
+    case ST_UTF16:
+      buf = wstr;
+      break;
+    case ST_UTF8:
+      buf = stream_wstr;
+      break;
+    case ST_CSTRING:
+      buf = cstr->getWBuffer();
+      break;
+    default:
+      break;
+  }
+  return buf ? buf + start : nullptr;
+}
+
 wchar CString::operator[](size_t i) const
 {
   if (i < len) switch (type) {
@@ -93,6 +93,7 @@ public:
 
   wchar operator[](size_t i) const override;
   size_t length() const override;
+  const wchar* getWBuffer() const override;
 
 protected:
   enum EStreamType {
@@ -52,8 +52,88 @@ public:
 
   /** @deprecated For debug purposes only. */
   static int sizeofTables();
+
+private:
+  /** Latin-1 symbols properties bits. */
+  enum {
+    LP_LOWER = 0x01,
+    LP_UPPER = 0x02,
+    LP_LETTER = 0x04,
+    LP_DIGIT = 0x08,
+    LP_SPACE = 0x10,
+    LP_WHITESPACE = 0x20
+  };
+  // Latin-1 symbols are looked up in these tables,
+  // generated from the generic Unicode tables
+  static const unsigned char latin1Props[0x100];
+  static const wchar latin1Lower[0x100];
+  static const wchar latin1Upper[0x100];
+
+  static wchar toLowerCaseUnicode(wchar c);
+  static wchar toUpperCaseUnicode(wchar c);
+  static bool isLowerCaseUnicode(wchar c);
+  static bool isUpperCaseUnicode(wchar c);
+  static bool isLetterUnicode(wchar c);
+  static bool isLetterOrDigitUnicode(wchar c);
+  static bool isDigitUnicode(wchar c);
+  static bool isSpaceCharUnicode(wchar c);
+  static bool isWhitespaceUnicode(wchar c);
 };
 
+inline wchar Character::toLowerCase(wchar c)
+{
+  if (c < 0x100) return latin1Lower[c];
+  return toLowerCaseUnicode(c);
+}
+
+inline wchar Character::toUpperCase(wchar c)
+{
+  if (c < 0x100) return latin1Upper[c];
+  return toUpperCaseUnicode(c);
+}
+
+inline bool Character::isLowerCase(wchar c)
+{
+  if (c < 0x100) return (latin1Props[c] & LP_LOWER) != 0;
+  return isLowerCaseUnicode(c);
+}
+
+inline bool Character::isUpperCase(wchar c)
+{
+  if (c < 0x100) return (latin1Props[c] & LP_UPPER) != 0;
+  return isUpperCaseUnicode(c);
+}
+
+inline bool Character::isLetter(wchar c)
+{
+  if (c < 0x100) return (latin1Props[c] & LP_LETTER) != 0;
+  return isLetterUnicode(c);
+}
+
+inline bool Character::isLetterOrDigit(wchar c)
+{
+  if (c < 0x100) return (latin1Props[c] & (LP_LETTER | LP_DIGIT)) != 0;
+  return isLetterOrDigitUnicode(c);
+}
+
+inline bool Character::isDigit(wchar c)
+{
+  if (c < 0x100) return (latin1Props[c] & LP_DIGIT) != 0;
+  return isDigitUnicode(c);
+}
+
+inline bool Character::isSpaceChar(wchar c)
+{
+  if (c < 0x100) return (latin1Props[c] & LP_SPACE) != 0;
+  return isSpaceCharUnicode(c);
+}
+
+inline bool Character::isWhitespace(wchar c)
+{
+  if (c < 0x100) return (latin1Props[c] & LP_WHITESPACE) != 0;
+  return isWhitespaceUnicode(c);
+}
+
 #endif
 
 
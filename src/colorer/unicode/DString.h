@@ -36,6 +36,7 @@ public:
 
   wchar operator[](size_t i) const override;
   size_t length() const override;
+  const wchar* getWBuffer() const override;
 
   const SString* str;
   size_t start;
@@ -98,6 +99,12 @@ inline size_t DString::length() const
   return len;
 }
 
+inline const wchar* DString::getWBuffer() const
+{
+  const wchar* buf = str->getWBuffer();
+  return buf ? buf + start : nullptr;
+}
+
 #endif
 
 
@@ -51,6 +51,7 @@ public:
 
   wchar operator[](size_t i) const override;
   size_t length() const override;
+  const wchar* getWBuffer() const override;
 
   /** Appends to this string buffer @c string */
   SString &append(const String &string, size_t maxlen = (size_t)-1);
@@ -121,6 +122,11 @@ inline wchar SString::operator[](size_t i) const
   return wstr[i];
 }
 
+inline const wchar* SString::getWBuffer() const
+{
+  return wstr.get();
+}
+
 #include <unordered_map>
 namespace std
 {
@@ -37,6 +37,37 @@ extern "C" int strnicmp(const char* c1, const char* c2, unsigned int len)
 }
 #endif
 
+/** Compares symbols of two strings, accessed either by their
+    buffers, or by String interface.
+*/
+template <class S1, class S2>
+static int compareSymbols(const S1 &s1, size_t l1, const S2 &s2, size_t l2)
+{
+  size_t i;
+  for (i = 0; i < l1 && i < l2; i++) {
+    int cmp = s1[i] - s2[i];
+    if (cmp > 0) return -1;
+    if (cmp < 0) return 1;
+  }
+  if (i < l1) return -1;
+  if (i < l2) return 1;
+  return 0;
+}
+
+template <class S1, class S2>
+static int compareSymbolsIgnoreCase(const S1 &s1, size_t l1, const S2 &s2, size_t l2)
+{
+  size_t i;
+  for (i = 0; i < l1 && i < l2; i++) {
+    int cmp = Character::toLowerCase(s1[i]) - Character::toLowerCase(s2[i]);
+    if (cmp > 0) return -1;
+    if (cmp < 0) return 1;
+  }
+  if (i < l1) return -1;
+  if (i < l2) return 1;
+  return 0;
+}
+
 String::String()
 {
   ret_char_val = nullptr;
@@ -52,17 +83,13 @@ String::~String()
 bool String::operator==(const String &str) const
 {
   if (str.length() != length()) return false;
-  for (size_t i = 0; i < str.length(); i++)
-    if (str[i] != (*this)[i]) return false;
-  return true;
+  return compareTo(str) == 0;
 }
 
 bool String::operator!=(const String &str) const
 {
-  if (str.length() != this->length()) return true;
-  for (size_t i = 0; i < str.length(); i++)
-    if (str[i] != (*this)[i]) return true;
-  return false;
+  if (str.length() != length()) return true;
+  return compareTo(str) != 0;
 }
 
 bool String::equals(const String* str) const
@@ -82,32 +109,18 @@ bool String::equalsIgnoreCase(const String* str) const
 
 int String::compareTo(const String &str) const
 {
-  size_t i;
-  size_t sl = str.length();
-  size_t l = length();
-  for (i = 0; i < sl && i < l; i++) {
-    int cmp = str[i] - (*this)[i];
-    if (cmp > 0) return -1;
-    if (cmp < 0) return 1;
-  }
-  if (i < sl) return -1;
-  if (i < l) return 1;
-  return 0;
+  const wchar* sbuf = str.getWBuffer();
+  const wchar* buf = getWBuffer();
+  if (sbuf && buf) return compareSymbols(sbuf, str.length(), buf, length());
+  return compareSymbols(str, str.length(), *this, length());
 }
 
 int String::compareToIgnoreCase(const String &str) const
 {
-  size_t i;
-  size_t sl = str.length();
-  size_t l = length();
-  for (i = 0; i < sl && i < l; i++) {
-    int cmp = Character::toLowerCase(str[i]) - Character::toLowerCase((*this)[i]);
-    if (cmp > 0) return -1;
-    if (cmp < 0) return 1;
-  }
-  if (i < sl) return -1;
-  if (i < l) return 1;
-  return 0;
+  const wchar* sbuf = str.getWBuffer();
+  const wchar* buf = getWBuffer();
+  if (sbuf && buf) return compareSymbolsIgnoreCase(sbuf, str.length(), buf, length());
+  return compareSymbolsIgnoreCase(str, str.length(), *this, length());
 }
 
 size_t String::getWChars(wchar** chars) const
@@ -164,11 +177,22 @@ const wchar* String::getWChars() const
   return ret_wchar_val;
 }
 
+const wchar* String::getWBuffer() const
+{
+  return nullptr;
+}
+
 size_t String::indexOf(wchar wc, size_t pos) const
 {
   size_t idx;
-  for (idx = pos; idx < this->length() && (*this)[idx] != wc; idx++) {}
-  return idx == this->length() ? npos : idx;
+  size_t len = this->length();
+  const wchar* buf = getWBuffer();
+  if (buf) {
+    for (idx = pos; idx < len && buf[idx] != wc; idx++) {}
+  } else {
+    for (idx = pos; idx < len && (*this)[idx] != wc; idx++) {}
+  }
+  return idx == len ? npos : idx;
 }
 
 size_t String::indexOf(const String &str, size_t pos) const
@@ -225,8 +249,14 @@ size_t String::hashCode() const
 {
   size_t hc = 0;
   size_t len = length();
-  for (size_t i = 0; i < len; i++)
-    hc = 31 * hc + (*this)[i];
+  const wchar* buf = getWBuffer();
+  if (buf) {
+    for (size_t i = 0; i < len; i++)
+      hc = 31 * hc + buf[i];
+  } else {
+    for (size_t i = 0; i < len; i++)
+      hc = 31 * hc + (*this)[i];
+  }
   return hc;
 }
 
@@ -49,6 +49,11 @@ public:
   virtual const char *getChars(int encoding = -1) const;
   /** Returns string content in internally supported unicode character array */
   virtual const wchar *getWChars() const;
+  /** Returns pointer to the string's own contiguous unicode characters buffer
+      without copying, or nullptr, if string has no such storage.
+      Pointer is valid until the string is changed.
+  */
+  virtual const wchar *getWBuffer() const;
 
   /** Searches first index of char @c wc, starting from @c pos */
   virtual size_t indexOf(wchar wc, size_t pos = 0) const;
@@ -2,14 +2,17 @@
 #include <xercesc/util/BinFileInputStream.hpp>
 
 std::unordered_map<SString, SharedXmlInputSource*>* SharedXmlInputSource::isHash = nullptr;
+std::mutex SharedXmlInputSource::isHashMutex;
 
 int SharedXmlInputSource::addref()
 {
+  std::lock_guard<std::mutex> lock(isHashMutex);
   return ++ref_count;
 }
 
 int SharedXmlInputSource::delref()
 {
+  std::lock_guard<std::mutex> lock(isHashMutex);
   ref_count--;
   if (ref_count <= 0) {
     delete this;
@@ -44,6 +47,7 @@ SharedXmlInputSource* SharedXmlInputSource::getSharedInputSource(const XMLCh* pa
 {
   uXmlInputSource tempis = XmlInputSource::newInstance(path, base);
 
+  std::lock_guard<std::mutex> lock(isHashMutex);
   if (isHash == nullptr) {
     isHash = new std::unordered_map<SString, SharedXmlInputSource*>();
   }
@@ -52,7 +56,7 @@ SharedXmlInputSource* SharedXmlInputSource::getSharedInputSource(const XMLCh* pa
   auto s = isHash->find(d_id);
   if (s != isHash->end()) {
     SharedXmlInputSource* sis = s->second;
-    sis->addref();
+    ++sis->ref_count;
     return sis;
   } else {
     auto* sis = new SharedXmlInputSource(tempis);
@@ -1,6 +1,7 @@
 #ifndef _COLORER_SHAREDXMLINPUTSOURCE_H_
 #define _COLORER_SHAREDXMLINPUTSOURCE_H_
 
+#include <mutex>
 #include <colorer/Common.h>
 #include <xercesc/sax/InputSource.hpp>
 #include <colorer/xml/XmlInputSource.h>
@@ -24,6 +25,8 @@ private:
   ~SharedXmlInputSource();
 
   static std::unordered_map<SString, SharedXmlInputSource*>* isHash;
+  // guards the hash and the reference counters, sources are created by parallel HRC loading
+  static std::mutex isHashMutex;
 
   uXmlInputSource input_source;
   int ref_count;
@@ -1,4 +1,6 @@
 #include <time.h>
+#include <algorithm>
+#include <thread>
 #include <colorer/parsers/ParserFactory.h>
 #include <colorer/editor/BaseEditor.h>
 #include <colorer/viewer/TextLinesStore.h>
@@ -17,9 +19,12 @@
 
 using namespace xercesc;
 
+// lines of the parse window per parse thread, so each thread gets a parallel chunk
+static const int PARSE_WINDOW_LINES = 2048;
+
 ConsoleTools::ConsoleTools(): copyrightHeader(true), htmlEscaping(true), bomOutput(true), htmlWrapping(true), lineNumbers(false),
-  inputEncodingIndex(-1), outputEncodingIndex(-1), inputEncoding(nullptr), outputEncoding(nullptr), typeDescription(nullptr), catalogPath(nullptr), hrdName(nullptr),
-  outputFileName(nullptr), inputFileName(nullptr)
+  inputEncodingIndex(-1), outputEncodingIndex(-1), inputEncoding(nullptr), outputEncoding(nullptr), typeDescription(nullptr), catalogPath(nullptr), hrcImagePath(nullptr), hrdName(nullptr),
+  outputFileName(nullptr), inputFileName(nullptr), loadThreads(1)
 {
 }
 
@@ -102,6 +107,16 @@ void ConsoleTools::setCatalogPath(const String &str)
 #endif
 }
 
+void ConsoleTools::setHrcImagePath(const String &str)
+{
+  hrcImagePath.reset(new SString(str));
+}
+
+void ConsoleTools::setLoadThreads(int threads)
+{
+  loadThreads = threads;
+}
+
 void ConsoleTools::setHRDName(const String &str)
 {
   hrdName.reset(new SString(str));
@@ -212,9 +227,13 @@ void ConsoleTools::listTypes(bool load, bool useNames)
   try {
     writer = new StreamWriter(stdout, outputEncodingIndex, bomOutput);
     ParserFactory pf;
-    pf.loadCatalog(catalogPath.get());
+    pf.getHRCParser()->setLoadThreads(loadThreads);
+    pf.loadCatalog(catalogPath.get(), hrcImagePath.get());
     HRCParser* hrcParser = pf.getHRCParser();
     fprintf(stderr, "\nloading file types...\n");
+    if (load) {
+      hrcParser->loadAllTypes();
+    }
     for (int idx = 0;; idx++) {
       FileType* type = hrcParser->enumerateFileTypes(idx);
       if (type == nullptr) {
@@ -230,9 +249,6 @@ void ConsoleTools::listTypes(bool load, bool useNames)
         writer->write(CString("\n"));
       }
 
-      if (load) {
-        type->getBaseScheme();
-      }
     }
     delete writer;
   } catch (Exception &e) {
@@ -241,6 +257,18 @@ void ConsoleTools::listTypes(bool load, bool useNames)
   }
 }
 
+void ConsoleTools::buildHrcImage()
+{
+  if (outputFileName == nullptr) {
+    throw Exception(CString("Output file for HRC image is not specified"));
+  }
+  ParserFactory pf;
+  pf.getHRCParser()->setLoadThreads(loadThreads);
+  pf.loadCatalog(catalogPath.get());
+  pf.saveHrcImage(outputFileName.get());
+  fprintf(stderr, "HRC image is written into '%s'\n", outputFileName->getChars());
+}
+
 FileType* ConsoleTools::selectType(HRCParser* hrcParser, LineSource* lineSource)
 {
   FileType* type = nullptr;
@@ -294,13 +322,14 @@ FileType* ConsoleTools::selectType(HRCParser* hrcParser, LineSource* lineSource)
   return type;
 }
 
-void ConsoleTools::profile(int loopCount)
+void ConsoleTools::profile(int loopCount, bool rulesReport)
 {
   clock_t msecs;
 
   // parsers factory
   ParserFactory pf;
-  pf.loadCatalog(catalogPath.get());
+  pf.getHRCParser()->setLoadThreads(loadThreads);
+  pf.loadCatalog(catalogPath.get(), hrcImagePath.get());
   // Source file text lines store.
   TextLinesStore textLinesStore;
   textLinesStore.loadFile(inputFileName.get(), inputEncoding.get(), true);
@@ -312,6 +341,10 @@ void ConsoleTools::profile(int loopCount)
   FileType* type = selectType(pf.getHRCParser(), &textLinesStore);
   type->getBaseScheme();
   baseEditor.setFileType(type);
+  if (rulesReport) {
+    pf.getHRCParser()->resetRuleProfiles();
+    baseEditor.setProfiling(true);
+  }
 
   msecs = clock();
   while (loopCount--) {
@@ -322,6 +355,33 @@ void ConsoleTools::profile(int loopCount)
   msecs = clock() - msecs;
 
   printf("%ld\n", (msecs * 1000) / CLOCKS_PER_SEC);
+  if (rulesReport) {
+    printRulesReport(pf.getHRCParser());
+  }
+}
+
+void ConsoleTools::printRulesReport(HRCParser* hrcParser)
+{
+  static const size_t REPORT_RULES = 50;
+  static const char* kindNames[] = { "regexp", "block start", "block end", "keywords" };
+
+  std::vector<RuleProfile> profiles;
+  hrcParser->getRuleProfiles(profiles);
+  std::sort(profiles.begin(), profiles.end(), [](const RuleProfile &a, const RuleProfile &b) {
+    return a.time > b.time;
+  });
+  long long totalTime = 0;
+  for (const auto &p : profiles) {
+    totalTime += p.time;
+  }
+
+  printf("\n%10s %6s %12s %10s %14s  %s\n", "time, ms", "%", "attempts", "matches", "steps", "rule");
+  for (size_t idx = 0; idx < profiles.size() && idx < REPORT_RULES; idx++) {
+    const RuleProfile &p = profiles[idx];
+    printf("%10.3f %6.2f %12lld %10lld %14lld  %s #%d %s (%s)\n", p.time / 1e6, totalTime ? p.time * 100.0 / totalTime : 0.0,
+           p.attempts, p.matches, p.steps, p.scheme->getName()->getChars(), p.rule, kindNames[p.kind],
+           p.location ? p.location->getChars() : "");
+  }
 }
 
 void ConsoleTools::viewFile()
@@ -332,7 +392,8 @@ void ConsoleTools::viewFile()
     textLinesStore.loadFile(inputFileName.get(), inputEncoding.get(), true);
     // parsers factory
     ParserFactory pf;
-    pf.loadCatalog(catalogPath.get());
+    pf.getHRCParser()->setLoadThreads(loadThreads);
+    pf.loadCatalog(catalogPath.get(), hrcImagePath.get());
     // Base editor to make primary parse
     BaseEditor baseEditor(&pf, &textLinesStore);
     // HRD RegionMapper linking
@@ -393,7 +454,8 @@ void ConsoleTools::genOutput(bool useTokens)
     textLinesStore.loadFile(inputFileName.get(), inputEncoding.get(), true);
     // parsers factory
     ParserFactory pf;
-    pf.loadCatalog(catalogPath.get());
+    pf.getHRCParser()->setLoadThreads(loadThreads);
+    pf.loadCatalog(catalogPath.get(), hrcImagePath.get());
     // HRC loading
     HRCParser* hrcParser = pf.getHRCParser();
     // HRD RegionMapper creation
@@ -414,6 +476,12 @@ void ConsoleTools::genOutput(bool useTokens)
     baseEditor.setRegionCompact(true);
     baseEditor.setRegionMapper(mapper);
     baseEditor.lineCountEvent(textLinesStore.getLineCount());
+    // With -j the text is parsed in larger windows, which are split between the threads
+    int parseThreads = loadThreads > 0 ? loadThreads : std::max(1, (int)std::thread::hardware_concurrency());
+    if (parseThreads > 1) {
+      baseEditor.visibleTextEvent(0, parseThreads * PARSE_WINDOW_LINES);
+      baseEditor.setParseThreads(parseThreads);
+    }
     // Choosing file type
     FileType* type = selectType(hrcParser, &textLinesStore);
     baseEditor.setFileType(type);
@@ -63,6 +63,10 @@ public:
   void setOutputEncoding(const String &str);
   /// Optional path to base catalog.xml
   void setCatalogPath(const String &str);
+  /// Optional path to precompiled HRC database image, used instead of HRC files
+  void setHrcImagePath(const String &str);
+  /// Number of threads, used to load HRC files and parse text, 0 - number of the processor cores
+  void setLoadThreads(int threads);
   /// Optional HRD instance name, used to perform parsing
   void setHRDName(const String &str);
   /// Sets linking datasource into this filename
@@ -82,14 +86,20 @@ public:
       Prints into standard output number of msecs, used.
 
       @param loopCount Number of times to repeat file's parsing.
+      @param rulesReport Prints also the HRC rules, which take the most of the parse time.
   */
-  void profile(int loopCount);
+  void profile(int loopCount, bool rulesReport = false);
 
   /** Lists all available HRC types and
       optionally tries to load them.
   */
   void listTypes(bool load, bool useNames);
 
+  /** Loads all HRC types and writes precompiled
+      HRC database image into the output file.
+  */
+  void buildHrcImage();
+
 
   FileType* selectType(HRCParser* hrcParser, LineSource* lineSource);
 
@@ -114,6 +124,8 @@ public:
    */
   void genTokenOutput();
 private:
+  void printRulesReport(HRCParser* hrcParser);
+
   bool copyrightHeader;
   bool htmlEscaping;
   bool bomOutput;
@@ -127,9 +139,11 @@ private:
 
   std::unique_ptr<String> typeDescription;
   std::unique_ptr<String> catalogPath;
+  std::unique_ptr<String> hrcImagePath;
   std::unique_ptr<String> hrdName;
   std::unique_ptr<String> outputFileName;
   std::unique_ptr<String> inputFileName;
+  int loadThreads;
 
   std::unordered_map<SString, String*> docLinkHash;
 };
@@ -9,13 +9,14 @@
 
 /** Internal run action type */
 enum JobType { JT_NOTHING, JT_REGTEST, JT_PROFILE,
-               JT_LIST_LOAD, JT_LIST_TYPES, JT_LIST_TYPE_NAMES,
+               JT_LIST_LOAD, JT_LIST_TYPES, JT_LIST_TYPE_NAMES, JT_BUILD_IMAGE,
                JT_VIEW, JT_GEN, JT_GEN_TOKENS, JT_FORWARD
              };
 
 struct setting {
   JobType job = JT_NOTHING;
   std::unique_ptr<SString> catalog;
+  std::unique_ptr<SString> hrc_image;
   std::unique_ptr<SString> input_file;
   std::unique_ptr<SString> output_file;
   std::unique_ptr<SString> link_sources;
@@ -27,6 +28,8 @@ struct setting {
   std::string log_file_dir = "./";
   std::string log_level = "off";
   int profile_loops = 1;
+  int load_threads = 1;
+  bool profile_rules = false;
   bool line_numbers = false;
   bool copyright = true;
   bool bom_output = true;
@@ -44,6 +47,14 @@ void readArgs(int argc, char* argv[])
       continue;
     }
 
+    if (argv[i][1] == 'p' && argv[i][2] == 'r') {
+      settings.job = JT_PROFILE;
+      settings.profile_rules = true;
+      if (argv[i][3]) {
+        settings.profile_loops = atoi(argv[i] + 3);
+      }
+      continue;
+    }
     if (argv[i][1] == 'p') {
       settings.job = JT_PROFILE;
       if (argv[i][2]) {
@@ -55,6 +66,10 @@ void readArgs(int argc, char* argv[])
       settings.job = JT_REGTEST;
       continue;
     }
+    if (argv[i][1] == 'b') {
+      settings.job = JT_BUILD_IMAGE;
+      continue;
+    }
     if (argv[i][1] == 'f') {
       settings.job = JT_FORWARD;
       continue;
@@ -150,6 +165,19 @@ void readArgs(int argc, char* argv[])
       }
       continue;
     }
+    if (argv[i][1] == 'u' && (i + 1 < argc || argv[i][2])) {
+      if (argv[i][2]) {
+        settings.hrc_image = std::make_unique<SString>(CString(argv[i] + 2));
+      } else {
+        settings.hrc_image = std::make_unique<SString>(CString(argv[i + 1]));
+        i++;
+      }
+      continue;
+    }
+    if (argv[i][1] == 'j') {
+      settings.load_threads = atoi(argv[i] + 2);
+      continue;
+    }
     if (argv[i][1] == 'e' && argv[i][2] == 'i' && (i + 1 < argc || argv[i][3])) {
       if (argv[i][3]) {
         settings.input_encoding = std::make_unique<SString>(CString(argv[i] + 3));
@@ -215,9 +243,13 @@ void printError()
           "  -ht        Generates plain coloring from <filename> using tokens output\n"
           "  -v         Runs viewer on file <fname> (uses 'console' hrd class)\n"
           "  -p<n>      Runs parser in profile mode (if <n> specified, makes <n> loops)\n"
+          "  -pr<n>     Runs parser in profile mode and prints the most expensive HRC rules\n"
           "  -f         Forwards input file into output with specified encodings\n"
+          "  -b         Builds precompiled HRC database image into the output file (-o)\n"
           " Parameters:\n"
           "  -c<path>   Uses specified 'catalog.xml' file\n"
+          "  -u<path>   Uses precompiled HRC database image instead of HRC files\n"
+          "  -j<n>      Loads HRC files and parses text in <n> threads (if <n> not specified, uses all processor cores)\n"
           "  -i<name>   Loads specified hrd rules from catalog\n"
           "  -t<type>   Tries to use type <type> instead of type autodetection\n"
           "  -ls<name>  Use file <name> as input linking data source for href generation\n"
@@ -244,6 +276,9 @@ void initConsoleTools(ConsoleTools &ct)
   if (settings.catalog) {
     ct.setCatalogPath(*settings.catalog);
   }
+  if (settings.hrc_image) {
+    ct.setHrcImagePath(*settings.hrc_image);
+  }
   if (settings.link_sources) {
     ct.setLinkSource(*settings.link_sources);
   }
@@ -262,6 +297,7 @@ void initConsoleTools(ConsoleTools &ct)
   if (settings.hrd_name) {
     ct.setHRDName(*settings.hrd_name);
   }
+  ct.setLoadThreads(settings.load_threads);
   ct.addLineNumbers(settings.line_numbers);
   ct.setCopyrightHeader(settings.copyright);
   ct.setHtmlEscaping(settings.html_esc);
@@ -286,7 +322,7 @@ int workIt()
         ct.RETest();
         break;
       case JT_PROFILE:
-        ct.profile(settings.profile_loops);
+        ct.profile(settings.profile_loops, settings.profile_rules);
         break;
       case JT_LIST_LOAD:
         ct.listTypes(true, false);
@@ -297,6 +333,9 @@ int workIt()
       case JT_LIST_TYPE_NAMES:
         ct.listTypes(false, true);
         break;
+      case JT_BUILD_IMAGE:
+        ct.buildHrcImage();
+        break;
       case JT_VIEW:
         ct.viewFile();
         break;